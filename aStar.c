@@ -1,11 +1,14 @@
 #include "aStar.h"
-#include "mkGr.h"
+#include "arcBatch.h"
+#include "landmarks.h"
 #include "myFunctions.h"
 #include <assert.h>
+#include <float.h>
 #include <inttypes.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /*  DIS2NODES
  *
@@ -14,15 +17,16 @@
  *  particular, we will use the haversine formula.
  *
  *  Input:
- *      n1,n2: nodes to compute the distance between.
+ *      graph: graph of the nodes.
+ *      n1,n2: positions of the nodes to compute the distance between.
  *
  *  Return: approximate distance.
  */
-double dis2nodes(node_t n1, node_t n2){
-    double lat1 = n1.lat*DEG2RAD;
-    double lat2 = n2.lat*DEG2RAD;
-    double lon1 = n1.lon*DEG2RAD;
-    double lon2 = n2.lon*DEG2RAD;
+double dis2nodes(const graph_t *graph, uint32_t n1, uint32_t n2){
+    double lat1 = graph->lat[n1]*(DEG2RAD/COORD_SCALE);
+    double lat2 = graph->lat[n2]*(DEG2RAD/COORD_SCALE);
+    double lon1 = graph->lon[n1]*(DEG2RAD/COORD_SCALE);
+    double lon2 = graph->lon[n2]*(DEG2RAD/COORD_SCALE);
     double dlat = lat1-lat2;
     double dlon = lon1-lon2;
     double slat = sin(dlat*0.5);
@@ -41,54 +45,114 @@ double dis2nodes(node_t n1, node_t n2){
  *  particular, we will use the haversine formula.
  *
  *  Input:
- *      currentNode: current node to find heuristic distance.
- *      destinationNode: destination node.
+ *      graph: graph of the nodes.
+ *      currentNode: position of current node to find heuristic distance.
+ *      destinationNode: position of destination node.
+ *      data: unused.
  *
  *  Return: heuristic distance.
  */
-double heuristic1(node_t currentNode, node_t destinationNode){
-    double lat1 = currentNode.lat*DEG2RAD;
-    double lat2 = destinationNode.lat*DEG2RAD;
-    double lon1 = currentNode.lon*DEG2RAD;
-    double lon2 = destinationNode.lon*DEG2RAD;
+double heuristic1(const graph_t *graph, uint32_t currentNode,
+                  uint32_t destinationNode, const void *data){
+    double lat1 = graph->lat[currentNode]*(DEG2RAD/COORD_SCALE);
+    double lat2 = graph->lat[destinationNode]*(DEG2RAD/COORD_SCALE);
+    double lon1 = graph->lon[currentNode]*(DEG2RAD/COORD_SCALE);
+    double lon2 = graph->lon[destinationNode]*(DEG2RAD/COORD_SCALE);
     double dlat = lat1-lat2;
     double dlon = lon1-lon2;
     double slat = sin(dlat*0.5);
     double slon = sin(dlon*0.5);
 
+    (void)data;
     return 2.*asin(sqrt(POW2(slat)+
            cos(lat1)*cos(lat2)*
            POW2(slon)))*EARTH_RADIUS;
 }
 
+/*  HEURISTICCHORD
+ *
+ *  Heuristic function for the a* algorithm using the precomputed
+ *  unit vectors of the nodes. The chord between two points of
+ *  the sphere is never longer than the great circle arc, so it
+ *  is an admissible and consistent lower bound which needs no
+ *  trigonometric function. It is scaled by CHORD_SAFETY so
+ *  rounding can not push it over the arc.
+ *
+ *  Input:
+ *      graph: graph of the nodes.
+ *      currentNode: position of current node to find heuristic distance.
+ *      destinationNode: position of destination node.
+ *      data: unused.
+ *
+ *  Return: heuristic distance.
+ */
+double heuristicChord(const graph_t *graph, uint32_t currentNode,
+                      uint32_t destinationNode, const void *data){
+    const double *u1 = graph->unit+3*currentNode;
+    const double *u2 = graph->unit+3*destinationNode;
+
+    (void)data;
+    return sqrt(POW2(u1[0]-u2[0])+POW2(u1[1]-u2[1])+POW2(u1[2]-u2[2]))*
+           (EARTH_RADIUS*CHORD_SAFETY);
+}
+
+/*  GETHEURISTIC
+ *
+ *  Returns the heuristic function of a heuristic type.
+ *
+ *  Input:
+ *      heuristic: heuristic type (enum heuristicType).
+ *
+ *  Return: pointer to the heuristic function.
+ */
+heuristic_f getHeuristic(uint8_t heuristic){
+    switch(heuristic){
+        case CHORD_HEURISTIC:
+            return heuristicChord;
+        case ALT_HEURISTIC:
+            return heuristicALT;
+        default:
+            return heuristic1;
+    }
+}
+
+/*  WRITESTATSJSON
+ *
+ *  Writes the counters of a search as a JSON object.
+ *
+ *  Input:
+ *      out: stream to write to.
+ *      stats: counters to write.
+ */
+void writeStatsJSON(FILE *out, const AStarStats_t *stats){
+    fprintf(out,"{\"expanded\":%"PRIu64",\"relaxed\":%"PRIu64",\"decreased\":%"PRIu64","
+                "\"reopened\":%"PRIu64",\"pushed\":%"PRIu64",\"popped\":%"PRIu64","
+                "\"max_open\":%"PRIu64",\"tile_faults\":%"PRIu64"}",
+            stats->expanded,stats->relaxed,stats->decreased,stats->reopened,
+            stats->pushed,stats->popped,stats->maxOpen,stats->tileFaults);
+}
+
 /*  FINDNODE
  *
- *  Finds node position in vector given its ID. If it is not
- *  found it returns -1.
+ *  Finds node position in vector given its ID, with the id index
+ *  of the graph. If it is not found it returns UINT32_MAX.
  *
  *  Input:
- *      nodes: vector of nodes.
- *      nNodes: number of nodes in vector.
+ *      graph: graph with its id index.
  *      targetId: ID to look for.
  *
  *  Return: position of the node with input ID. If not found it
- *          returns -1.
- */
-uint32_t findNode(node_t *nodes, uint32_t nNodes, uint32_t targetId){
-    node_t auxNode, *resultNode;
-    auxNode.id = targetId;
-    resultNode = bsearch(&auxNode,nodes,nNodes,sizeof(node_t),compare_id);
-    if(resultNode == NULL)
-        return -1;
-    else
-        return (resultNode-nodes);
+ *          returns UINT32_MAX.
+ */
+uint32_t findNode(const graph_t *graph, uint32_t targetId){
+    return graph_find(graph,targetId);
 }
 
 /*  INSERTNODETOQUEUE
  *
  *  Puts node into queue dynamic list in a sorted way,
  *  from smallest f to biggest f, obtained from status.
- *  
+ *  The list may be empty (*queue NULL).
  *
  *  Input:
  *      queue: queue pointer to pointer of the first element.
@@ -101,14 +165,16 @@ void insertNodeToQueue(queue_t **queue,uint32_t nodeId,
     auxQueue = malloc(sizeof(queue_t)); assert(auxQueue);
     auxQueue->id = nodeId;
     //Insert at the begining
-    if(status[(*queue)->id].f >= status[nodeId].f){
+    if(*queue == NULL ||
+       status[(*queue)->id].g+status[(*queue)->id].h >= status[nodeId].g+status[nodeId].h){
         auxQueue->next = *queue;
         *queue = auxQueue;
     //Insert somewhere else
     }else{
         queueIterator = *queue;
         while(queueIterator->next != NULL && 
-              status[queueIterator->next->id].f < status[nodeId].f)
+              status[queueIterator->next->id].g+status[queueIterator->next->id].h <
+              status[nodeId].g+status[nodeId].h)
             queueIterator = queueIterator->next;
         auxQueue->next = queueIterator->next;
         queueIterator->next = auxQueue;
@@ -143,85 +209,869 @@ void deleteNodefromQueue(queue_t **queue, uint32_t nodeId){
     }
 }
 
-/*  ASTARALGORITHM
+/*  HEAPSIFTUP
  *
- *  Given a startin node and a target node in the graph, the a-star
- *  algorithm is applied to find a path between them, trying to make
- *  it as short as possible. The path can be reconstructed from the
- *  AStarStatus vector after its completation. 
+ *  Moves element at position i up the heap until its parent
+ *  has a smaller or equal key.
+ *
+ *  Input:
+ *      heap: heap to modify.
+ *      i: heap position of the element.
+ */
+static void heapSiftUp(heap_t *heap, uint32_t i){
+    heapElem_t elem = heap->elems[i];
+    uint32_t parent;
+
+    while(i > 0){
+        parent = (i-1)>>2;
+        if(heap->elems[parent].f <= elem.f)
+            break;
+        heap->elems[i] = heap->elems[parent];
+        heap->pos[heap->elems[i].id] = i;
+        i = parent;
+    }
+    heap->elems[i] = elem;
+    heap->pos[elem.id] = i;
+}
+
+/*  HEAPSIFTDOWN
+ *
+ *  Moves element at position i down the heap until all its
+ *  children have a bigger or equal key.
+ *
+ *  Input:
+ *      heap: heap to modify.
+ *      i: heap position of the element.
+ */
+static void heapSiftDown(heap_t *heap, uint32_t i){
+    heapElem_t elem = heap->elems[i];
+    uint32_t child, best, last;
+
+    while((child = (i<<2)+1) < heap->size){
+        //Smallest of the (up to) four children
+        best = child;
+        last = child+4 < heap->size ? child+4 : heap->size;
+        for(child++; child<last; child++)
+            if(heap->elems[child].f < heap->elems[best].f)
+                best = child;
+        if(elem.f <= heap->elems[best].f)
+            break;
+        heap->elems[i] = heap->elems[best];
+        heap->pos[heap->elems[i].id] = i;
+        i = best;
+    }
+    heap->elems[i] = elem;
+    heap->pos[elem.id] = i;
+}
+
+/*  HEAPCREATE
+ *
+ *  Allocates an empty indexed heap able to hold every node of
+ *  the graph, so no allocation is needed during the search.
+ *
+ *  Input:
+ *      heap: heap to initialize.
+ *      nNodes: number of nodes in graph.
+ */
+void heapCreate(heap_t *heap, uint32_t nNodes){
+    heap->elems = malloc(sizeof(heapElem_t)*nNodes); assert(heap->elems != NULL || nNodes == 0);
+    heap->pos = malloc(sizeof(uint32_t)*nNodes); assert(heap->pos != NULL || nNodes == 0);
+    heap->size = 0;
+}
+
+/*  HEAPFREE
+ *
+ *  Frees the memory of the heap.
+ *
+ *  Input:
+ *      heap: heap to free.
+ */
+void heapFree(heap_t *heap){
+    free(heap->elems);
+    free(heap->pos);
+    heap->size = 0;
+}
+
+/*  HEAPPUSH
+ *
+ *  Inserts node into the heap with key f. The node must
+ *  not be in the heap.
+ *
+ *  Input:
+ *      heap: heap to modify.
+ *      nodeId: node position to insert.
+ *      f: key of the node.
+ */
+void heapPush(heap_t *heap, uint32_t nodeId, double f){
+    heap->elems[heap->size].f = f;
+    heap->elems[heap->size].id = nodeId;
+    heap->size++;
+    heapSiftUp(heap,heap->size-1);
+}
+
+/*  HEAPPOP
+ *
+ *  Removes the element with smallest key from the heap.
+ *  User must be sure that the heap is not empty.
+ *
+ *  Input:
+ *      heap: heap to modify.
+ *
+ *  Return: node position with smallest key.
+ */
+uint32_t heapPop(heap_t *heap){
+    uint32_t nodeId = heap->elems[0].id;
+
+    heap->size--;
+    if(heap->size > 0){
+        heap->elems[0] = heap->elems[heap->size];
+        heapSiftDown(heap,0);
+    }
+    return nodeId;
+}
+
+/*  HEAPDECREASEKEY
+ *
+ *  Lowers the key of a node already in the heap.
+ *
+ *  Input:
+ *      heap: heap to modify.
+ *      nodeId: node position whose key decreases.
+ *      f: new key, not bigger than the old one.
+ */
+void heapDecreaseKey(heap_t *heap, uint32_t nodeId, double f){
+    uint32_t i = heap->pos[nodeId];
+    heap->elems[i].f = f;
+    heapSiftUp(heap,i);
+}
+
+/*  QUEUESTATUS
+ *
+ *  Queue status of a node in the current query. Status entries
+ *  written by older queries have another epoch and count as NONE,
+ *  so the status vector never has to be cleared between queries.
  *
  *  Input:
- *      nodes: vector of nodes.
- *      status: vector of AStarStatus which will be modified.
- *      nNodes: number of nodes in vector.
- *      startNode: position of starting node in the vector of nodes.
- *      targetNode: position of target node in the vector of nodes.
+ *      status: vector of status of the nodes.
+ *      node: position of the node.
+ *      epoch: epoch of the current query.
+ *
+ *  Return: NONE, OPEN or CLOSED.
+ */
+static inline Queue queueStatus(const AStarStatus_t *status, uint32_t node,
+                                uint32_t epoch){
+    uint32_t state = status[node].state;
+
+    return state>>2 == epoch ? state&3 : NONE;
+}
+
+/*  SETQUEUE
+ *
+ *  Sets the queue status of a node in the current query.
+ *
+ *  Input:
+ *      status: status of the node.
+ *      epoch: epoch of the current query.
+ *      whq: OPEN or CLOSED.
+ */
+static inline void setQueue(AStarStatus_t *status, uint32_t epoch, Queue whq){
+    status->state = epoch<<2|whq;
+}
+
+/*  LOWERFLOAT
+ *
+ *  Float not bigger than a non negative double, so a lower bound
+ *  stays a lower bound once stored as float: it is scaled by
+ *  FLOAT_SAFETY, more than the rounding to float can add.
+ *
+ *  Input:
+ *      x: value to round.
+ *
+ *  Return: x rounded down to float.
+ */
+static inline float lowerFloat(double x){
+    return (float) (x*FLOAT_SAFETY);
+}
+
+/*  ENDSHEURISTIC
+ *
+ *  Lower bound of the distance from the start to a node, or from a
+ *  node to the target: the smallest bound through any of their ends
+ *  (see graph_ends), which stays consistent. With a single end at
+ *  distance 0 it is the heuristic itself.
+ *
+ *  Input:
+ *      ctx: search context with the ends of the query.
+ *      heuristic: heuristic function.
+ *      node: position of the node.
+ *      toTarget: 1 for the bound to the target, 0 from the start.
+ *
+ *  Return: heuristic distance.
+ */
+static inline double endsHeuristic(const AStarContext_t *ctx, heuristic_f heuristic,
+                                   uint32_t node, uint8_t toTarget){
+    const void *data = ctx->options.heuristicData;
+    double h, best = DBL_MAX;
+    uint8_t e;
+
+    if(ctx->arcHeuristic){
+        arcBatch(ctx->graph,&node,1,ctx->ends[toTarget],ctx->endOffset[toTarget],
+                 ctx->nEnds[toTarget],&best);
+        return best;
+    }
+
+    for(e=0; e<ctx->nEnds[toTarget]; e++){
+        if(toTarget)
+            h = heuristic(ctx->graph,node,ctx->ends[1][e],data);
+        else
+            h = heuristic(ctx->graph,ctx->ends[0][e],node,data);
+        h += ctx->endOffset[toTarget][e];
+        if(h < best)
+            best = h;
+    }
+    return best;
+}
+
+/*  NEWHEURISTICS
+ *
+ *  Heuristic bounds of the successors of the expanded node not
+ *  reached yet in the current query, computed together by arcBatch
+ *  instead of one by one. The bound of the successor of edge j is
+ *  left in ctx->arcTo[j-first], and its bound from the start in
+ *  ctx->arcFrom[j-first] if asked for.
+ *
+ *  Input:
+ *      ctx: search context with the ends of the query.
+ *      status: status vector of the search.
+ *      adjacent: successors (or predecessors) of the graph.
+ *      first, last: edges of the expanded node.
+ *      fromStart: 1 to compute the bounds from the start too.
+ */
+static void newHeuristics(AStarContext_t *ctx, const AStarStatus_t *status,
+                          const uint32_t *adjacent, uint32_t first, uint32_t last,
+                          uint8_t fromStart){
+    uint32_t j, k = 0;
+
+    for(j=first; j<last; j++)
+        if(queueStatus(status,adjacent[j],ctx->epoch) == NONE){
+            ctx->arcNodes[k] = adjacent[j];
+            ctx->arcEdge[k++] = j-first;
+        }
+    //Bounds in place: each one moves to the position of its edge, never before
+    arcBatch(ctx->graph,ctx->arcNodes,k,ctx->ends[1],ctx->endOffset[1],ctx->nEnds[1],ctx->arcTo);
+    if(fromStart)
+        arcBatch(ctx->graph,ctx->arcNodes,k,ctx->ends[0],ctx->endOffset[0],ctx->nEnds[0],ctx->arcFrom);
+    for(j=k; j-->0; ){
+        ctx->arcTo[ctx->arcEdge[j]] = ctx->arcTo[j];
+        if(fromStart)
+            ctx->arcFrom[ctx->arcEdge[j]] = ctx->arcFrom[j];
+    }
+}
+
+/*  COUNTPUSH
+ *
+ *  Counts a node inserted in OPEN. Every node in OPEN was pushed and
+ *  not popped yet, so the size of OPEN is their difference.
+ *
+ *  Input:
+ *      stats: counters of the search.
+ */
+static inline void countPush(AStarStats_t *stats){
+    stats->pushed++;
+    if(stats->pushed-stats->popped > stats->maxOpen)
+        stats->maxOpen = stats->pushed-stats->popped;
+}
+
+/*  ASTARCONTEXTCREATE
+ *
+ *  Allocates the memory of a search context: the status vectors and
+ *  the heaps of one or two (bidirectional) searches, and the buffers
+ *  of the haversine bounds. The path buffer grows with the longest
+ *  path found.
+ *
+ *  Input:
+ *      ctx: context to initialize.
+ *      graph: graph to search.
+ *      options: options of the searches.
+ */
+void aStarContextCreate(AStarContext_t *ctx, const graph_t *graph,
+                        const AStarOptions_t *options){
+    uint32_t v, maxDegree = 0;
+    uint8_t d;
+
+    memset(ctx,0,sizeof(AStarContext_t));
+    ctx->graph = graph;
+    ctx->options = *options;
+    //Buffers of the haversine bounds, as long as the largest degree
+    ctx->arcHeuristic = options->heuristic == HAVERSINE_HEURISTIC;
+    if(ctx->arcHeuristic){
+        for(v=0; v<graph->nNodes; v++){
+            if(graph->offsets[v+1]-graph->offsets[v] > maxDegree)
+                maxDegree = graph->offsets[v+1]-graph->offsets[v];
+            if(graph->rOffsets[v+1]-graph->rOffsets[v] > maxDegree)
+                maxDegree = graph->rOffsets[v+1]-graph->rOffsets[v];
+        }
+        ctx->arcNodes = malloc(sizeof(uint32_t)*maxDegree); assert(ctx->arcNodes != NULL || maxDegree == 0);
+        ctx->arcEdge = malloc(sizeof(uint32_t)*maxDegree); assert(ctx->arcEdge != NULL || maxDegree == 0);
+        ctx->arcTo = malloc(sizeof(double)*maxDegree); assert(ctx->arcTo != NULL || maxDegree == 0);
+        ctx->arcFrom = malloc(sizeof(double)*maxDegree); assert(ctx->arcFrom != NULL || maxDegree == 0);
+    }
+    for(d=0; d<(options->bidirectional ? 2 : 1); d++){
+        ctx->status[d] = calloc(graph->nNodes,sizeof(AStarStatus_t)); assert(ctx->status[d] != NULL || graph->nNodes == 0);
+        ctx->parent[d] = malloc(sizeof(uint32_t)*graph->nNodes); assert(ctx->parent[d] != NULL || graph->nNodes == 0);
+        heapCreate(&ctx->heap[d],graph->nNodes);
+    }
+}
+
+/*  ASTARCONTEXTFREE
+ *
+ *  Frees the memory of a search context.
+ *
+ *  Input:
+ *      ctx: context to free.
+ */
+void aStarContextFree(AStarContext_t *ctx){
+    uint8_t d;
+
+    for(d=0; d<2; d++)
+        if(ctx->status[d] != NULL){
+            free(ctx->status[d]);
+            free(ctx->parent[d]);
+            heapFree(&ctx->heap[d]);
+        }
+    free(ctx->path);
+    free(ctx->pathDist);
+    free(ctx->fullPath);
+    free(ctx->fullDist);
+    free(ctx->arcNodes);
+    free(ctx->arcEdge);
+    free(ctx->arcTo);
+    free(ctx->arcFrom);
+}
+
+/*  NEWEPOCH
+ *
+ *  Starts a new query, invalidating every status entry in O(1).
+ *  Only when the epoch counter wraps (ASTAR_EPOCHS queries) the
+ *  status vectors are cleared.
+ *
+ *  Input:
+ *      ctx: search context.
+ */
+static void newEpoch(AStarContext_t *ctx){
+    uint8_t d;
+
+    if(++ctx->epoch == ASTAR_EPOCHS){
+        for(d=0; d<2; d++)
+            if(ctx->status[d] != NULL)
+                memset(ctx->status[d],0,sizeof(AStarStatus_t)*ctx->graph->nNodes);
+        ctx->epoch = 1;
+    }
+    ctx->pathLen = 0;
+    ctx->distance = DBL_MAX;
+    memset(ctx->stats,0,sizeof(ctx->stats));
+}
+
+/*  PATHRESERVE
+ *
+ *  Makes room in the path buffer for len nodes.
+ *
+ *  Input:
+ *      ctx: search context.
+ *      len: number of nodes of the path.
+ */
+static void pathReserve(AStarContext_t *ctx, uint32_t len){
+    if(len > ctx->pathCap){
+        ctx->pathCap = len;
+        ctx->path = realloc(ctx->path,sizeof(uint32_t)*len); assert(ctx->path);
+        ctx->pathDist = realloc(ctx->pathDist,sizeof(double)*len); assert(ctx->pathDist);
+    }
+    ctx->pathLen = len;
+}
+
+/*  ASTARFORWARD
+ *
+ *  Unidirectional a-star from the start ends to the target ends of
+ *  the context, each at its distance from the start or target. The
+ *  search stops once the smallest key reaches the best path, which
+ *  starts at ctx->distance (a path already known, DBL_MAX if none).
+ *  The path is left in the path buffer of the context.
+ *
+ *  Input:
+ *      ctx: search context.
  *
  *  Return: 0 if algorithm was successfull in finding a path, 1 otherwise.
  */
-uint8_t aStarAlgorithm(node_t *nodes, AStarStatus_t *status, 
-                    uint32_t nNodes, uint32_t startNode,
-                    uint32_t targetNode){
-    queue_t *open,*auxQueue;
-    uint32_t currentNode,successorNode;
-    uint8_t i;
-    double successorCurrentCost;
+static uint8_t aStarForward(AStarContext_t *ctx){
+    const graph_t *graph = ctx->graph;
+    const AStarOptions_t *options = &ctx->options;
+    AStarStatus_t *status = ctx->status[0];
+    uint32_t *parent = ctx->parent[0];
+    heap_t *heap = &ctx->heap[0];
+    queue_t *open = NULL,*auxQueue;
+    uint32_t currentNode,successorNode,i,len,epoch = ctx->epoch,reached = UINT32_MAX;
+    uint8_t queueType = options->queueType, e;
+    Queue whq;
+    heuristic_f heuristic = getHeuristic(options->heuristic);
+    AStarStats_t *stats = &ctx->stats[0];
+    uint64_t expanded = 0;
+    double successorCurrentCost, best = ctx->distance;
+    const overlay_t *overlay = overlayActive(ctx->overlay);
+    float weight;
     
-    /* Initialize */
-    open = malloc(sizeof(queue_t)); assert(open);
-    open->next = NULL;
-    open->id = startNode;
-
-    status[startNode].g = 0.;
-    status[startNode].h = heuristic1(nodes[startNode],nodes[targetNode]);
-    status[startNode].f = status[startNode].g+status[startNode].h;
-    status[startNode].whq = OPEN;
+    /* Initialize: every start end at its distance from the start */
+    heap->size = 0;
+    for(e=0; e<ctx->nEnds[0]; e++){
+        currentNode = ctx->ends[0][e];
+        if(queueStatus(status,currentNode,epoch) == OPEN){
+            //Both ends of a loop: keep the smaller cost
+            if(status[currentNode].g <= ctx->endOffset[0][e])
+                continue;
+            status[currentNode].g = ctx->endOffset[0][e];
+            if(queueType == HEAP_QUEUE)
+                heapDecreaseKey(heap,currentNode,status[currentNode].g+status[currentNode].h);
+            continue;
+        }
+        status[currentNode].g = ctx->endOffset[0][e];
+        status[currentNode].h = lowerFloat(endsHeuristic(ctx,heuristic,currentNode,1));
+        parent[currentNode] = currentNode;
+        setQueue(&status[currentNode],epoch,OPEN);
+        ASTAR_COUNT(countPush(stats));
+        if(queueType == HEAP_QUEUE)
+            heapPush(heap,currentNode,status[currentNode].g+status[currentNode].h);
+    }
+    //The list is filled once the costs are final, each end once
+    if(queueType != HEAP_QUEUE)
+        for(e=0; e<ctx->nEnds[0]; e++){
+            for(i=0; i<e && ctx->ends[0][i] != ctx->ends[0][e]; i++);
+            if(i == e)
+                insertNodeToQueue(&open,ctx->ends[0][e],status);
+        }
 
     /* Main Loop */
-    while(open != NULL){
+    while(queueType == HEAP_QUEUE ? heap->size > 0 : open != NULL){
         // Select current node with smallest f
-        currentNode = open->id;
-        // If current node is target node, we are done
-        if(currentNode == targetNode)
+        currentNode = queueType == HEAP_QUEUE ? heapPop(heap) : open->id;
+        ASTAR_COUNT(stats->popped++);
+        // Path to the target through a target end
+        for(e=0; e<ctx->nEnds[1]; e++)
+            if(currentNode == ctx->ends[1][e] &&
+               status[currentNode].g+ctx->endOffset[1][e] < best){
+                best = status[currentNode].g+ctx->endOffset[1][e];
+                reached = currentNode;
+            }
+        // If no open node can lead to a better path, we are done
+        if(status[currentNode].g+status[currentNode].h >= best)
             break;
+        expanded++;
+        if(ctx->tiles != NULL)
+            stats->tileFaults += tileTouchExpand(ctx->tiles,currentNode,0);
+        if(ctx->arcHeuristic)
+            newHeuristics(ctx,status,graph->successors,graph->offsets[currentNode],
+                          graph->offsets[currentNode+1],0);
         //Expand each successor of current node
-        for(i=0; i<nodes[currentNode].nsucc;i++){
-            successorNode = nodes[currentNode].successors[i];
-            successorCurrentCost = status[currentNode].g + 
-                                   dis2nodes(nodes[successorNode],nodes[currentNode]);
-            if(status[successorNode].whq == OPEN){
+        for(i=graph->offsets[currentNode]; i<graph->offsets[currentNode+1];i++){
+            successorNode = graph->successors[i];
+            if(options->edgeCost == STORED_EDGES){
+                weight = graph->weights[i];
+                if(overlay != NULL && (weight = overlayCost(overlay,0,i,weight)) == OVERLAY_BLOCKED)
+                    continue;
+                successorCurrentCost = status[currentNode].g + weight;
+            }else
+                successorCurrentCost = status[currentNode].g + 
+                                       dis2nodes(graph,successorNode,currentNode);
+            ASTAR_COUNT(stats->relaxed++);
+            whq = queueStatus(status,successorNode,epoch);
+            if(whq == OPEN){
                 if(status[successorNode].g <= successorCurrentCost)
                     continue;
-                else
+                ASTAR_COUNT(stats->decreased++);
+                status[successorNode].g = successorCurrentCost;
+                parent[successorNode] = currentNode;
+                //Reposition successor node in open list
+                if(queueType == HEAP_QUEUE)
+                    heapDecreaseKey(heap,successorNode,status[successorNode].g+status[successorNode].h);
+                else{
                     deleteNodefromQueue(&open,successorNode);
-            }else if(status[successorNode].whq == CLOSED){
+                    insertNodeToQueue(&open,successorNode,status);
+                }
+                continue;
+            }else if(whq == CLOSED){
                 if(status[successorNode].g <= successorCurrentCost)
                     continue;
+                ASTAR_COUNT(stats->decreased++);
+                ASTAR_COUNT(stats->reopened++);
                 //Add successor node to open list
-                status[successorNode].whq = OPEN;
+                setQueue(&status[successorNode],epoch,OPEN);
             }else{
                 //Add successor node to open list
-                status[successorNode].whq = OPEN;
-                status[successorNode].h = heuristic1(nodes[successorNode],nodes[targetNode]);
+                setQueue(&status[successorNode],epoch,OPEN);
+                status[successorNode].h = lowerFloat(ctx->arcHeuristic ?
+                                                     ctx->arcTo[i-graph->offsets[currentNode]] :
+                                                     endsHeuristic(ctx,heuristic,successorNode,1));
             }
             status[successorNode].g = successorCurrentCost;
-            status[successorNode].f = status[successorNode].g + status[successorNode].h;
-            status[successorNode].parent = currentNode;
-            insertNodeToQueue(&open,successorNode,status);
+            parent[successorNode] = currentNode;
+            ASTAR_COUNT(countPush(stats));
+            if(queueType == HEAP_QUEUE)
+                heapPush(heap,successorNode,status[successorNode].g+status[successorNode].h);
+            else
+                insertNodeToQueue(&open,successorNode,status);
         }
         //Add current node to CLOSED list (also remove from open)
-        status[currentNode].whq = CLOSED;
-        deleteNodefromQueue(&open,currentNode);
+        setQueue(&status[currentNode],epoch,CLOSED);
+        if(queueType != HEAP_QUEUE)
+            deleteNodefromQueue(&open,currentNode);
     }
+    stats->expanded = expanded;
     //Free open list
     while(open != NULL){
         auxQueue = open;
         open = open->next;
         free(auxQueue);
     }
-    //Return that it was found or not
-    if(currentNode == targetNode)
-        return 0;
+    if(reached == UINT32_MAX)
+        return 1;
+
+    /* Path from the parents, filled backwards */
+    ctx->distance = best;
+    for(len=1, i=reached; parent[i]!=i; i=parent[i])
+        len++;
+    pathReserve(ctx,len);
+    for(i=reached; len>0; i=parent[i]){
+        len--;
+        ctx->path[len] = i;
+        ctx->pathDist[len] = status[i].g;
+    }
+    return 0;
+}
+
+/*  ASTARBIDIRECTIONAL
+ *
+ *  Bidirectional a-star from the start ends and the target ends of
+ *  the context, each at its distance from the start or target. The
+ *  best path starts at ctx->distance (a path already known, DBL_MAX
+ *  if none). The path is left in the path buffer of the context.
+ *
+ *  Input:
+ *      ctx: search context.
+ *
+ *  Return: 0 if algorithm was successfull in finding a path, 1 otherwise.
+ */
+static uint8_t aStarBidirectional(AStarContext_t *ctx){
+    const graph_t *graph = ctx->graph;
+    const AStarOptions_t *options = &ctx->options;
+    AStarStatus_t **status = ctx->status;
+    heap_t *heap = ctx->heap;
+    const uint32_t *offsets[2] = {graph->offsets, graph->rOffsets};
+    const uint32_t *adjacent[2] = {graph->successors, graph->rSources};
+    const float *weights[2] = {graph->weights, graph->rWeights};
+    heuristic_f heuristic = getHeuristic(options->heuristic);
+    uint32_t currentNode, successorNode, i, len, meet = UINT32_MAX, epoch = ctx->epoch;
+    uint8_t d, e;
+    uint32_t *parent[2] = {ctx->parent[0], ctx->parent[1]};
+    Queue whq;
+    double best = ctx->distance, successorCurrentCost;
+    float potential, weight;
+    const overlay_t *overlay = overlayActive(ctx->overlay);
+
+    /* Initialize: every end at its distance from the start or target */
+    for(d=0; d<2; d++){
+        heap[d].size = 0;
+        for(e=0; e<ctx->nEnds[d]; e++){
+            currentNode = ctx->ends[d][e];
+            if(queueStatus(status[d],currentNode,epoch) == OPEN){
+                //Both ends of a loop
+                if(status[d][currentNode].g <= ctx->endOffset[d][e])
+                    continue;
+                status[d][currentNode].g = ctx->endOffset[d][e];
+                heapDecreaseKey(&heap[d],currentNode,status[d][currentNode].g+status[d][currentNode].h);
+                continue;
+            }
+            potential = (float) (0.5*(endsHeuristic(ctx,heuristic,currentNode,1)-
+                                      endsHeuristic(ctx,heuristic,currentNode,0)));
+            status[d][currentNode].g = ctx->endOffset[d][e];
+            status[d][currentNode].h = d == 0 ? potential : -potential;
+            parent[d][currentNode] = currentNode;
+            setQueue(&status[d][currentNode],epoch,OPEN);
+            ASTAR_COUNT(countPush(&ctx->stats[d]));
+            heapPush(&heap[d],currentNode,status[d][currentNode].g+status[d][currentNode].h);
+        }
+    }
+    //Ends shared by the start and the target
+    for(e=0; e<ctx->nEnds[1]; e++){
+        currentNode = ctx->ends[1][e];
+        if(queueStatus(status[0],currentNode,epoch) != NONE &&
+           status[0][currentNode].g+status[1][currentNode].g < best){
+            best = status[0][currentNode].g+status[1][currentNode].g;
+            meet = currentNode;
+        }
+    }
+
+    /* Main Loop */
+    while(heap[0].size > 0 && heap[1].size > 0){
+        //No path through the unexpanded nodes can beat the best one
+        if(heap[0].elems[0].f+heap[1].elems[0].f >= best)
+            break;
+        //Expand the direction with the smallest key
+        d = heap[0].elems[0].f <= heap[1].elems[0].f ? 0 : 1;
+        currentNode = heapPop(&heap[d]);
+        ASTAR_COUNT(ctx->stats[d].popped++);
+        setQueue(&status[d][currentNode],epoch,CLOSED);
+        ctx->stats[d].expanded++;
+        if(ctx->tiles != NULL)
+            ctx->stats[d].tileFaults += tileTouchExpand(ctx->tiles,currentNode,d);
+        if(ctx->arcHeuristic)
+            newHeuristics(ctx,status[d],adjacent[d],offsets[d][currentNode],
+                          offsets[d][currentNode+1],1);
+        for(i=offsets[d][currentNode]; i<offsets[d][currentNode+1]; i++){
+            successorNode = adjacent[d][i];
+            if(options->edgeCost == STORED_EDGES){
+                weight = weights[d][i];
+                if(overlay != NULL && (weight = overlayCost(overlay,d,i,weight)) == OVERLAY_BLOCKED)
+                    continue;
+                successorCurrentCost = status[d][currentNode].g + weight;
+            }else
+                successorCurrentCost = status[d][currentNode].g +
+                                       dis2nodes(graph,successorNode,currentNode);
+            ASTAR_COUNT(ctx->stats[d].relaxed++);
+            whq = queueStatus(status[d],successorNode,epoch);
+            if(whq == OPEN){
+                if(status[d][successorNode].g <= successorCurrentCost)
+                    continue;
+                ASTAR_COUNT(ctx->stats[d].decreased++);
+                status[d][successorNode].g = successorCurrentCost;
+                parent[d][successorNode] = currentNode;
+                heapDecreaseKey(&heap[d],successorNode,status[d][successorNode].g+status[d][successorNode].h);
+            }else{
+                if(whq == CLOSED){
+                    if(status[d][successorNode].g <= successorCurrentCost)
+                        continue;
+                    ASTAR_COUNT(ctx->stats[d].decreased++);
+                    ASTAR_COUNT(ctx->stats[d].reopened++);
+                }else{
+                    if(ctx->arcHeuristic)
+                        potential = (float) (0.5*(ctx->arcTo[i-offsets[d][currentNode]]-
+                                                  ctx->arcFrom[i-offsets[d][currentNode]]));
+                    else
+                        potential = (float) (0.5*(endsHeuristic(ctx,heuristic,successorNode,1)-
+                                                  endsHeuristic(ctx,heuristic,successorNode,0)));
+                    status[d][successorNode].h = d == 0 ? potential : -potential;
+                }
+                //Add successor node to open list
+                setQueue(&status[d][successorNode],epoch,OPEN);
+                status[d][successorNode].g = successorCurrentCost;
+                parent[d][successorNode] = currentNode;
+                ASTAR_COUNT(countPush(&ctx->stats[d]));
+                heapPush(&heap[d],successorNode,status[d][successorNode].g+status[d][successorNode].h);
+            }
+            //Path through the successor, if reached by the other search
+            if(queueStatus(status[1-d],successorNode,epoch) != NONE &&
+               successorCurrentCost+status[1-d][successorNode].g < best){
+                best = successorCurrentCost+status[1-d][successorNode].g;
+                meet = successorNode;
+            }
+        }
+    }
+    if(meet == UINT32_MAX)
+        return 1;
+
+    /* Path: forward parents from meeting node back to start, then
+       backward parents from meeting node to target */
+    ctx->distance = best;
+    for(len=1, i=meet; parent[0][i]!=i; i=parent[0][i])
+        len++;
+    currentNode = len;
+    for(i=meet; parent[1][i]!=i; i=parent[1][i])
+        len++;
+    pathReserve(ctx,len);
+    for(i=meet, len=currentNode; len>0; i=parent[0][i]){
+        len--;
+        ctx->path[len] = i;
+        ctx->pathDist[len] = status[0][i].g;
+    }
+    for(i=meet, len=currentNode; parent[1][i]!=i; len++){
+        i = parent[1][i];
+        ctx->path[len] = i;
+        ctx->pathDist[len] = best-status[1][i].g;
+    }
+    return 0;
+}
+
+/*  ASTARALGORITHM
+ *
+ *  Given a startin node and a target node in the graph, the a-star
+ *  algorithm is applied to find a path between them, trying to make
+ *  it as short as possible. The search runs on the memory of the
+ *  context, which is reset in O(1), and the path is left in its path
+ *  buffer: ctx->path[0] = startNode ... ctx->path[ctx->pathLen-1] =
+ *  targetNode, with the distance from start of each node in
+ *  ctx->pathDist and the total in ctx->distance.
+ *
+ *  On a simplified graph the search runs between the ends of the
+ *  start and target nodes (see graph_ends), bounded by the direct
+ *  path along a chain if they share one, and the path found is
+ *  expanded with the nodes of the contracted chains.
+ *
+ *  With an overlay in ctx->overlay the stored edge costs are changed
+ *  by it (see overlay_t) and closed edges are skipped. As costs only
+ *  grow, the heuristics stay lower bounds. An empty overlay is not
+ *  looked at.
+ *
+ *  With the bidirectional option a forward search from the starting
+ *  node and a backward search from the target node over the reverse
+ *  graph are run. Both use the average potential
+ *  pf(v) = (h(v,target)-h(start,v))/2 (and -pf(v) backwards), which
+ *  keeps the reduced edge costs of both searches equal and non
+ *  negative, and they stop once the sum of their smallest keys
+ *  reaches the best path found.
+ *
+ *  Input:
+ *      ctx: search context.
+ *      startNode: position of starting node in the graph.
+ *      targetNode: position of target node in the graph.
+ *
+ *  Return: 0 if algorithm was successfull in finding a path, 1 otherwise.
+ */
+uint8_t aStarAlgorithm(AStarContext_t *ctx, uint32_t startNode,
+                       uint32_t targetNode){
+    const graph_t *graph = ctx->graph;
+    uint32_t *auxPath, auxCap;
+    double *auxDist;
+    uint8_t notFound;
+    const overlay_t *overlay = overlayActive(ctx->overlay);
+
+    newEpoch(ctx);
+    ctx->nEnds[0] = graph_ends(graph,startNode,0,ctx->ends[0],ctx->endOffset[0]);
+    ctx->nEnds[1] = graph_ends(graph,targetNode,1,ctx->ends[1],ctx->endOffset[1]);
+    //A path along a contracted chain bounds the search
+    if(!graph_chain_distance(graph,startNode,targetNode,&ctx->distance))
+        ctx->distance = DBL_MAX;
+    if(overlay != NULL && graph->geoOffsets != NULL){
+        ctx->nEnds[0] = overlayEnds(overlay,startNode,0,ctx->ends[0],ctx->endOffset[0],ctx->nEnds[0]);
+        ctx->nEnds[1] = overlayEnds(overlay,targetNode,1,ctx->ends[1],ctx->endOffset[1],ctx->nEnds[1]);
+        if(ctx->distance != DBL_MAX && !overlayChainDistance(overlay,startNode,targetNode,&ctx->distance))
+            ctx->distance = DBL_MAX;
+    }
+    if(ctx->options.bidirectional)
+        notFound = aStarBidirectional(ctx);
     else
+        notFound = aStarForward(ctx);
+    if(notFound && ctx->distance == DBL_MAX)
         return 1;
+
+    /* Full path of a simplified graph, swapped into the path buffer */
+    if(graph->geoOffsets != NULL){
+        auxPath = ctx->fullPath;
+        auxDist = ctx->fullDist;
+        auxCap = ctx->fullCap;
+        ctx->pathLen = graph_expand_path(graph,startNode,targetNode,ctx->distance,
+                                         ctx->path,ctx->pathDist,notFound ? 0 : ctx->pathLen,
+                                         &auxPath,&auxDist,&auxCap);
+        ctx->fullPath = ctx->path;
+        ctx->fullDist = ctx->pathDist;
+        ctx->fullCap = ctx->pathCap;
+        ctx->path = auxPath;
+        ctx->pathDist = auxDist;
+        ctx->pathCap = auxCap;
+    }
+    return 0;
+}
+
+/*  ASTARONETOMANY
+ *
+ *  Distances from a starting node to a set of targets with a single
+ *  search: Dijkstra (a-star without heuristic) that stops as soon as
+ *  every target is settled, instead of one search per target. Uses
+ *  the forward memory of the context and the stored edge lengths.
+ *
+ *  Input:
+ *      ctx: search context.
+ *      startNode: position of starting node in the graph.
+ *      isTarget: nNodes flags marking the targets, or their ends on
+ *                a simplified graph (see graph_ends).
+ *      nTargets: number of marked nodes.
+ *      columns: position of the target of each output distance,
+ *               UINT32_MAX for ids not in the graph.
+ *      nColumns: number of output distances.
+ *      dist: output vector of nColumns distances, -1 if unreachable.
+ */
+void aStarOneToMany(AStarContext_t *ctx, uint32_t startNode,
+                    const uint8_t *isTarget, uint32_t nTargets,
+                    const uint32_t *columns, uint32_t nColumns, double *dist){
+    const graph_t *graph = ctx->graph;
+    AStarStatus_t *status = ctx->status[0];
+    heap_t *heap = &ctx->heap[0];
+    uint32_t currentNode, successorNode, i, remaining = nTargets, epoch, ends[2];
+    double successorCurrentCost, offsets[2], best;
+    uint8_t e, n;
+
+    newEpoch(ctx);
+    epoch = ctx->epoch;
+    heap->size = 0;
+    n = graph_ends(graph,startNode,0,ends,offsets);
+    for(e=0; e<n; e++){
+        currentNode = ends[e];
+        if(queueStatus(status,currentNode,epoch) == OPEN){
+            //Both ends of a loop
+            if(status[currentNode].g > offsets[e]){
+                status[currentNode].g = offsets[e];
+                heapDecreaseKey(heap,currentNode,offsets[e]);
+            }
+            continue;
+        }
+        status[currentNode].g = offsets[e];
+        status[currentNode].h = 0.;
+        setQueue(&status[currentNode],epoch,OPEN);
+        ASTAR_COUNT(countPush(&ctx->stats[0]));
+        heapPush(heap,currentNode,offsets[e]);
+    }
+
+    /* Main Loop: settle nodes until no target is left */
+    while(heap->size > 0 && remaining > 0){
+        currentNode = heapPop(heap);
+        ASTAR_COUNT(ctx->stats[0].popped++);
+        setQueue(&status[currentNode],epoch,CLOSED);
+        ctx->stats[0].expanded++;
+        if(ctx->tiles != NULL)
+            ctx->stats[0].tileFaults += tileTouchExpand(ctx->tiles,currentNode,0);
+        if(isTarget[currentNode] && --remaining == 0)
+            break;
+        for(i=graph->offsets[currentNode]; i<graph->offsets[currentNode+1]; i++){
+            successorNode = graph->successors[i];
+            successorCurrentCost = status[currentNode].g + graph->weights[i];
+            ASTAR_COUNT(ctx->stats[0].relaxed++);
+            switch(queueStatus(status,successorNode,epoch)){
+                case NONE:
+                    setQueue(&status[successorNode],epoch,OPEN);
+                    status[successorNode].h = 0.;
+                    status[successorNode].g = successorCurrentCost;
+                    ASTAR_COUNT(countPush(&ctx->stats[0]));
+                    heapPush(heap,successorNode,successorCurrentCost);
+                    break;
+                case OPEN:
+                    if(status[successorNode].g <= successorCurrentCost)
+                        break;
+                    ASTAR_COUNT(ctx->stats[0].decreased++);
+                    status[successorNode].g = successorCurrentCost;
+                    heapDecreaseKey(heap,successorNode,successorCurrentCost);
+            }
+        }
+    }
+
+    //Best end of each target, or the direct path along a chain
+    for(i=0; i<nColumns; i++){
+        dist[i] = -1.;
+        if(columns[i] == UINT32_MAX)
+            continue;
+        if(!graph_chain_distance(graph,startNode,columns[i],&best))
+            best = DBL_MAX;
+        n = graph_ends(graph,columns[i],1,ends,offsets);
+        for(e=0; e<n; e++)
+            if(queueStatus(status,ends[e],epoch) == CLOSED &&
+               status[ends[e]].g+offsets[e] < best)
+                best = status[ends[e]].g+offsets[e];
+        if(best < DBL_MAX)
+            dist[i] = best;
+    }
 }
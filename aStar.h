@@ -1,15 +1,69 @@
 #pragma once
 #define EARTH_RADIUS 6371008.8 //mean earth radius (meters)
+#define CHORD_SAFETY (1.-1e-9)  //keeps the chord bound below the arc under rounding
+#define FLOAT_SAFETY (1.-1.2e-7) //keeps heuristics stored as float below the double value
+#include "graph.h"
+#include "overlay.h"
+#include "tiles.h"
 #include <inttypes.h>
+#include <stdio.h>
 
 typedef uint8_t Queue;
 enum whichQueue {NONE, OPEN, CLOSED};
 
-/*A Star status structure for a node */
+/*Implementations available for the OPEN set */
+enum queueType {LIST_QUEUE, HEAP_QUEUE};
+
+/*Source of the edge costs */
+enum edgeCost {STORED_EDGES, HAVERSINE_EDGES};
+
+/*Available heuristics */
+enum heuristicType {HAVERSINE_HEURISTIC, CHORD_HEURISTIC, ALT_HEURISTIC};
+
+/*Options of a search */
+typedef struct AStarOptions_s{
+    uint8_t queueType;  //OPEN set implementation (enum queueType)
+    uint8_t edgeCost;   //Edge costs read or recomputed (enum edgeCost)
+    uint8_t heuristic;  //Heuristic (enum heuristicType)
+    const void *heuristicData; //Precomputed data of the heuristic (if any)
+    uint8_t bidirectional; //Search from both ends
+} AStarOptions_t;
+
+/*Heuristic function: lower bound of the distance between two nodes */
+typedef double (*heuristic_f)(const graph_t *graph, uint32_t currentNode,
+                              uint32_t destinationNode, const void *data);
+
+/*Counters of a search. Only the expanded nodes are always counted:
+ *the other counters need ASTAR_STATS defined at compile time
+ *(make CFLAGS="-Ofast -DASTAR_STATS") and stay 0 otherwise, so the
+ *searches pay nothing for them */
+typedef struct AStarStats_s{
+    uint64_t expanded;  //Nodes expanded
+    uint64_t relaxed;   //Edges relaxed
+    uint64_t decreased; //Relaxations lowering the cost of a node
+    uint64_t reopened;  //CLOSED nodes put back in OPEN
+    uint64_t pushed;    //Nodes inserted in OPEN
+    uint64_t popped;    //Nodes removed from OPEN
+    uint64_t maxOpen;   //Largest size of OPEN
+    uint64_t tileFaults;//Tiles paged in (see tiles.h)
+} AStarStats_t;
+
+#ifdef ASTAR_STATS
+#define ASTAR_COUNT(stmt) do{ stmt; }while(0)
+#else
+#define ASTAR_COUNT(stmt) do{ }while(0)
+#endif
+
+#define ASTAR_EPOCHS (1u<<30) //Queries between clears of the status vectors
+
+/*A Star status structure for a node: only what a relaxation reads,
+ *16 bytes. The key f = g+h is kept in the OPEN set alone and the
+ *parents in their own vector, as they are only read for the path */
 typedef struct AStarStatus_s{
-    double g,h,f;       //Cost
-    uint32_t parent;    //Parent node
-    Queue whq;          //Queue status
+    double g;           //Cost from the start
+    float h;            //Heuristic, rounded down to stay a lower bound
+    uint32_t state;     //Query that wrote the entry and queue status
+                        //(epoch<<2 | whq, whq valid if epoch is current)
 } AStarStatus_t;
 
 /*Dynamic list structure */
@@ -18,7 +72,46 @@ typedef struct queue_s{
     uint32_t id;
 } queue_t;
 
-typedef struct node_s node_t;
+/*Indexed heap element */
+typedef struct heapElem_s{
+    double f;           //Key of the element
+    uint32_t id;        //Node position
+} heapElem_t;
+
+/*Indexed 4-ary min-heap. pos[id] holds the heap position of node id
+ *so decrease-key does not need to search the heap */
+typedef struct heap_s{
+    heapElem_t *elems;  //Heap array
+    uint32_t *pos;      //Position in heap of every node
+    uint32_t size;      //Number of elements in heap
+} heap_t;
+
+/*Memory of the searches on a graph, reusable between queries */
+typedef struct AStarContext_s{
+    const graph_t *graph;       //Graph to search
+    AStarOptions_t options;     //Options of the searches
+    AStarStatus_t *status[2];   //Forward and backward status vectors
+    uint32_t *parent[2];        //Forward and backward parent of each node
+    heap_t heap[2];             //Forward and backward OPEN sets
+    uint32_t epoch;             //Current query
+    AStarStats_t stats[2];      //Counters of the last query
+    double distance;            //Length of the last path
+    uint32_t *path;             //Nodes of the last path, start to target
+    double *pathDist;           //Distance from start of each path node
+    uint32_t pathLen, pathCap;  //Nodes in path and room in buffers
+    uint32_t ends[2][2];        //Search nodes of the start and the target
+    double endOffset[2][2];     //Distance of each end to the start or target
+    uint8_t nEnds[2];           //Number of ends of the start and the target
+    uint32_t *fullPath;         //Spare path buffers to expand paths of
+    double *fullDist;           //simplified graphs
+    uint32_t fullCap;           //Room in spare buffers
+    uint8_t arcHeuristic;       //Haversine bounds computed by arcBatch
+    uint32_t *arcNodes;         //Unreached successors of the expanded node
+    uint32_t *arcEdge;          //Edge of each of them, from the first edge
+    double *arcTo, *arcFrom;    //Their bounds to the target and from the start
+    const overlay_t *overlay;   //Edge cost changes applied to the searches (NULL if none)
+    tilePager_t *tiles;         //Pager of the graph tiles (NULL if the graph stays mapped whole)
+} AStarContext_t;
 
 /*  DIS2NODES
  *
@@ -27,11 +120,12 @@ typedef struct node_s node_t;
  *  approximation of the earth.
  *
  *  Input:
- *      n1,n2: nodes to compute the distance between.
+ *      graph: graph of the nodes.
+ *      n1,n2: positions of the nodes to compute the distance between.
  *
  *  Return: approximate distance.
  */
-double dis2nodes(node_t n1, node_t n2);
+double dis2nodes(const graph_t *graph, uint32_t n1, uint32_t n2);
 
 /*  HEURISTIC1
  *
@@ -40,33 +134,76 @@ double dis2nodes(node_t n1, node_t n2);
  *  particular, we will use the haversine formula.
  *
  *  Input:
- *      currentNode: current node to find heuristic distance.
- *      destinationNode: destination node.
+ *      graph: graph of the nodes.
+ *      currentNode: position of current node to find heuristic distance.
+ *      destinationNode: position of destination node.
+ *      data: unused.
  *
  *  Return: heuristic distance.
  */
-double heuristic1(node_t currentNode, node_t destinationNode);
+double heuristic1(const graph_t *graph, uint32_t currentNode,
+                  uint32_t destinationNode, const void *data);
+
+/*  HEURISTICCHORD
+ *
+ *  Heuristic function for the a* algorithm using the precomputed
+ *  unit vectors of the nodes. The chord between two points of
+ *  the sphere is never longer than the great circle arc, so it
+ *  is an admissible and consistent lower bound which needs no
+ *  trigonometric function. It is scaled by CHORD_SAFETY so
+ *  rounding can not push it over the arc.
+ *
+ *  Input:
+ *      graph: graph of the nodes.
+ *      currentNode: position of current node to find heuristic distance.
+ *      destinationNode: position of destination node.
+ *      data: unused.
+ *
+ *  Return: heuristic distance.
+ */
+double heuristicChord(const graph_t *graph, uint32_t currentNode,
+                      uint32_t destinationNode, const void *data);
+
+/*  GETHEURISTIC
+ *
+ *  Returns the heuristic function of a heuristic type.
+ *
+ *  Input:
+ *      heuristic: heuristic type (enum heuristicType).
+ *
+ *  Return: pointer to the heuristic function.
+ */
+heuristic_f getHeuristic(uint8_t heuristic);
+
+/*  WRITESTATSJSON
+ *
+ *  Writes the counters of a search as a JSON object.
+ *
+ *  Input:
+ *      out: stream to write to.
+ *      stats: counters to write.
+ */
+void writeStatsJSON(FILE *out, const AStarStats_t *stats);
 
 /*  FINDNODE
  *
- *  Finds node position in vector given its ID. If it is not
- *  found it returns -1.
+ *  Finds node position in vector given its ID, with the id index
+ *  of the graph. If it is not found it returns UINT32_MAX.
  *
  *  Input:
- *      nodes: vector of nodes.
- *      nNodes: number of nodes in vector.
+ *      graph: graph with its id index.
  *      targetId: ID to look for.
  *
  *  Return: position of the node with input ID. If not found it
- *          returns -1.
+ *          returns UINT32_MAX.
  */
-uint32_t findNode(node_t *nodes, uint32_t nNodes, uint32_t targetId);
+uint32_t findNode(const graph_t *graph, uint32_t targetId);
 
 /*  INSERTNODETOQUEUE
  *
  *  Puts node into queue dynamic list in a sorted way,
  *  from smallest f to biggest f, obtained from status.
- *  
+ *  The list may be empty (*queue NULL).
  *
  *  Input:
  *      queue: queue pointer to pointer of the first element.
@@ -87,22 +224,141 @@ void insertNodeToQueue(queue_t **queue,uint32_t nodeId,
  */
 void deleteNodefromQueue(queue_t **queue, uint32_t nodeId);
 
+/*  HEAPCREATE
+ *
+ *  Allocates an empty indexed heap able to hold every node of
+ *  the graph, so no allocation is needed during the search.
+ *
+ *  Input:
+ *      heap: heap to initialize.
+ *      nNodes: number of nodes in graph.
+ */
+void heapCreate(heap_t *heap, uint32_t nNodes);
+
+/*  HEAPFREE
+ *
+ *  Frees the memory of the heap.
+ *
+ *  Input:
+ *      heap: heap to free.
+ */
+void heapFree(heap_t *heap);
+
+/*  HEAPPUSH
+ *
+ *  Inserts node into the heap with key f. The node must
+ *  not be in the heap.
+ *
+ *  Input:
+ *      heap: heap to modify.
+ *      nodeId: node position to insert.
+ *      f: key of the node.
+ */
+void heapPush(heap_t *heap, uint32_t nodeId, double f);
+
+/*  HEAPPOP
+ *
+ *  Removes the element with smallest key from the heap.
+ *  User must be sure that the heap is not empty.
+ *
+ *  Input:
+ *      heap: heap to modify.
+ *
+ *  Return: node position with smallest key.
+ */
+uint32_t heapPop(heap_t *heap);
+
+/*  HEAPDECREASEKEY
+ *
+ *  Lowers the key of a node already in the heap.
+ *
+ *  Input:
+ *      heap: heap to modify.
+ *      nodeId: node position whose key decreases.
+ *      f: new key, not bigger than the old one.
+ */
+void heapDecreaseKey(heap_t *heap, uint32_t nodeId, double f);
+
+/*  ASTARCONTEXTCREATE
+ *
+ *  Allocates the memory of a search context: the status vectors and
+ *  the heaps of one or two (bidirectional) searches, and the buffers
+ *  of the haversine bounds. The path buffer grows with the longest
+ *  path found.
+ *
+ *  Input:
+ *      ctx: context to initialize.
+ *      graph: graph to search.
+ *      options: options of the searches.
+ */
+void aStarContextCreate(AStarContext_t *ctx, const graph_t *graph,
+                        const AStarOptions_t *options);
+
+/*  ASTARCONTEXTFREE
+ *
+ *  Frees the memory of a search context.
+ *
+ *  Input:
+ *      ctx: context to free.
+ */
+void aStarContextFree(AStarContext_t *ctx);
+
 /*  ASTARALGORITHM
  *
  *  Given a startin node and a target node in the graph, the a-star
  *  algorithm is applied to find a path between them, trying to make
- *  it as short as possible. The path can be reconstructed from the
- *  AStarStatus vector after its completation. 
+ *  it as short as possible. The search runs on the memory of the
+ *  context, which is reset in O(1), and the path is left in its path
+ *  buffer: ctx->path[0] = startNode ... ctx->path[ctx->pathLen-1] =
+ *  targetNode, with the distance from start of each node in
+ *  ctx->pathDist and the total in ctx->distance.
+ *
+ *  On a simplified graph the search runs between the ends of the
+ *  start and target nodes (see graph_ends), bounded by the direct
+ *  path along a chain if they share one, and the path found is
+ *  expanded with the nodes of the contracted chains.
+ *
+ *  With an overlay in ctx->overlay the stored edge costs are changed
+ *  by it (see overlay_t) and closed edges are skipped. As costs only
+ *  grow, the heuristics stay lower bounds. An empty overlay is not
+ *  looked at.
+ *
+ *  With the bidirectional option a forward search from the starting
+ *  node and a backward search from the target node over the reverse
+ *  graph are run. Both use the average potential
+ *  pf(v) = (h(v,target)-h(start,v))/2 (and -pf(v) backwards), which
+ *  keeps the reduced edge costs of both searches equal and non
+ *  negative, and they stop once the sum of their smallest keys
+ *  reaches the best path found.
  *
  *  Input:
- *      nodes: vector of nodes.
- *      status: vector of AStarStatus which will be modified.
- *      nNodes: number of nodes in vector.
- *      startNode: position of starting node in the vector of nodes.
- *      targetNode: position of target node in the vector of nodes.
+ *      ctx: search context.
+ *      startNode: position of starting node in the graph.
+ *      targetNode: position of target node in the graph.
  *
  *  Return: 0 if algorithm was successfull in finding a path, 1 otherwise.
  */
-uint8_t aStarAlgorithm(node_t *nodes, AStarStatus_t *status, 
-                    uint32_t nNodes, uint32_t startNode,
-                    uint32_t targetNode);
+uint8_t aStarAlgorithm(AStarContext_t *ctx, uint32_t startNode,
+                       uint32_t targetNode);
+
+/*  ASTARONETOMANY
+ *
+ *  Distances from a starting node to a set of targets with a single
+ *  search: Dijkstra (a-star without heuristic) that stops as soon as
+ *  every target is settled, instead of one search per target. Uses
+ *  the forward memory of the context and the stored edge lengths.
+ *
+ *  Input:
+ *      ctx: search context.
+ *      startNode: position of starting node in the graph.
+ *      isTarget: nNodes flags marking the targets, or their ends on
+ *                a simplified graph (see graph_ends).
+ *      nTargets: number of marked nodes.
+ *      columns: position of the target of each output distance,
+ *               UINT32_MAX for ids not in the graph.
+ *      nColumns: number of output distances.
+ *      dist: output vector of nColumns distances, -1 if unreachable.
+ */
+void aStarOneToMany(AStarContext_t *ctx, uint32_t startNode,
+                    const uint8_t *isTarget, uint32_t nTargets,
+                    const uint32_t *columns, uint32_t nColumns, double *dist);
@@ -0,0 +1,44 @@
+#pragma once
+#include "graph.h"
+#include <inttypes.h>
+
+#define ARC_TERMS 9     //Terms of the arcsine series
+
+/*  ARCBATCH
+ *
+ *  Lower bounds of the great circle distance from several nodes to
+ *  the nearest of a set of ends, each at an offset, as used by the
+ *  haversine heuristic. The arc is computed from the unit vectors of
+ *  the nodes: with c the chord between two points of the unit sphere,
+ *  arc = 2*asin(c/2), and asin(x) is taken as its Taylor series up to
+ *  x^17 (ARC_TERMS terms). Every term of the series is positive, so
+ *  the truncated sum is never above the arc, and the result is
+ *  scaled by CHORD_SAFETY to absorb rounding: it stays admissible.
+ *  Relative error below 1e-12 up to 3000 km, 5e-8 up to 6700 km
+ *  (c/2 = 0.5), and the bound only loosens beyond (12% at the
+ *  antipode).
+ *
+ *  The AVX2 kernel gathers the unit vectors of 4 nodes at a time;
+ *  it is chosen at run time if the processor supports it, and a
+ *  scalar loop computing the same series is used otherwise.
+ *
+ *  Input:
+ *      graph: graph of the nodes.
+ *      nodes: positions of the nodes.
+ *      n: number of nodes.
+ *      ends: positions of the ends.
+ *      offsets: distance added to the arc of each end.
+ *      nEnds: number of ends.
+ *      h: output vector of n bounds.
+ */
+void arcBatch(const graph_t *graph, const uint32_t *nodes, uint32_t n,
+              const uint32_t *ends, const double *offsets, uint8_t nEnds,
+              double *h);
+
+/*  ARCBATCHKERNEL
+ *
+ *  Name of the kernel arcBatch runs on this processor.
+ *
+ *  Return: "avx2" or "scalar".
+ */
+const char *arcBatchKernel(void);
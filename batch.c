@@ -0,0 +1,457 @@
+#include "batch.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+/*Pair of a block and its result */
+typedef struct batchPair_s{
+    uint32_t startId, targetId; //Ids read
+    double distance;            //Length of the path, negative if not found
+    uint32_t worker;            //Thread that answered the pair
+    uint32_t pathLen;           //Nodes of the path kept
+    size_t pathOffset;          //Position of the path in the thread buffer
+    double lookupTime;          //Seconds finding the ids (JSON output)
+    double searchTime;          //Seconds searching (JSON output)
+    AStarStats_t stats[2];      //Forward and backward counters (JSON output)
+} batchPair_t;
+
+/*Range of pairs of a block still owned by a thread */
+typedef struct batchDeque_s{
+    pthread_mutex_t lock;
+    uint32_t head, tail;        //Next pair and end of the range
+} batchDeque_t;
+
+/*State shared by the threads of a batch */
+typedef struct batchShared_s{
+    const graph_t *graph;
+    const batchOptions_t *batchOptions;
+    batchPair_t *pairs;         //Pairs of the current block
+    batchDeque_t *deques;       //Range of each thread
+    uint32_t nWorkers;          //Number of threads
+} batchShared_t;
+
+/*Search memory and counters of a thread */
+typedef struct batchWorker_s{
+    uint32_t id;                //Position of the thread
+    batchShared_t *shared;
+    AStarContext_t ctx;         //A-star memory
+    chWorkspace_t chWs;         //Hierarchy memory
+    crpWorkspace_t crpWs;       //Partition memory
+    uint32_t *paths;            //Paths answered in the current block
+    size_t pathsLen, pathsCap;
+    uint64_t found, unknown, steals;
+    pthread_t thread;
+} batchWorker_t;
+
+/*  PARSEPAIR
+ *
+ *  Reads the two ids of a line of the pairs stream.
+ *
+ *  Input:
+ *      line: line to parse.
+ *      startId, targetId: ids read.
+ *
+ *  Return: 1 if a pair was read, 0 if the line is empty or a
+ *          comment, -1 if it can not be parsed.
+ */
+static int parsePair(const char *line, uint32_t *startId, uint32_t *targetId){
+    line += strspn(line," \t\r\n");
+    if(*line == '\0' || *line == '#')
+        return 0;
+    if(sscanf(line,"%"SCNu32"%*[ \t,;|]%"SCNu32,startId,targetId) != 2)
+        return -1;
+    return 1;
+}
+
+/*  ELAPSED
+ *
+ *  Seconds between two instants of the monotonic clock.
+ *
+ *  Input:
+ *      before, after: instants.
+ *
+ *  Return: seconds elapsed.
+ */
+static double elapsed(const struct timespec *before, const struct timespec *after){
+    return (after->tv_sec-before->tv_sec)+1e-9*(after->tv_nsec-before->tv_nsec);
+}
+
+/*  WRITEJSON
+ *
+ *  Writes the result of a pair as a line of JSON.
+ *
+ *  Input:
+ *      out: stream of results.
+ *      graph: graph searched.
+ *      pair: answered pair.
+ *      path: nodes of the path, start to target.
+ */
+static void writeJSON(FILE *out, const graph_t *graph, const batchPair_t *pair,
+                      const uint32_t *path){
+    uint32_t i;
+
+    fprintf(out,"{\"start\":%"PRIu32",\"target\":%"PRIu32",",pair->startId,pair->targetId);
+    if(pair->distance < 0.)
+        fprintf(out,"\"distance\":null,");
+    else
+        fprintf(out,"\"distance\":%.6lf,",pair->distance);
+    fprintf(out,"\"lookup_us\":%.3lf,\"search_us\":%.3lf,\"stats\":[",
+            1e6*pair->lookupTime,1e6*pair->searchTime);
+    writeStatsJSON(out,&pair->stats[0]);
+    fputc(',',out);
+    writeStatsJSON(out,&pair->stats[1]);
+    fputc(']',out);
+    if(pair->pathLen > 0){
+        fprintf(out,",\"path\":[");
+        for(i=0; i<pair->pathLen; i++)
+            fprintf(out,i > 0 ? ",%"PRIu32 : "%"PRIu32,graph->ids[path[i]]);
+        fputc(']',out);
+    }
+    fprintf(out,"}\n");
+}
+
+/*  WRITERESULT
+ *
+ *  Writes the result of a pair in the output format.
+ *
+ *  Input:
+ *      out: stream of results.
+ *      graph: graph searched.
+ *      format: output format (enum batchFormat).
+ *      pair: answered pair.
+ *      path: nodes of the path, start to target.
+ */
+static void writeResult(FILE *out, const graph_t *graph, uint8_t format,
+                        const batchPair_t *pair, const uint32_t *path){
+    uint32_t i, id, startId = pair->startId, targetId = pair->targetId;
+    uint32_t pathLen = pair->pathLen;
+    double distance = pair->distance;
+
+    if(format == BATCH_JSON){
+        writeJSON(out,graph,pair,path);
+        return;
+    }
+    if(format == BATCH_BINARY){
+        fwrite(&startId,sizeof(uint32_t),1,out);
+        fwrite(&targetId,sizeof(uint32_t),1,out);
+        fwrite(&distance,sizeof(double),1,out);
+        fwrite(&pathLen,sizeof(uint32_t),1,out);
+        for(i=0; i<pathLen; i++){
+            id = graph->ids[path[i]];
+            fwrite(&id,sizeof(uint32_t),1,out);
+        }
+        return;
+    }
+    if(distance < 0.)
+        fprintf(out,"%"PRIu32" %"PRIu32" -1",startId,targetId);
+    else
+        fprintf(out,"%"PRIu32" %"PRIu32" %.6lf",startId,targetId,distance);
+    for(i=0; i<pathLen; i++)
+        fprintf(out," %"PRIu32,graph->ids[path[i]]);
+    fputc('\n',out);
+}
+
+/*  ANSWERPAIR
+ *
+ *  Searches the path of a pair with the memory of a thread, keeping
+ *  the path in the buffer of the thread if it has to be written.
+ *
+ *  Input:
+ *      worker: thread answering the pair.
+ *      pair: pair to answer, whose result is filled.
+ */
+static void answerPair(batchWorker_t *worker, batchPair_t *pair){
+    const graph_t *graph = worker->shared->graph;
+    const batchOptions_t *batchOptions = worker->shared->batchOptions;
+    uint32_t startNode, targetNode, pathLen = 0;
+    const uint32_t *path = NULL;
+    uint8_t timed = batchOptions->format == BATCH_JSON, d;
+    struct timespec before, lookup, search;
+
+    pair->distance = -1.;
+    pair->worker = worker->id;
+    pair->pathLen = 0;
+    if(timed){
+        memset(pair->stats,0,sizeof(pair->stats));
+        pair->searchTime = 0.;
+        clock_gettime(CLOCK_MONOTONIC,&before);
+    }
+    startNode = findNode(graph,pair->startId);
+    targetNode = findNode(graph,pair->targetId);
+    if(timed){
+        clock_gettime(CLOCK_MONOTONIC,&lookup);
+        pair->lookupTime = elapsed(&before,&lookup);
+    }
+    if(startNode == UINT32_MAX || targetNode == UINT32_MAX){
+        worker->unknown++;
+        return;
+    }
+    if(batchOptions->ch != NULL){
+        if(chQuery(batchOptions->ch,&worker->chWs,startNode,targetNode) == 0){
+            pair->distance = worker->chWs.pathDist[worker->chWs.pathLen-1];
+            path = worker->chWs.path;
+            pathLen = worker->chWs.pathLen;
+        }
+    }else if(batchOptions->crp != NULL){
+        if(crpQuery(batchOptions->crp,&worker->crpWs,startNode,targetNode) == 0){
+            pair->distance = worker->crpWs.distance;
+            path = worker->crpWs.path;
+            pathLen = worker->crpWs.pathLen;
+        }
+    }else if(aStarAlgorithm(&worker->ctx,startNode,targetNode) == 0){
+        pair->distance = worker->ctx.distance;
+        path = worker->ctx.path;
+        pathLen = worker->ctx.pathLen;
+    }
+    if(timed){
+        clock_gettime(CLOCK_MONOTONIC,&search);
+        pair->searchTime = elapsed(&lookup,&search);
+        if(batchOptions->ch != NULL)
+            for(d=0; d<2; d++)
+                pair->stats[d].expanded = worker->chWs.settled[d];
+        else if(batchOptions->crp != NULL)
+            for(d=0; d<2; d++)
+                pair->stats[d].expanded = worker->crpWs.settled[d];
+        else
+            memcpy(pair->stats,worker->ctx.stats,sizeof(pair->stats));
+    }
+    if(pair->distance < 0.)
+        return;
+    worker->found++;
+    if(!batchOptions->printPath)
+        return;
+    if(worker->pathsLen+pathLen > worker->pathsCap){
+        worker->pathsCap = 2*(worker->pathsLen+pathLen);
+        worker->paths = realloc(worker->paths,sizeof(uint32_t)*worker->pathsCap);
+        assert(worker->paths);
+    }
+    memcpy(worker->paths+worker->pathsLen,path,sizeof(uint32_t)*pathLen);
+    pair->pathOffset = worker->pathsLen;
+    pair->pathLen = pathLen;
+    worker->pathsLen += pathLen;
+}
+
+/*  STEALRANGE
+ *
+ *  Moves to the range of a thread the upper half of the remaining
+ *  range of the first other thread with pairs left.
+ *
+ *  Input:
+ *      worker: thread without pairs left.
+ *
+ *  Return: 1 if pairs were stolen, 0 if every range is empty.
+ */
+static int stealRange(batchWorker_t *worker){
+    batchShared_t *shared = worker->shared;
+    batchDeque_t *victim, *own = &shared->deques[worker->id];
+    uint32_t k, mid, tail;
+
+    for(k=1; k<shared->nWorkers; k++){
+        victim = &shared->deques[(worker->id+k)%shared->nWorkers];
+        pthread_mutex_lock(&victim->lock);
+        if(victim->head == victim->tail){
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        mid = victim->head+(victim->tail-victim->head)/2;
+        tail = victim->tail;
+        victim->tail = mid;
+        pthread_mutex_unlock(&victim->lock);
+        pthread_mutex_lock(&own->lock);
+        own->head = mid;
+        own->tail = tail;
+        pthread_mutex_unlock(&own->lock);
+        worker->steals++;
+        return 1;
+    }
+    return 0;
+}
+
+/*  BATCHWORKER
+ *
+ *  Thread loop: answers the pairs of its own range from the front,
+ *  stealing from other threads when it runs out.
+ *
+ *  Input:
+ *      arg: batchWorker_t of the thread.
+ *
+ *  Return: NULL.
+ */
+static void *batchWorker(void *arg){
+    batchWorker_t *worker = arg;
+    batchDeque_t *own = &worker->shared->deques[worker->id];
+    uint32_t i;
+
+    for(;;){
+        pthread_mutex_lock(&own->lock);
+        i = own->head < own->tail ? own->head++ : UINT32_MAX;
+        pthread_mutex_unlock(&own->lock);
+        if(i != UINT32_MAX)
+            answerPair(worker,&worker->shared->pairs[i]);
+        else if(!stealRange(worker))
+            break;
+    }
+    return NULL;
+}
+
+/*  RUNBATCH
+ *
+ *  Answers a stream of origin/destination pairs on a loaded graph.
+ *  Pairs are read in blocks of BATCH_BLOCK and answered by a pool of
+ *  threads sharing the read-only graph, each with its own search
+ *  memory. Every thread starts with an equal range of the block and,
+ *  once its range is exhausted, steals half of the remaining range of
+ *  another thread, so long routes do not leave cores idle. Results
+ *  are written in input order after each block, and do not depend on
+ *  the number of threads. Each input line holds two node ids
+ *  separated by blanks, commas, semicolons or '|'; empty lines and
+ *  lines starting with '#' are skipped.
+ *
+ *  With an overlay, its file is checked before each block and reloaded
+ *  if it changed, so a long stream picks up new closures and traffic
+ *  without a restart; every pair of a block uses the same overlay. A
+ *  partition is customized again with the new overlay before the block.
+ *
+ *  Text output, one line per pair:
+ *      startId targetId distance [id id ... id]
+ *  with distance -1 if there is no path or an id is unknown.
+ *  Binary output, one record per pair:
+ *      uint32 startId, uint32 targetId, double distance, uint32 n,
+ *      n uint32 path ids (n = 0 without paths).
+ *  JSON output, one object per line and pair, with the time spent
+ *  finding the ids and searching (microseconds) and the counters of
+ *  the forward and backward searches (see AStarStats_t):
+ *      {"start":id,"target":id,"distance":d|null,"lookup_us":t,
+ *       "search_us":t,"stats":[{...},{...}][,"path":[id,...]]}
+ *
+ *  Input:
+ *      graph: graph to search.
+ *      options: search options of the a-star queries.
+ *      batchOptions: output format, query engine and threads.
+ *      in: stream of pairs.
+ *      out: stream of results.
+ *      stats: counters of the run, filled if not NULL.
+ *
+ *  Return: 0 if successfull, 1 if a line could not be parsed.
+ */
+int runBatch(const graph_t *graph, const AStarOptions_t *options,
+             const batchOptions_t *batchOptions, FILE *in, FILE *out,
+             batchStats_t *stats){
+    batchShared_t shared;
+    batchWorker_t *workers, *worker;
+    batchPair_t *pair;
+    char line[BATCH_LINE];
+    uint32_t nPairs, nWorkers = batchOptions->threads > 0 ? batchOptions->threads : 1;
+    uint32_t i;
+    uint64_t lineNo = 0;
+    batchStats_t count = {0, 0, 0, 0, 0.};
+    struct timeval tval_before, tval_after, tval_result;
+    int ret = 0, more = 1, parsed, reloaded;
+    overlay_t *overlay = NULL;
+
+    shared.graph = graph;
+    shared.batchOptions = batchOptions;
+    shared.nWorkers = nWorkers;
+    shared.pairs = malloc(sizeof(batchPair_t)*BATCH_BLOCK); assert(shared.pairs);
+    shared.deques = malloc(sizeof(batchDeque_t)*nWorkers); assert(shared.deques);
+    workers = calloc(nWorkers,sizeof(batchWorker_t)); assert(workers);
+    for(i=0; i<nWorkers; i++){
+        pthread_mutex_init(&shared.deques[i].lock,NULL);
+        workers[i].id = i;
+        workers[i].shared = &shared;
+        if(batchOptions->ch != NULL)
+            chWorkspaceCreate(&workers[i].chWs,graph->nNodes);
+        else if(batchOptions->crp != NULL)
+            crpWorkspaceCreate(&workers[i].crpWs,batchOptions->crp);
+        else{
+            aStarContextCreate(&workers[i].ctx,graph,options);
+            workers[i].ctx.tiles = batchOptions->tiles;
+        }
+    }
+    if(batchOptions->tiles != NULL)
+        tilePagerTrim(batchOptions->tiles);
+
+    gettimeofday(&tval_before,NULL);
+    while(ret == 0 && more){
+        /* Read a block of pairs */
+        nPairs = 0;
+        while(nPairs < BATCH_BLOCK){
+            if(fgets(line,BATCH_LINE,in) == NULL){
+                more = 0;
+                break;
+            }
+            lineNo++;
+            pair = &shared.pairs[nPairs];
+            parsed = parsePair(line,&pair->startId,&pair->targetId);
+            if(parsed < 0){
+                fprintf(stderr,"ERROR: Can not parse pair in line %"PRIu64".\n",lineNo);
+                ret = 1;
+                break;
+            }
+            nPairs += parsed;
+        }
+        if(nPairs == 0)
+            continue;
+
+        /* Answer it: equal ranges, then stealing */
+        if(batchOptions->overlay != NULL){
+            reloaded = overlayRefresh(batchOptions->overlay);
+            overlay = overlayAcquire(batchOptions->overlay);
+            if(reloaded && batchOptions->crp != NULL)
+                customizeCRP(batchOptions->crp,overlay,nWorkers);
+        }
+        for(i=0; i<nWorkers; i++){
+            workers[i].ctx.overlay = overlay;
+            shared.deques[i].head = (uint64_t)nPairs*i/nWorkers;
+            shared.deques[i].tail = (uint64_t)nPairs*(i+1)/nWorkers;
+            workers[i].pathsLen = 0;
+        }
+        for(i=1; i<nWorkers; i++)
+            if(pthread_create(&workers[i].thread,NULL,batchWorker,&workers[i]) != 0){
+                fprintf(stderr,"ERROR: Can not create thread.\n");
+                exit(1);
+            }
+        batchWorker(&workers[0]);
+        for(i=1; i<nWorkers; i++)
+            pthread_join(workers[i].thread,NULL);
+        if(overlay != NULL)
+            overlayRelease(batchOptions->overlay,overlay);
+
+        /* Write it in input order */
+        for(i=0; i<nPairs; i++){
+            pair = &shared.pairs[i];
+            worker = &workers[pair->worker];
+            writeResult(out,graph,batchOptions->format,pair,worker->paths+pair->pathOffset);
+        }
+        count.queries += nPairs;
+    }
+    fflush(out);
+    gettimeofday(&tval_after,NULL);
+    timersub(&tval_after,&tval_before,&tval_result);
+    count.seconds = tval_result.tv_sec+1e-6*tval_result.tv_usec;
+
+    for(i=0; i<nWorkers; i++){
+        count.found += workers[i].found;
+        count.unknown += workers[i].unknown;
+        count.steals += workers[i].steals;
+        if(batchOptions->ch != NULL)
+            chWorkspaceFree(&workers[i].chWs);
+        else if(batchOptions->crp != NULL)
+            crpWorkspaceFree(&workers[i].crpWs);
+        else
+            aStarContextFree(&workers[i].ctx);
+        free(workers[i].paths);
+        pthread_mutex_destroy(&shared.deques[i].lock);
+    }
+    free(workers);
+    free(shared.deques);
+    free(shared.pairs);
+    if(stats != NULL)
+        *stats = count;
+    return ret;
+}
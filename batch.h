@@ -0,0 +1,79 @@
+#pragma once
+#include "aStar.h"
+#include "ch.h"
+#include "crp.h"
+#include "graph.h"
+#include "overlay.h"
+#include "tiles.h"
+#include <inttypes.h>
+#include <stdio.h>
+
+#define BATCH_LINE 256      //Longest line of a pairs file
+#define BATCH_BLOCK 4096    //Pairs read and answered together
+
+/*Output formats of a batch */
+enum batchFormat {BATCH_TEXT, BATCH_BINARY, BATCH_JSON};
+
+/*Options of a batch run */
+typedef struct batchOptions_s{
+    uint8_t format;     //Output format (enum batchFormat)
+    uint8_t printPath;  //Write the node ids of each path
+    const ch_t *ch;     //Hierarchy to answer with, a-star if NULL
+    uint32_t threads;   //Threads answering the pairs
+    overlayHolder_t *overlay; //Edge cost changes of the a-star and partition queries (NULL if none)
+    crp_t *crp;         //Customized partition to answer with, if ch is NULL
+    tilePager_t *tiles; //Pager of the graph tiles of the a-star queries (NULL if none)
+} batchOptions_t;
+
+/*Counters of a batch run */
+typedef struct batchStats_s{
+    uint64_t queries;   //Pairs read
+    uint64_t found;     //Pairs with a path
+    uint64_t unknown;   //Pairs with an id not in the graph
+    uint64_t steals;    //Ranges of pairs stolen between threads
+    double seconds;     //Wall time of the run
+} batchStats_t;
+
+/*  RUNBATCH
+ *
+ *  Answers a stream of origin/destination pairs on a loaded graph.
+ *  Pairs are read in blocks of BATCH_BLOCK and answered by a pool of
+ *  threads sharing the read-only graph, each with its own search
+ *  memory. Every thread starts with an equal range of the block and,
+ *  once its range is exhausted, steals half of the remaining range of
+ *  another thread, so long routes do not leave cores idle. Results
+ *  are written in input order after each block, and do not depend on
+ *  the number of threads. Each input line holds two node ids
+ *  separated by blanks, commas, semicolons or '|'; empty lines and
+ *  lines starting with '#' are skipped.
+ *
+ *  With an overlay, its file is checked before each block and reloaded
+ *  if it changed, so a long stream picks up new closures and traffic
+ *  without a restart; every pair of a block uses the same overlay. A
+ *  partition is customized again with the new overlay before the block.
+ *
+ *  Text output, one line per pair:
+ *      startId targetId distance [id id ... id]
+ *  with distance -1 if there is no path or an id is unknown.
+ *  Binary output, one record per pair:
+ *      uint32 startId, uint32 targetId, double distance, uint32 n,
+ *      n uint32 path ids (n = 0 without paths).
+ *  JSON output, one object per line and pair, with the time spent
+ *  finding the ids and searching (microseconds) and the counters of
+ *  the forward and backward searches (see AStarStats_t):
+ *      {"start":id,"target":id,"distance":d|null,"lookup_us":t,
+ *       "search_us":t,"stats":[{...},{...}][,"path":[id,...]]}
+ *
+ *  Input:
+ *      graph: graph to search.
+ *      options: search options of the a-star queries.
+ *      batchOptions: output format, query engine and threads.
+ *      in: stream of pairs.
+ *      out: stream of results.
+ *      stats: counters of the run, filled if not NULL.
+ *
+ *  Return: 0 if successfull, 1 if a line could not be parsed.
+ */
+int runBatch(const graph_t *graph, const AStarOptions_t *options,
+             const batchOptions_t *batchOptions, FILE *in, FILE *out,
+             batchStats_t *stats);
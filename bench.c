@@ -0,0 +1,452 @@
+#include "aStar.h"
+#include "arcBatch.h"
+#include "ch.h"
+#include "crp.h"
+#include "graph.h"
+#include "landmarks.h"
+#include <assert.h>
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_BANDS 16          //Distance bands of the stratified set
+#define BENCH_FIRST_BAND 1000.  //Upper distance of the first band (meters)
+#define BENCH_TOLERANCE 1e-6    //Relative error accepted against the reference
+#define BENCH_MODES 9           //Most search modes run
+
+/*Query of a benchmark set, with its reference distance */
+typedef struct benchQuery_s{
+    uint32_t start, target; //Node positions
+    double reference;       //Dijkstra distance, DBL_MAX if unreachable
+    uint8_t band;           //Distance band of the reference
+} benchQuery_t;
+
+/*Search mode under test */
+typedef struct benchMode_s{
+    const char *name;       //Name in the report
+    AStarOptions_t options; //Options of the a-star searches
+    const ch_t *ch;         //Hierarchy to answer with, a-star if NULL
+    const crp_t *crp;       //Customized partition to answer with, a-star if NULL
+} benchMode_t;
+
+/*  RANDOMNODE
+ *
+ *  Seeded random node position, also for graphs with more nodes
+ *  than RAND_MAX.
+ *
+ *  Input:
+ *      n: number of nodes.
+ *
+ *  Return: position in [0,n).
+ */
+static uint32_t randomNode(uint32_t n){
+    return (uint32_t) (((uint64_t) rand()*((uint64_t) RAND_MAX+1)+rand())%n);
+}
+
+/*  DISTANCEBAND
+ *
+ *  Band of a distance: band 0 holds distances below BENCH_FIRST_BAND
+ *  and every next band doubles its upper limit.
+ *
+ *  Input:
+ *      distance: distance in meters.
+ *
+ *  Return: band of the distance.
+ */
+static uint8_t distanceBand(double distance){
+    double limit = BENCH_FIRST_BAND;
+    uint8_t band = 0;
+
+    while(distance >= limit && band < BENCH_BANDS-1){
+        limit *= 2.;
+        band++;
+    }
+    return band;
+}
+
+/*  REFERENCEDIJKSTRA
+ *
+ *  Distance from a source node to every node, the reference of the
+ *  benchmark. It keeps its own binary heap of (distance, node) entries
+ *  with lazy deletion, so a bug in the heap or the searches under test
+ *  cannot change the reference as well. Unreachable nodes get DBL_MAX.
+ *
+ *  Input:
+ *      graph: graph of the queries.
+ *      source: position of the source node.
+ *      dist: output vector of nNodes distances.
+ */
+static void referenceDijkstra(const graph_t *graph, uint32_t source, double *dist){
+    typedef struct entry_s{
+        double dist;
+        uint32_t node;
+    } entry_t;
+    entry_t *heap, top, moved;
+    uint64_t size = 0, cap = graph->nEdges+1, pos, child;
+    uint32_t i, v;
+    double cost;
+
+    heap = malloc(sizeof(entry_t)*cap); assert(heap);
+    for(i=0; i<graph->nNodes; i++)
+        dist[i] = DBL_MAX;
+    dist[source] = 0.;
+    heap[size++] = (entry_t) {0., source};
+    while(size > 0){
+        //Pop the smallest entry and sift the last one down from the root
+        top = heap[0];
+        moved = heap[--size];
+        for(pos=0; (child = 2*pos+1) < size; pos=child){
+            if(child+1 < size && heap[child+1].dist < heap[child].dist)
+                child++;
+            if(moved.dist <= heap[child].dist)
+                break;
+            heap[pos] = heap[child];
+        }
+        heap[pos] = moved;
+        //Stale entry of a node settled with a smaller distance
+        if(top.dist > dist[top.node])
+            continue;
+        for(i=graph->offsets[top.node]; i<graph->offsets[top.node+1]; i++){
+            v = graph->successors[i];
+            cost = top.dist+graph->weights[i];
+            if(cost >= dist[v])
+                continue;
+            dist[v] = cost;
+            //Each edge pushes at most once, so cap entries always fit
+            for(pos=size++; pos > 0 && heap[(pos-1)/2].dist > cost; pos=(pos-1)/2)
+                heap[pos] = heap[(pos-1)/2];
+            heap[pos] = (entry_t) {cost, v};
+        }
+    }
+    free(heap);
+}
+
+/*  MAKEQUERIES
+ *
+ *  Builds the query sets from seeded random sources. A full Dijkstra
+ *  from each source (referenceDijkstra) gives the reference
+ *  distances. The random set
+ *  takes perSource random targets of each source; the stratified set
+ *  takes one random target of each source in every distance band, so
+ *  short and long routes are measured apart. Only nodes with edges are
+ *  used, so simplified graphs are measured on their search graph.
+ *
+ *  Input:
+ *      graph: graph of the queries.
+ *      nSources: number of sources.
+ *      perSource: random targets of each source.
+ *      randomSet: output vector of nSources*perSource queries.
+ *      stratSet: output vector of up to nSources*BENCH_BANDS queries.
+ *      nStrat: output number of stratified queries.
+ */
+static void makeQueries(const graph_t *graph, uint32_t nSources, uint32_t perSource,
+                        benchQuery_t *randomSet, benchQuery_t *stratSet,
+                        uint32_t *nStrat){
+    uint32_t s, k, v, source, pick[BENCH_BANDS], count[BENCH_BANDS];
+    double *dist;
+    uint8_t b;
+
+    dist = malloc(sizeof(double)*graph->nNodes); assert(dist != NULL || graph->nNodes == 0);
+    *nStrat = 0;
+    for(s=0; s<nSources; s++){
+        source = randomNode(graph->nKept);
+        referenceDijkstra(graph,source,dist);
+        for(k=0; k<perSource; k++){
+            v = randomNode(graph->nKept);
+            randomSet[s*perSource+k].start = source;
+            randomSet[s*perSource+k].target = v;
+            randomSet[s*perSource+k].reference = dist[v];
+            randomSet[s*perSource+k].band = dist[v] < DBL_MAX ? distanceBand(dist[v]) : 0;
+        }
+        //One reachable target per band, by reservoir sampling
+        memset(count,0,sizeof(count));
+        for(v=0; v<graph->nKept; v++)
+            if(dist[v] < DBL_MAX){
+                b = distanceBand(dist[v]);
+                if(randomNode(++count[b]) == 0)
+                    pick[b] = v;
+            }
+        for(b=0; b<BENCH_BANDS; b++)
+            if(count[b] > 0){
+                stratSet[*nStrat].start = source;
+                stratSet[*nStrat].target = pick[b];
+                stratSet[*nStrat].reference = dist[pick[b]];
+                stratSet[(*nStrat)++].band = b;
+            }
+    }
+    free(dist);
+}
+
+/*  COMPAREDOUBLE
+ *
+ *  Compares two doubles, for qsort.
+ *
+ *  Input:
+ *      a, b: pointers to the values.
+ *
+ *  Return: -1, 0 or 1 if a is smaller, equal or bigger than b.
+ */
+static int compareDouble(const void *a, const void *b){
+    double da = *(const double *) a, db = *(const double *) b;
+    return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+/*  PERCENTILE
+ *
+ *  Percentile of a sorted vector, by the nearest rank.
+ *
+ *  Input:
+ *      sorted: sorted values.
+ *      n: number of values (not 0).
+ *      p: percentile in [0,100].
+ *
+ *  Return: value of the percentile.
+ */
+static double percentile(const double *sorted, uint32_t n, double p){
+    uint32_t rank = (uint32_t) ceil(p/100.*n);
+    return sorted[rank > 0 ? rank-1 : 0];
+}
+
+/*  RUNSET
+ *
+ *  Answers a query set with a search mode, checking every distance
+ *  against its reference, and prints a line of the report: queries
+ *  per second, latency percentiles, mean settled nodes and errors.
+ *  The median latency of each distance band is returned for the
+ *  stratified breakdown.
+ *
+ *  Input:
+ *      graph: graph of the queries.
+ *      mode: search mode.
+ *      setName: name of the set in the report.
+ *      queries: query set.
+ *      n: number of queries.
+ *      bandMedian: output median latency (us) of each band, -1 if empty.
+ *
+ *  Return: number of wrong answers.
+ */
+static uint32_t runSet(const graph_t *graph, const benchMode_t *mode,
+                       const char *setName, const benchQuery_t *queries,
+                       uint32_t n, double *bandMedian){
+    AStarContext_t ctx;
+    chWorkspace_t ws;
+    crpWorkspace_t crpWs;
+    struct timespec before, after;
+    double *latency, *band, total = 0., distance;
+    uint64_t settled = 0;
+    uint32_t i, errors = 0, nBand;
+    uint8_t found, b;
+
+    if(mode->ch != NULL)
+        chWorkspaceCreate(&ws,graph->nNodes);
+    else if(mode->crp != NULL)
+        crpWorkspaceCreate(&crpWs,mode->crp);
+    else
+        aStarContextCreate(&ctx,graph,&mode->options);
+    latency = malloc(sizeof(double)*n); assert(latency != NULL || n == 0);
+    band = malloc(sizeof(double)*n); assert(band != NULL || n == 0);
+
+    for(i=0; i<n; i++){
+        clock_gettime(CLOCK_MONOTONIC,&before);
+        if(mode->ch != NULL){
+            found = chQuery(mode->ch,&ws,queries[i].start,queries[i].target) == 0;
+            clock_gettime(CLOCK_MONOTONIC,&after);
+            distance = found ? ws.pathDist[ws.pathLen-1] : DBL_MAX;
+            settled += ws.settled[0]+ws.settled[1];
+        }else if(mode->crp != NULL){
+            found = crpQuery(mode->crp,&crpWs,queries[i].start,queries[i].target) == 0;
+            clock_gettime(CLOCK_MONOTONIC,&after);
+            distance = found ? crpWs.distance : DBL_MAX;
+            settled += crpWs.settled[0]+crpWs.settled[1];
+        }else{
+            found = aStarAlgorithm(&ctx,queries[i].start,queries[i].target) == 0;
+            clock_gettime(CLOCK_MONOTONIC,&after);
+            distance = found ? ctx.distance : DBL_MAX;
+            settled += ctx.stats[0].expanded+ctx.stats[1].expanded;
+        }
+        latency[i] = (after.tv_sec-before.tv_sec)*1e6+(after.tv_nsec-before.tv_nsec)*1e-3;
+        total += latency[i];
+        //Same reachability, and the same distance up to rounding
+        if((distance < DBL_MAX) != (queries[i].reference < DBL_MAX) ||
+           (distance < DBL_MAX && fabs(distance-queries[i].reference) >
+            BENCH_TOLERANCE*fmax(1.,queries[i].reference))){
+            if(errors++ < 5)
+                fprintf(stderr,"%s %s: wrong distance %lf between ids %"PRIu32" and %"PRIu32" (reference %lf)\n",
+                        mode->name,setName,distance < DBL_MAX ? distance : -1.,
+                        graph->ids[queries[i].start],graph->ids[queries[i].target],
+                        queries[i].reference < DBL_MAX ? queries[i].reference : -1.);
+        }
+    }
+
+    /* Median of each band, then of the whole set */
+    for(b=0; b<BENCH_BANDS && bandMedian != NULL; b++){
+        for(i=0, nBand=0; i<n; i++)
+            if(queries[i].band == b)
+                band[nBand++] = latency[i];
+        qsort(band,nBand,sizeof(double),compareDouble);
+        bandMedian[b] = nBand > 0 ? percentile(band,nBand,50.) : -1.;
+    }
+    qsort(latency,n,sizeof(double),compareDouble);
+    if(n > 0)
+        printf("%-14s %-10s %8"PRIu32" %10.1f %9.1f %9.1f %9.1f %9.1f %10.1f %6"PRIu32"\n",
+               mode->name,setName,n,total > 0. ? n/(total*1e-6) : 0.,
+               percentile(latency,n,50.),percentile(latency,n,90.),
+               percentile(latency,n,99.),latency[n-1],(double) settled/n,errors);
+
+    free(latency);
+    free(band);
+    if(mode->ch != NULL)
+        chWorkspaceFree(&ws);
+    else if(mode->crp != NULL)
+        crpWorkspaceFree(&crpWs);
+    else
+        aStarContextFree(&ctx);
+    return errors;
+}
+
+int main(int argc, char *argv[]){
+
+    uint32_t nSources = 100, perSource = 10, seed = 1, nStrat, nModes = 0, errors = 0, m;
+    char *landmarksFile = NULL, *chFile = NULL, *crpFile = NULL, label[16];
+    benchQuery_t *randomSet, *stratSet;
+    benchMode_t modes[BENCH_MODES];
+    double bandMedian[BENCH_MODES][BENCH_BANDS], limit;
+    landmarks_t landmarks;
+    graph_t graph;
+    ch_t ch;
+    crp_t crp;
+    int opt, bad = 0;
+    uint8_t b;
+
+    /* INPUT */
+    while((opt = getopt(argc,argv,"n:k:s:l:c:R:")) != -1){
+        switch(opt){
+            case 'n':
+                bad |= sscanf(optarg,"%"SCNu32,&nSources) != 1 || nSources == 0;
+                break;
+            case 'k':
+                bad |= sscanf(optarg,"%"SCNu32,&perSource) != 1;
+                break;
+            case 's':
+                bad |= sscanf(optarg,"%"SCNu32,&seed) != 1;
+                break;
+            case 'l':
+                landmarksFile = optarg;
+                break;
+            case 'c':
+                chFile = optarg;
+                break;
+            case 'R':
+                crpFile = optarg;
+                break;
+            default:
+                bad = 1;
+        }
+    }
+    if (bad || argc-optind < 1) {
+          fprintf(stderr,"%s [-n sources] [-k targets] [-s seed] [-l landmarks] [-c hierarchy] [-R partition] filename\n",argv[0]);
+          return 1;
+    }
+
+    /* READ GRAPH AND SIDECAR FILES */
+    if(graph_open(&graph,argv[optind]) != 0){
+        fprintf(stderr,"Problems reading graph. Exiting...\n");
+        return 1;
+    }
+    if(graph.nKept == 0){
+        fprintf(stderr,"Graph has no nodes with edges.\n");
+        graph_close(&graph);
+        return 1;
+    }
+    if(landmarksFile != NULL && openLandmarks(&landmarks,&graph,landmarksFile) != 0){
+        graph_close(&graph);
+        return 1;
+    }
+    if(chFile != NULL && openCH(&ch,&graph,chFile) != 0){
+        if(landmarksFile != NULL)
+            closeLandmarks(&landmarks);
+        graph_close(&graph);
+        return 1;
+    }
+    if(crpFile != NULL){
+        if(openCRP(&crp,&graph,crpFile) != 0){
+            if(chFile != NULL)
+                closeCH(&ch);
+            if(landmarksFile != NULL)
+                closeLandmarks(&landmarks);
+            graph_close(&graph);
+            return 1;
+        }
+        customizeCRP(&crp,NULL,sysconf(_SC_NPROCESSORS_ONLN));
+    }
+
+    /* SEARCH MODES */
+    modes[nModes++] = (benchMode_t) {"astar", {HEAP_QUEUE, STORED_EDGES, HAVERSINE_HEURISTIC, NULL, 0}, NULL, NULL};
+    modes[nModes++] = (benchMode_t) {"astar-list", {LIST_QUEUE, STORED_EDGES, HAVERSINE_HEURISTIC, NULL, 0}, NULL, NULL};
+    modes[nModes++] = (benchMode_t) {"astar-chord", {HEAP_QUEUE, STORED_EDGES, CHORD_HEURISTIC, NULL, 0}, NULL, NULL};
+    modes[nModes++] = (benchMode_t) {"bidir", {HEAP_QUEUE, STORED_EDGES, HAVERSINE_HEURISTIC, NULL, 1}, NULL, NULL};
+    modes[nModes++] = (benchMode_t) {"bidir-chord", {HEAP_QUEUE, STORED_EDGES, CHORD_HEURISTIC, NULL, 1}, NULL, NULL};
+    if(landmarksFile != NULL){
+        modes[nModes++] = (benchMode_t) {"alt", {HEAP_QUEUE, STORED_EDGES, ALT_HEURISTIC, &landmarks, 0}, NULL, NULL};
+        modes[nModes++] = (benchMode_t) {"bidir-alt", {HEAP_QUEUE, STORED_EDGES, ALT_HEURISTIC, &landmarks, 1}, NULL, NULL};
+    }
+    if(chFile != NULL)
+        modes[nModes++] = (benchMode_t) {"ch", {HEAP_QUEUE, STORED_EDGES, HAVERSINE_HEURISTIC, NULL, 0}, &ch, NULL};
+    if(crpFile != NULL)
+        modes[nModes++] = (benchMode_t) {"crp", {HEAP_QUEUE, STORED_EDGES, HAVERSINE_HEURISTIC, NULL, 0}, NULL, &crp};
+
+    /* QUERY SETS */
+    srand(seed);
+    randomSet = malloc(sizeof(benchQuery_t)*nSources*perSource); assert(randomSet != NULL || nSources*perSource == 0);
+    stratSet = malloc(sizeof(benchQuery_t)*nSources*BENCH_BANDS); assert(stratSet);
+    makeQueries(&graph,nSources,perSource,randomSet,stratSet,&nStrat);
+    printf("Graph: %"PRIu32" nodes (%"PRIu32" with edges), %"PRIu32" edges. Seed %"PRIu32": "
+           "%"PRIu32" random and %"PRIu32" stratified queries from %"PRIu32" sources.\n",
+           graph.nNodes,graph.nKept,graph.nEdges,seed,nSources*perSource,nStrat,nSources);
+    printf("Haversine bounds: %s kernel.\n",arcBatchKernel());
+
+    /* RUN */
+    printf("%-14s %-10s %8s %10s %9s %9s %9s %9s %10s %6s\n","mode","set","queries",
+           "qps","p50 us","p90 us","p99 us","max us","settled","errors");
+    for(m=0; m<nModes; m++){
+        errors += runSet(&graph,&modes[m],"random",randomSet,nSources*perSource,NULL);
+        errors += runSet(&graph,&modes[m],"stratified",stratSet,nStrat,bandMedian[m]);
+    }
+
+    /* STRATIFIED BREAKDOWN */
+    printf("\nMedian latency (us) of the stratified set by distance band:\n%-14s","mode");
+    for(b=0, limit=BENCH_FIRST_BAND; b<BENCH_BANDS; b++, limit*=2.)
+        if(bandMedian[0][b] >= 0.){
+            snprintf(label,sizeof(label),"%s%.0fkm",b < BENCH_BANDS-1 ? "<" : ">=",
+                     (b < BENCH_BANDS-1 ? limit : limit/2.)*1e-3);
+            printf(" %9s",label);
+        }
+    printf("\n");
+    for(m=0; m<nModes; m++){
+        printf("%-14s",modes[m].name);
+        for(b=0; b<BENCH_BANDS; b++)
+            if(bandMedian[0][b] >= 0.)
+                printf(" %9.1f",bandMedian[m][b]);
+        printf("\n");
+    }
+    if(errors > 0)
+        fprintf(stderr,"%"PRIu32" distances differ from the Dijkstra reference.\n",errors);
+
+    /* FREE MEMORY */
+    free(randomSet);
+    free(stratSet);
+    if(crpFile != NULL)
+        closeCRP(&crp);
+    if(chFile != NULL)
+        closeCH(&ch);
+    if(landmarksFile != NULL)
+        closeLandmarks(&landmarks);
+    graph_close(&graph);
+
+    return errors > 0;
+}
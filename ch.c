@@ -0,0 +1,723 @@
+#include "ch.h"
+#include "aStar.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <float.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*Growable list of arcs of a node during the contraction */
+typedef struct chList_s{
+    chArc_t *arcs;
+    uint32_t n, cap;
+} chList_t;
+
+/*State of the contraction */
+typedef struct chBuild_s{
+    uint32_t nNodes;
+    chList_t *out, *in;         //Remaining graph (uncontracted nodes)
+    chList_t *fwd, *bwd;        //Upward arcs of the contracted nodes
+    uint32_t *deleted;          //Contracted neighbours of each node
+    uint8_t *contracted;        //Node already contracted
+    heap_t witness;             //Queue of the witness searches
+    double *wDist;              //Distances of the witness searches
+    uint32_t *wStamp;           //Witness search that set wDist
+    uint8_t *wClosed;           //Node settled in witness search
+    uint32_t *wTarget;          //Contraction whose out-neighbours are marked
+    uint32_t wRound;            //Current witness search
+    uint32_t tRound;            //Current contraction
+} chBuild_t;
+
+/*  LISTSET
+ *
+ *  Adds an arc to a list, or lowers its length if the list already
+ *  has an arc to the same node (parallel edges keep the shortest).
+ *
+ *  Input:
+ *      list: list to modify.
+ *      node: other end of the arc.
+ *      middle: contracted node of a shortcut, CH_NO_MIDDLE otherwise.
+ *      w: length of the arc.
+ */
+static void listSet(chList_t *list, uint32_t node, uint32_t middle, double w){
+    uint32_t i;
+
+    for(i=0; i<list->n; i++)
+        if(list->arcs[i].target == node){
+            if(w < list->arcs[i].w){
+                list->arcs[i].w = w;
+                list->arcs[i].middle = middle;
+            }
+            return;
+        }
+    if(list->n == list->cap){
+        list->cap = list->cap ? 2*list->cap : 4;
+        list->arcs = realloc(list->arcs,sizeof(chArc_t)*list->cap); assert(list->arcs);
+    }
+    list->arcs[list->n].target = node;
+    list->arcs[list->n].middle = middle;
+    list->arcs[list->n].w = w;
+    list->n++;
+}
+
+/*  LISTREMOVE
+ *
+ *  Removes the arc to a node from a list, if any.
+ *
+ *  Input:
+ *      list: list to modify.
+ *      node: other end of the arc.
+ */
+static void listRemove(chList_t *list, uint32_t node){
+    uint32_t i;
+
+    for(i=0; i<list->n; i++)
+        if(list->arcs[i].target == node){
+            list->arcs[i] = list->arcs[--list->n];
+            return;
+        }
+}
+
+/*  WITNESSSEARCH
+ *
+ *  Dijkstra from source over the uncontracted nodes, skipping the
+ *  node being contracted, until the distance exceeds maxDist, all
+ *  the marked out-neighbours of the contracted node are settled or
+ *  maxSettled nodes are settled. Distances are left in wDist for
+ *  the nodes stamped with the current round.
+ *
+ *  Input:
+ *      b: state of the contraction.
+ *      source: start of the search.
+ *      avoid: node being contracted.
+ *      maxDist: longest path of interest.
+ *      nTargets: number of marked out-neighbours.
+ *      maxSettled: most nodes to settle.
+ */
+static void witnessSearch(chBuild_t *b, uint32_t source, uint32_t avoid,
+                          double maxDist, uint32_t nTargets,
+                          uint32_t maxSettled){
+    uint32_t i, u, x, settled = 0;
+    double cost;
+
+    b->wRound++;
+    b->witness.size = 0;
+    b->wDist[source] = 0.;
+    b->wStamp[source] = b->wRound;
+    b->wClosed[source] = 0;
+    heapPush(&b->witness,source,0.);
+    while(b->witness.size > 0 && settled < maxSettled && nTargets > 0){
+        if(b->witness.elems[0].f > maxDist)
+            break;
+        u = heapPop(&b->witness);
+        b->wClosed[u] = 1;
+        settled++;
+        if(b->wTarget[u] == b->tRound)
+            nTargets--;
+        for(i=0; i<b->out[u].n; i++){
+            x = b->out[u].arcs[i].target;
+            if(x == avoid)
+                continue;
+            cost = b->wDist[u]+b->out[u].arcs[i].w;
+            if(b->wStamp[x] != b->wRound){
+                b->wStamp[x] = b->wRound;
+                b->wClosed[x] = 0;
+                b->wDist[x] = cost;
+                heapPush(&b->witness,x,cost);
+            }else if(!b->wClosed[x] && cost < b->wDist[x]){
+                b->wDist[x] = cost;
+                heapDecreaseKey(&b->witness,x,cost);
+            }
+        }
+    }
+}
+
+/*  CONTRACTNODE
+ *
+ *  Finds the shortcuts needed to contract a node and, unless
+ *  simulating, adds them to the remaining graph.
+ *
+ *  Input:
+ *      b: state of the contraction.
+ *      v: node to contract.
+ *      simulate: only count the shortcuts.
+ *
+ *  Return: number of shortcuts.
+ */
+static uint32_t contractNode(chBuild_t *b, uint32_t v, uint8_t simulate){
+    uint32_t i, j, u, x, nShortcuts = 0;
+    double wIn, maxOut = 0., need;
+
+    //Mark the out-neighbours, so witness searches stop once all are settled
+    b->tRound++;
+    for(j=0; j<b->out[v].n; j++){
+        b->wTarget[b->out[v].arcs[j].target] = b->tRound;
+        if(b->out[v].arcs[j].w > maxOut)
+            maxOut = b->out[v].arcs[j].w;
+    }
+
+    for(i=0; i<b->in[v].n; i++){
+        u = b->in[v].arcs[i].target;
+        wIn = b->in[v].arcs[i].w;
+        witnessSearch(b,u,v,wIn+maxOut,b->out[v].n-(b->wTarget[u] == b->tRound),
+                      simulate ? CH_WITNESS_SIMULATE : CH_WITNESS_SETTLE);
+        for(j=0; j<b->out[v].n; j++){
+            x = b->out[v].arcs[j].target;
+            if(x == u)
+                continue;
+            need = wIn+b->out[v].arcs[j].w;
+            //A witness path as short as u->v->x makes the shortcut useless
+            if(b->wStamp[x] == b->wRound && b->wDist[x] <= need)
+                continue;
+            nShortcuts++;
+            if(!simulate){
+                listSet(&b->out[u],x,v,need);
+                listSet(&b->in[x],u,v,need);
+            }
+        }
+    }
+    return nShortcuts;
+}
+
+/*  NODEPRIORITY
+ *
+ *  Contraction priority of a node: edge difference plus number of
+ *  contracted neighbours, so contraction spreads uniformly.
+ *
+ *  Input:
+ *      b: state of the contraction.
+ *      v: node.
+ *
+ *  Return: priority, smaller is contracted first.
+ */
+static double nodePriority(chBuild_t *b, uint32_t v){
+    return (double) contractNode(b,v,1)-b->in[v].n-b->out[v].n+b->deleted[v];
+}
+
+/*  PACKARCS
+ *
+ *  Packs the upward arc lists into compressed sparse row form.
+ *
+ *  Input:
+ *      lists: arc list of each node.
+ *      nNodes: number of nodes.
+ *      offsets: output offsets (nNodes+1).
+ *      arcs: output arcs.
+ *
+ *  Return: number of arcs.
+ */
+static uint32_t packArcs(chList_t *lists, uint32_t nNodes, uint32_t **offsets,
+                         chArc_t **arcs){
+    uint32_t i, total = 0;
+
+    *offsets = malloc(sizeof(uint32_t)*(nNodes+1)); assert(*offsets);
+    for(i=0; i<nNodes; i++){
+        (*offsets)[i] = total;
+        total += lists[i].n;
+    }
+    (*offsets)[nNodes] = total;
+    *arcs = malloc(sizeof(chArc_t)*(total ? total : 1)); assert(*arcs);
+    for(i=0; i<nNodes; i++){
+        memcpy(*arcs+(*offsets)[i],lists[i].arcs,sizeof(chArc_t)*lists[i].n);
+        free(lists[i].arcs);
+    }
+    return total;
+}
+
+/*  BUILDCH
+ *
+ *  Builds the contraction hierarchy of a graph. Nodes are contracted
+ *  in order of edge difference (shortcuts added minus edges removed,
+ *  plus contracted neighbours), updated lazily. A shortcut u->w is
+ *  added when contracting v only if a witness search from u that
+ *  avoids v finds no path to w as short as u->v->w.
+ *
+ *  Input:
+ *      graph: graph to contract.
+ *      ch: output hierarchy, owned by the structure.
+ */
+void buildCH(const graph_t *graph, ch_t *ch){
+    chBuild_t b;
+    heap_t order;
+    uint32_t n = graph->nNodes, i, j, v, x, nContracted = 0, nShortcuts = 0;
+    uint32_t *rank, *fwdOffsets, *bwdOffsets;
+    chArc_t *fwdArcs, *bwdArcs;
+    double priority;
+
+    memset(ch,0,sizeof(ch_t));
+    b.nNodes = n;
+    b.out = calloc(n,sizeof(chList_t)); assert(b.out != NULL || n == 0);
+    b.in = calloc(n,sizeof(chList_t)); assert(b.in != NULL || n == 0);
+    b.fwd = calloc(n,sizeof(chList_t)); assert(b.fwd != NULL || n == 0);
+    b.bwd = calloc(n,sizeof(chList_t)); assert(b.bwd != NULL || n == 0);
+    b.deleted = calloc(n,sizeof(uint32_t)); assert(b.deleted != NULL || n == 0);
+    b.contracted = calloc(n,sizeof(uint8_t)); assert(b.contracted != NULL || n == 0);
+    b.wDist = malloc(sizeof(double)*n); assert(b.wDist != NULL || n == 0);
+    b.wStamp = calloc(n,sizeof(uint32_t)); assert(b.wStamp != NULL || n == 0);
+    b.wClosed = calloc(n,sizeof(uint8_t)); assert(b.wClosed != NULL || n == 0);
+    b.wTarget = calloc(n,sizeof(uint32_t)); assert(b.wTarget != NULL || n == 0);
+    b.wRound = b.tRound = 0;
+    heapCreate(&b.witness,n);
+    rank = malloc(sizeof(uint32_t)*n); assert(rank != NULL || n == 0);
+
+    //Remaining graph starts as the original one, without loops
+    for(i=0; i<n; i++)
+        for(j=graph->offsets[i]; j<graph->offsets[i+1]; j++)
+            if(graph->successors[j] != i){
+                listSet(&b.out[i],graph->successors[j],CH_NO_MIDDLE,graph->weights[j]);
+                listSet(&b.in[graph->successors[j]],i,CH_NO_MIDDLE,graph->weights[j]);
+            }
+
+    //Initial priorities
+    heapCreate(&order,n);
+    for(i=0; i<n; i++)
+        heapPush(&order,i,nodePriority(&b,i));
+
+    while(order.size > 0){
+        v = heapPop(&order);
+        //Lazy update: postpone the node if its priority grew
+        priority = nodePriority(&b,v);
+        if(order.size > 0 && priority > order.elems[0].f){
+            heapPush(&order,v,priority);
+            continue;
+        }
+
+        //Arcs to the remaining nodes go up in the hierarchy
+        for(j=0; j<b.out[v].n; j++)
+            listSet(&b.fwd[v],b.out[v].arcs[j].target,b.out[v].arcs[j].middle,
+                    b.out[v].arcs[j].w);
+        for(j=0; j<b.in[v].n; j++)
+            listSet(&b.bwd[v],b.in[v].arcs[j].target,b.in[v].arcs[j].middle,
+                    b.in[v].arcs[j].w);
+
+        nShortcuts += contractNode(&b,v,0);
+
+        //Remove the node from the remaining graph
+        for(j=0; j<b.out[v].n; j++){
+            x = b.out[v].arcs[j].target;
+            listRemove(&b.in[x],v);
+            b.deleted[x]++;
+        }
+        for(j=0; j<b.in[v].n; j++){
+            x = b.in[v].arcs[j].target;
+            listRemove(&b.out[x],v);
+            b.deleted[x]++;
+        }
+        free(b.out[v].arcs); free(b.in[v].arcs);
+        memset(&b.out[v],0,sizeof(chList_t));
+        memset(&b.in[v],0,sizeof(chList_t));
+        b.contracted[v] = 1;
+        rank[v] = nContracted++;
+        if(nContracted%100000 == 0)
+            fprintf(stderr,"Contracted %"PRIu32" of %"PRIu32" nodes (%"PRIu32" shortcuts)\n",
+                    nContracted,n,nShortcuts);
+    }
+    fprintf(stderr,"Contraction done: %"PRIu32" shortcuts\n",nShortcuts);
+
+    ch->nNodes = n;
+    ch->nEdges = graph->nEdges;
+    ch->graph = graph;
+    ch->nFwd = packArcs(b.fwd,n,&fwdOffsets,&fwdArcs);
+    ch->nBwd = packArcs(b.bwd,n,&bwdOffsets,&bwdArcs);
+    ch->rank = rank;
+    ch->fwdOffsets = fwdOffsets;
+    ch->fwdArcs = fwdArcs;
+    ch->bwdOffsets = bwdOffsets;
+    ch->bwdArcs = bwdArcs;
+
+    heapFree(&order);
+    heapFree(&b.witness);
+    free(b.out); free(b.in); free(b.fwd); free(b.bwd);
+    free(b.deleted); free(b.contracted);
+    free(b.wDist); free(b.wStamp); free(b.wClosed); free(b.wTarget);
+}
+
+/*  WRITECH
+ *
+ *  Writes the hierarchy into a file.
+ *
+ *  Input:
+ *      ch: hierarchy to write.
+ *      filename: name of the output file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int writeCH(const ch_t *ch, const char *filename){
+    static const char zeros[GRAPH_ALIGN] = {0};
+    chHeader_t header;
+    const void *data[5];
+    uint64_t size[5], *offset[5], pos;
+    FILE *binOut;
+    int i;
+
+    memset(&header,0,sizeof(chHeader_t));
+    header.magic = CH_MAGIC;
+    header.version = CH_VERSION;
+    header.nNodes = ch->nNodes;
+    header.nEdges = ch->nEdges;
+    header.nFwd = ch->nFwd;
+    header.nBwd = ch->nBwd;
+    data[0] = ch->rank;       size[0] = sizeof(uint32_t)*(uint64_t)ch->nNodes;     offset[0] = &header.rankOffset;
+    data[1] = ch->fwdOffsets; size[1] = sizeof(uint32_t)*((uint64_t)ch->nNodes+1); offset[1] = &header.fwdOffsetsOffset;
+    data[2] = ch->fwdArcs;    size[2] = sizeof(chArc_t)*(uint64_t)ch->nFwd;        offset[2] = &header.fwdArcsOffset;
+    data[3] = ch->bwdOffsets; size[3] = sizeof(uint32_t)*((uint64_t)ch->nNodes+1); offset[3] = &header.bwdOffsetsOffset;
+    data[4] = ch->bwdArcs;    size[4] = sizeof(chArc_t)*(uint64_t)ch->nBwd;        offset[4] = &header.bwdArcsOffset;
+    pos = sizeof(chHeader_t);
+    for(i=0; i<5; i++){
+        pos += (GRAPH_ALIGN-pos%GRAPH_ALIGN)%GRAPH_ALIGN;
+        *offset[i] = pos;
+        pos += size[i];
+    }
+
+    binOut = fopen(filename,"wb");
+    if(binOut == NULL){
+        fprintf(stderr,"Could not create hierarchy file.\n");
+        return 1;
+    }
+    pos = sizeof(chHeader_t);
+    if(fwrite(&header,sizeof(chHeader_t),1,binOut) != 1){
+        fprintf(stderr,"Could not write hierarchy file.\n");
+        fclose(binOut);
+        return 1;
+    }
+    for(i=0; i<5; i++){
+        if(fwrite(zeros,1,*offset[i]-pos,binOut) != *offset[i]-pos ||
+           fwrite(data[i],1,size[i],binOut) != size[i]){
+            fprintf(stderr,"Could not write hierarchy file.\n");
+            fclose(binOut);
+            return 1;
+        }
+        pos = *offset[i]+size[i];
+    }
+    if(fclose(binOut) != 0){
+        fprintf(stderr,"Could not close hierarchy file.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*  OPENCH
+ *
+ *  Maps read-only a hierarchy file, checking that it belongs to
+ *  the graph.
+ *
+ *  Input:
+ *      ch: hierarchy to fill.
+ *      graph: graph the hierarchy must belong to.
+ *      filename: name of the input file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int openCH(ch_t *ch, const graph_t *graph, const char *filename){
+    const chHeader_t *header;
+    struct stat st;
+    int fd;
+
+    memset(ch,0,sizeof(ch_t));
+    fd = open(filename,O_RDONLY);
+    if(fd < 0 || fstat(fd,&st) != 0 || (size_t) st.st_size < sizeof(chHeader_t)){
+        fprintf(stderr,"Could not open hierarchy file %s.\n",filename);
+        if(fd >= 0)
+            close(fd);
+        return 1;
+    }
+    ch->mapSize = st.st_size;
+    ch->map = mmap(NULL,ch->mapSize,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if(ch->map == MAP_FAILED){
+        fprintf(stderr,"Could not map hierarchy file %s.\n",filename);
+        ch->map = NULL;
+        return 1;
+    }
+
+    header = ch->map;
+    if(header->magic != CH_MAGIC || header->version != CH_VERSION ||
+       header->nNodes != graph->nNodes || header->nEdges != graph->nEdges ||
+       header->rankOffset+sizeof(uint32_t)*(uint64_t)header->nNodes > ch->mapSize ||
+       header->fwdOffsetsOffset+sizeof(uint32_t)*((uint64_t)header->nNodes+1) > ch->mapSize ||
+       header->fwdArcsOffset+sizeof(chArc_t)*(uint64_t)header->nFwd > ch->mapSize ||
+       header->bwdOffsetsOffset+sizeof(uint32_t)*((uint64_t)header->nNodes+1) > ch->mapSize ||
+       header->bwdArcsOffset+sizeof(chArc_t)*(uint64_t)header->nBwd > ch->mapSize){
+        fprintf(stderr,"Hierarchy file %s does not belong to the graph. Rebuild it with makeCH.\n",
+                filename);
+        closeCH(ch);
+        return 1;
+    }
+    ch->nNodes = header->nNodes;
+    ch->nEdges = header->nEdges;
+    ch->graph = graph;
+    ch->nFwd = header->nFwd;
+    ch->nBwd = header->nBwd;
+    ch->rank = (const uint32_t *) ((const char *) ch->map+header->rankOffset);
+    ch->fwdOffsets = (const uint32_t *) ((const char *) ch->map+header->fwdOffsetsOffset);
+    ch->fwdArcs = (const chArc_t *) ((const char *) ch->map+header->fwdArcsOffset);
+    ch->bwdOffsets = (const uint32_t *) ((const char *) ch->map+header->bwdOffsetsOffset);
+    ch->bwdArcs = (const chArc_t *) ((const char *) ch->map+header->bwdArcsOffset);
+    return 0;
+}
+
+/*  CLOSECH
+ *
+ *  Unmaps or frees the hierarchy.
+ *
+ *  Input:
+ *      ch: hierarchy to close.
+ */
+void closeCH(ch_t *ch){
+    if(ch->map != NULL){
+        munmap(ch->map,ch->mapSize);
+        ch->map = NULL;
+    }else{
+        free((void *) ch->rank);
+        free((void *) ch->fwdOffsets);
+        free((void *) ch->fwdArcs);
+        free((void *) ch->bwdOffsets);
+        free((void *) ch->bwdArcs);
+    }
+}
+
+/*  CHWORKSPACECREATE / CHWORKSPACEFREE
+ *
+ *  Allocates and frees the memory of hierarchy queries.
+ *
+ *  Input:
+ *      ws: workspace.
+ *      nNodes: number of nodes of the graph.
+ */
+void chWorkspaceCreate(chWorkspace_t *ws, uint32_t nNodes){
+    int d;
+
+    memset(ws,0,sizeof(chWorkspace_t));
+    for(d=0; d<2; d++){
+        ws->dist[d] = malloc(sizeof(double)*nNodes); assert(ws->dist[d] != NULL || nNodes == 0);
+        ws->parent[d] = malloc(sizeof(uint32_t)*nNodes); assert(ws->parent[d] != NULL || nNodes == 0);
+        ws->stamp[d] = calloc(nNodes,sizeof(uint32_t)); assert(ws->stamp[d] != NULL || nNodes == 0);
+        ws->closed[d] = malloc(sizeof(uint8_t)*nNodes); assert(ws->closed[d] != NULL || nNodes == 0);
+        heapCreate(&ws->heap[d],nNodes);
+    }
+    ws->path = malloc(sizeof(uint32_t)*nNodes); assert(ws->path != NULL || nNodes == 0);
+    ws->pathDist = malloc(sizeof(double)*nNodes); assert(ws->pathDist != NULL || nNodes == 0);
+    ws->fullPath = malloc(sizeof(uint32_t)*nNodes); assert(ws->fullPath != NULL || nNodes == 0);
+    ws->fullDist = malloc(sizeof(double)*nNodes); assert(ws->fullDist != NULL || nNodes == 0);
+    ws->pathCap = ws->fullCap = nNodes;
+    ws->stack = malloc(sizeof(uint32_t)*2*nNodes); assert(ws->stack != NULL || nNodes == 0);
+    ws->nNodes = nNodes;
+}
+
+void chWorkspaceFree(chWorkspace_t *ws){
+    int d;
+
+    for(d=0; d<2; d++){
+        free(ws->dist[d]); free(ws->parent[d]);
+        free(ws->stamp[d]); free(ws->closed[d]);
+        heapFree(&ws->heap[d]);
+    }
+    free(ws->path); free(ws->pathDist); free(ws->stack);
+    free(ws->fullPath); free(ws->fullDist);
+}
+
+/*  FINDARC
+ *
+ *  Arc of the hierarchy for the edge a->b.
+ *
+ *  Input:
+ *      ch: hierarchy.
+ *      a, b: ends of the edge.
+ *
+ *  Return: pointer to the arc.
+ */
+static const chArc_t *findArc(const ch_t *ch, uint32_t a, uint32_t b){
+    uint32_t i;
+
+    if(ch->rank[a] < ch->rank[b]){
+        for(i=ch->fwdOffsets[a]; i<ch->fwdOffsets[a+1]; i++)
+            if(ch->fwdArcs[i].target == b)
+                return &ch->fwdArcs[i];
+    }else{
+        for(i=ch->bwdOffsets[b]; i<ch->bwdOffsets[b+1]; i++)
+            if(ch->bwdArcs[i].target == a)
+                return &ch->bwdArcs[i];
+    }
+    assert(0);
+    return NULL;
+}
+
+/*  UNPACKEDGE
+ *
+ *  Appends to the path the original edges of the hierarchy edge
+ *  a->b, replacing shortcuts by their two halves.
+ *
+ *  Input:
+ *      ch: hierarchy.
+ *      ws: query memory with the path so far.
+ *      a, b: ends of the edge, a being the last node of the path.
+ */
+static void unpackEdge(const ch_t *ch, chWorkspace_t *ws, uint32_t a, uint32_t b){
+    const chArc_t *arc;
+    uint32_t top = 0;
+
+    ws->stack[top++] = a;
+    ws->stack[top++] = b;
+    while(top > 0){
+        b = ws->stack[--top];
+        a = ws->stack[--top];
+        arc = findArc(ch,a,b);
+        if(arc->middle == CH_NO_MIDDLE){
+            ws->path[ws->pathLen] = b;
+            ws->pathDist[ws->pathLen] = ws->pathDist[ws->pathLen-1]+arc->w;
+            ws->pathLen++;
+        }else{
+            //Second half below the first one, so the first is done first
+            ws->stack[top++] = arc->middle;
+            ws->stack[top++] = b;
+            ws->stack[top++] = a;
+            ws->stack[top++] = arc->middle;
+        }
+    }
+}
+
+/*  CHQUERY
+ *
+ *  Shortest distance between two nodes with a bidirectional upward
+ *  search, and unpacked path into ws->path and ws->pathDist. On a
+ *  simplified graph the searches start from the ends of the nodes
+ *  (see graph_ends), bounded by the direct path along a chain if they
+ *  share one, and the path is expanded with the contracted chains.
+ *
+ *  Input:
+ *      ch: hierarchy of the graph.
+ *      ws: query memory.
+ *      startNode: position of starting node in the graph.
+ *      targetNode: position of target node in the graph.
+ *
+ *  Return: 0 if a path was found, 1 otherwise.
+ */
+uint8_t chQuery(const ch_t *ch, chWorkspace_t *ws, uint32_t startNode,
+                uint32_t targetNode){
+    const graph_t *graph = ch->graph;
+    const uint32_t *offsets;
+    const chArc_t *arcs;
+    uint32_t i, u, x, d, next, ends[2], *auxPath, auxCap;
+    double best, cost, offsetsEnd[2], *auxDist;
+    uint8_t e, n;
+
+    //New query: older stamps are invalid
+    if(++ws->query == 0){
+        for(d=0; d<2; d++)
+            memset(ws->stamp[d],0,sizeof(uint32_t)*ws->nNodes);
+        ws->query = 1;
+    }
+    ws->meet = UINT32_MAX;
+    ws->pathLen = 0;
+    for(d=0; d<2; d++){
+        ws->heap[d].size = 0;
+        ws->settled[d] = 0;
+        n = graph_ends(graph,d == 0 ? startNode : targetNode,d,ends,offsetsEnd);
+        for(e=0; e<n; e++){
+            u = ends[e];
+            if(ws->stamp[d][u] == ws->query){
+                //Both ends of a loop
+                if(offsetsEnd[e] < ws->dist[d][u]){
+                    ws->dist[d][u] = offsetsEnd[e];
+                    heapDecreaseKey(&ws->heap[d],u,offsetsEnd[e]);
+                }
+                continue;
+            }
+            ws->dist[d][u] = offsetsEnd[e];
+            ws->parent[d][u] = u;
+            ws->stamp[d][u] = ws->query;
+            ws->closed[d][u] = 0;
+            heapPush(&ws->heap[d],u,offsetsEnd[e]);
+        }
+    }
+    //A path along a contracted chain bounds the searches
+    if(!graph_chain_distance(graph,startNode,targetNode,&best))
+        best = DBL_MAX;
+
+    /* Alternate the searches until neither can improve the best path */
+    while(1){
+        //Direction with the smallest key still below the best path
+        d = 2;
+        if(ws->heap[0].size > 0 && ws->heap[0].elems[0].f < best)
+            d = 0;
+        if(ws->heap[1].size > 0 && ws->heap[1].elems[0].f < best &&
+           (d == 2 || ws->heap[1].elems[0].f < ws->heap[0].elems[0].f))
+            d = 1;
+        if(d == 2)
+            break;
+
+        u = heapPop(&ws->heap[d]);
+        ws->closed[d][u] = 1;
+        ws->settled[d]++;
+        if(ws->stamp[1-d][u] == ws->query &&
+           ws->dist[d][u]+ws->dist[1-d][u] < best){
+            best = ws->dist[d][u]+ws->dist[1-d][u];
+            ws->meet = u;
+        }
+
+        offsets = d == 0 ? ch->fwdOffsets : ch->bwdOffsets;
+        arcs = d == 0 ? ch->fwdArcs : ch->bwdArcs;
+        for(i=offsets[u]; i<offsets[u+1]; i++){
+            x = arcs[i].target;
+            cost = ws->dist[d][u]+arcs[i].w;
+            if(ws->stamp[d][x] != ws->query){
+                ws->stamp[d][x] = ws->query;
+                ws->closed[d][x] = 0;
+                ws->dist[d][x] = cost;
+                ws->parent[d][x] = u;
+                heapPush(&ws->heap[d],x,cost);
+            }else if(!ws->closed[d][x] && cost < ws->dist[d][x]){
+                ws->dist[d][x] = cost;
+                ws->parent[d][x] = u;
+                heapDecreaseKey(&ws->heap[d],x,cost);
+            }
+        }
+    }
+    if(ws->meet == UINT32_MAX && best == DBL_MAX)
+        return 1;
+
+    /* Upward path from start to meeting node, then down to target.
+       The forward parents are reversed in place to walk them from start */
+    if(ws->meet != UINT32_MAX){
+        x = UINT32_MAX;
+        for(u=ws->meet; ws->parent[0][u]!=u; u=next){
+            next = ws->parent[0][u];
+            ws->parent[0][u] = x;
+            x = u;
+        }
+        ws->parent[0][u] = x;
+        ws->path[0] = u;
+        ws->pathDist[0] = ws->dist[0][u];
+        ws->pathLen = 1;
+        for(; ws->parent[0][u] != UINT32_MAX; u=x){
+            x = ws->parent[0][u];
+            unpackEdge(ch,ws,u,x);
+        }
+        for(u=ws->meet; ws->parent[1][u]!=u; u=x){
+            x = ws->parent[1][u];
+            unpackEdge(ch,ws,u,x);
+        }
+    }
+
+    /* Full path of a simplified graph, swapped into the path buffer */
+    if(graph->geoOffsets != NULL){
+        auxPath = ws->fullPath;
+        auxDist = ws->fullDist;
+        auxCap = ws->fullCap;
+        ws->pathLen = graph_expand_path(graph,startNode,targetNode,best,
+                                        ws->path,ws->pathDist,ws->pathLen,
+                                        &auxPath,&auxDist,&auxCap);
+        ws->fullPath = ws->path;
+        ws->fullDist = ws->pathDist;
+        ws->fullCap = ws->pathCap;
+        ws->path = auxPath;
+        ws->pathDist = auxDist;
+        ws->pathCap = auxCap;
+    }
+    return 0;
+}
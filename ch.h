@@ -0,0 +1,146 @@
+#pragma once
+#include "aStar.h"
+#include "graph.h"
+#include <inttypes.h>
+#include <stddef.h>
+
+#define CH_MAGIC 0x52474843        //"CHGR" in little endian
+#define CH_VERSION 1
+#define CH_NO_MIDDLE UINT32_MAX    //Middle node of an original edge
+#define CH_WITNESS_SETTLE 500      //Nodes settled by a witness search
+#define CH_WITNESS_SIMULATE 50     //Nodes settled when estimating priorities
+
+/*Edge of the hierarchy. It goes up in rank from the node owning it */
+typedef struct chArc_s{
+    uint32_t target;    //Other end of the edge
+    uint32_t middle;    //Contracted node of a shortcut, CH_NO_MIDDLE otherwise
+    double w;           //Length of the edge
+} chArc_t;
+
+/*Header of a contraction hierarchy file, followed by the arrays at
+ *aligned offsets */
+typedef struct chHeader_s{
+    uint32_t magic;         //CH_MAGIC
+    uint32_t version;       //CH_VERSION
+    uint32_t nNodes;        //Nodes of the graph
+    uint32_t nEdges;        //Edges of the graph
+    uint32_t nFwd, nBwd;    //Number of upward forward and backward arcs
+    uint64_t rankOffset;    //Position of the ranks
+    uint64_t fwdOffsetsOffset, fwdArcsOffset;
+    uint64_t bwdOffsetsOffset, bwdArcsOffset;
+} chHeader_t;
+
+/*Contraction hierarchy. fwd holds, for each node u, the edges u->v with
+ *rank(v) > rank(u); bwd holds, for each node v, the edges u->v with
+ *rank(u) > rank(v), stored with target u. */
+typedef struct ch_s{
+    uint32_t nNodes, nEdges, nFwd, nBwd;
+    const uint32_t *rank;           //Contraction order of each node
+    const uint32_t *fwdOffsets;     //Start of the arcs of each node (nNodes+1)
+    const chArc_t *fwdArcs;
+    const uint32_t *bwdOffsets;
+    const chArc_t *bwdArcs;
+    const graph_t *graph;           //Graph of the hierarchy
+    void *map;                      //Mapping of the file (NULL if owned)
+    size_t mapSize;                 //Size of the mapping
+} ch_t;
+
+/*Memory of a hierarchy query, reusable between queries */
+typedef struct chWorkspace_s{
+    uint32_t nNodes;        //Number of nodes
+    heap_t heap[2];         //Forward and backward queues
+    double *dist[2];        //Forward and backward distances
+    uint32_t *parent[2];    //Previous node in each search tree
+    uint32_t *stamp[2];     //Query in which dist and parent were set
+    uint8_t *closed[2];     //Node settled in each search
+    uint32_t *stack;        //Stack for path unpacking (2*nNodes)
+    uint32_t query;         //Current query
+    uint32_t meet;          //Node where the best path meets
+    uint64_t settled[2];    //Nodes settled by each search
+    uint32_t *path;         //Unpacked path (at least nNodes)
+    double *pathDist;       //Distance from start of each path node
+    uint32_t pathLen;       //Nodes in path
+    uint32_t pathCap;       //Room in path buffers
+    uint32_t *fullPath;     //Spare path buffers to expand paths of
+    double *fullDist;       //simplified graphs (at least nNodes)
+    uint32_t fullCap;       //Room in spare buffers
+} chWorkspace_t;
+
+/*  BUILDCH
+ *
+ *  Builds the contraction hierarchy of a graph. Nodes are contracted
+ *  in order of edge difference (shortcuts added minus edges removed,
+ *  plus contracted neighbours), updated lazily. A shortcut u->w is
+ *  added when contracting v only if a witness search from u that
+ *  avoids v finds no path to w as short as u->v->w.
+ *
+ *  Input:
+ *      graph: graph to contract.
+ *      ch: output hierarchy, owned by the structure.
+ */
+void buildCH(const graph_t *graph, ch_t *ch);
+
+/*  WRITECH
+ *
+ *  Writes the hierarchy into a file.
+ *
+ *  Input:
+ *      ch: hierarchy to write.
+ *      filename: name of the output file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int writeCH(const ch_t *ch, const char *filename);
+
+/*  OPENCH
+ *
+ *  Maps read-only a hierarchy file, checking that it belongs to
+ *  the graph.
+ *
+ *  Input:
+ *      ch: hierarchy to fill.
+ *      graph: graph the hierarchy must belong to.
+ *      filename: name of the input file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int openCH(ch_t *ch, const graph_t *graph, const char *filename);
+
+/*  CLOSECH
+ *
+ *  Unmaps or frees the hierarchy.
+ *
+ *  Input:
+ *      ch: hierarchy to close.
+ */
+void closeCH(ch_t *ch);
+
+/*  CHWORKSPACECREATE / CHWORKSPACEFREE
+ *
+ *  Allocates and frees the memory of hierarchy queries.
+ *
+ *  Input:
+ *      ws: workspace.
+ *      nNodes: number of nodes of the graph.
+ */
+void chWorkspaceCreate(chWorkspace_t *ws, uint32_t nNodes);
+void chWorkspaceFree(chWorkspace_t *ws);
+
+/*  CHQUERY
+ *
+ *  Shortest distance between two nodes with a bidirectional upward
+ *  search, and unpacked path into ws->path and ws->pathDist. On a
+ *  simplified graph the searches start from the ends of the nodes
+ *  (see graph_ends), bounded by the direct path along a chain if they
+ *  share one, and the path is expanded with the contracted chains.
+ *
+ *  Input:
+ *      ch: hierarchy of the graph.
+ *      ws: query memory.
+ *      startNode: position of starting node in the graph.
+ *      targetNode: position of target node in the graph.
+ *
+ *  Return: 0 if a path was found, 1 otherwise.
+ */
+uint8_t chQuery(const ch_t *ch, chWorkspace_t *ws, uint32_t startNode,
+                uint32_t targetNode);
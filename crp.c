@@ -0,0 +1,903 @@
+#include "crp.h"
+#include "aStar.h"
+#include "myFunctions.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*Node of the partition and its coordinate along the side being split */
+typedef struct crpSort_s{
+    double key;
+    uint32_t node;
+} crpSort_t;
+
+/*State shared by the threads of a customization */
+typedef struct crpShared_s{
+    crp_t *crp;
+    uint32_t level;             //Level being customized
+    pthread_mutex_t lock;       //Protects next
+    uint32_t next;              //Next cell to customize
+} crpShared_t;
+
+/*Search memory of a customization thread */
+typedef struct crpWorker_s{
+    crpShared_t *shared;
+    heap_t heap;
+    double *dist;               //Distance of each node or boundary node
+    uint32_t *stamp;            //Search in which dist was set
+    uint8_t *closed;            //Node settled
+    uint8_t *clique;            //Node reached along a clique of the level below
+    uint32_t query;             //Current search
+    pthread_t thread;
+} crpWorker_t;
+
+/*  EDGECOST
+ *
+ *  Cost of an edge in the customized metric.
+ *
+ *  Input:
+ *      overlay: edge cost changes, NULL if none.
+ *      backward: 1 for a position in the reverse adjacency.
+ *      i: position of the edge.
+ *      weight: stored weight of the edge.
+ *
+ *  Return: cost of the edge, DBL_MAX if closed.
+ */
+static inline double edgeCost(const overlay_t *overlay, uint8_t backward,
+                              uint32_t i, float weight){
+    if(overlay != NULL && (weight = overlayCost(overlay,backward,i,weight)) == OVERLAY_BLOCKED)
+        return DBL_MAX;
+    return weight;
+}
+
+/*  COMPAREKEY
+ *
+ *  Order of crpSort_t by key, for qsort.
+ */
+static int compareKey(const void *a, const void *b){
+    double ka = ((const crpSort_t *) a)->key, kb = ((const crpSort_t *) b)->key;
+
+    return ka < kb ? -1 : ka > kb;
+}
+
+/*  BISECT
+ *
+ *  Splits a set of nodes in two halves at the median of its longest
+ *  side, and each half again, down to a depth, numbering the cells.
+ *
+ *  Input:
+ *      graph: graph of the nodes.
+ *      sort: nodes of the set, reordered.
+ *      n: number of nodes.
+ *      level: bisections left.
+ *      code: code of the set.
+ *      codes: output cell of each node.
+ */
+static void bisect(const graph_t *graph, crpSort_t *sort, uint32_t n,
+                   uint32_t level, uint32_t code, uint32_t *codes){
+    double minLat = DBL_MAX, maxLat = -DBL_MAX, minLon = DBL_MAX, maxLon = -DBL_MAX;
+    double lat, lon, scale;
+    uint32_t i;
+
+    if(level == 0){
+        for(i=0; i<n; i++)
+            codes[sort[i].node] = code;
+        return;
+    }
+    for(i=0; i<n; i++){
+        lat = graph->lat[sort[i].node]*(DEG2RAD/COORD_SCALE);
+        lon = graph->lon[sort[i].node]*(DEG2RAD/COORD_SCALE);
+        if(lat < minLat) minLat = lat;
+        if(lat > maxLat) maxLat = lat;
+        if(lon < minLon) minLon = lon;
+        if(lon > maxLon) maxLon = lon;
+    }
+    //Degrees of longitude are shorter away from the equator
+    scale = cos(0.5*(minLat+maxLat));
+    for(i=0; i<n; i++)
+        sort[i].key = (maxLat-minLat) >= scale*(maxLon-minLon) ?
+                      graph->lat[sort[i].node] : graph->lon[sort[i].node];
+    qsort(sort,n,sizeof(crpSort_t),compareKey);
+    bisect(graph,sort,n/2,level-1,code<<1,codes);
+    bisect(graph,sort+n/2,n-n/2,level-1,code<<1|1,codes);
+}
+
+/*  BUILDLEVELS
+ *
+ *  Finds the boundary nodes of every level of a partition, and
+ *  allocates their clique matrices.
+ *
+ *  Input:
+ *      crp: partition with its codes.
+ */
+static void buildLevels(crp_t *crp){
+    const graph_t *graph = crp->graph;
+    crpLevel_t *level;
+    uint32_t l, u, j, c, k, shift, *fill;
+    uint8_t *boundary;
+
+    boundary = malloc(sizeof(uint8_t)*crp->nKept); assert(boundary != NULL || crp->nKept == 0);
+    for(l=0; l<crp->nLevels; l++){
+        level = &crp->levels[l];
+        shift = l*crp->fanBits;
+        level->nCells = 1u << (crp->depth-shift);
+
+        //Both ends of every edge between cells
+        memset(boundary,0,sizeof(uint8_t)*crp->nKept);
+        for(u=0; u<crp->nKept; u++)
+            for(j=graph->offsets[u]; j<graph->offsets[u+1]; j++)
+                if((crp->code[u]^crp->code[graph->successors[j]]) >> shift){
+                    boundary[u] = 1;
+                    boundary[graph->successors[j]] = 1;
+                }
+
+        //Boundary nodes sorted by cell
+        level->cellOffsets = calloc(level->nCells+1,sizeof(uint32_t)); assert(level->cellOffsets);
+        for(u=0; u<crp->nKept; u++)
+            if(boundary[u])
+                level->cellOffsets[(crp->code[u]>>shift)+1]++;
+        for(c=0; c<level->nCells; c++)
+            level->cellOffsets[c+1] += level->cellOffsets[c];
+        level->nBoundary = level->cellOffsets[level->nCells];
+        level->nodes = malloc(sizeof(uint32_t)*level->nBoundary); assert(level->nodes != NULL || level->nBoundary == 0);
+        level->index = malloc(sizeof(uint32_t)*crp->nKept); assert(level->index != NULL || crp->nKept == 0);
+        fill = malloc(sizeof(uint32_t)*level->nCells); assert(fill);
+        memcpy(fill,level->cellOffsets,sizeof(uint32_t)*level->nCells);
+        for(u=0; u<crp->nKept; u++)
+            if(boundary[u]){
+                level->index[u] = fill[crp->code[u]>>shift]++;
+                level->nodes[level->index[u]] = u;
+            }else
+                level->index[u] = UINT32_MAX;
+        free(fill);
+
+        //A k x k matrix per cell
+        level->matrixOffsets = malloc(sizeof(uint64_t)*(level->nCells+1)); assert(level->matrixOffsets);
+        level->matrixOffsets[0] = 0;
+        for(c=0; c<level->nCells; c++){
+            k = level->cellOffsets[c+1]-level->cellOffsets[c];
+            level->matrixOffsets[c+1] = level->matrixOffsets[c]+(uint64_t)k*k;
+        }
+        level->matrix = malloc(sizeof(double)*level->matrixOffsets[level->nCells]);
+        assert(level->matrix != NULL || level->matrixOffsets[level->nCells] == 0);
+    }
+    free(boundary);
+}
+
+/*  BUILDCRP
+ *
+ *  Partitions the nodes with edges of a graph by recursive bisection:
+ *  each set is split at the median of its longest side, measured on
+ *  the sphere, until cells hold at most cellSize nodes. Nearby nodes
+ *  share cells, so few edges cross between them on road networks.
+ *  Levels are added while the level above has at least 2 cells.
+ *
+ *  Input:
+ *      graph: graph to partition.
+ *      cellSize: largest cell of the lowest level.
+ *      fanBits: log2 of the cells of a level inside a cell above.
+ *      crp: output partition, owned by the structure, not customized.
+ */
+void buildCRP(const graph_t *graph, uint32_t cellSize, uint32_t fanBits, crp_t *crp){
+    crpSort_t *sort;
+    uint32_t *code, u;
+
+    memset(crp,0,sizeof(crp_t));
+    crp->graph = graph;
+    crp->nKept = graph->nKept;
+    crp->fanBits = fanBits > 0 ? fanBits : 1;
+    while(crp->depth < 31 && ((uint64_t)cellSize << crp->depth) < crp->nKept)
+        crp->depth++;
+    crp->nLevels = crp->depth > 0 ? (crp->depth-1)/crp->fanBits+1 : 0;
+    if(crp->nLevels > CRP_MAX_LEVELS)
+        crp->nLevels = CRP_MAX_LEVELS;
+
+    code = malloc(sizeof(uint32_t)*crp->nKept); assert(code != NULL || crp->nKept == 0);
+    sort = malloc(sizeof(crpSort_t)*crp->nKept); assert(sort != NULL || crp->nKept == 0);
+    for(u=0; u<crp->nKept; u++)
+        sort[u].node = u;
+    bisect(graph,sort,crp->nKept,crp->depth,0,code);
+    free(sort);
+    crp->code = code;
+    buildLevels(crp);
+}
+
+/*  WRITECRP
+ *
+ *  Writes the partition into a file. The clique matrices are not
+ *  written: they are rebuilt for each metric by customizeCRP.
+ *
+ *  Input:
+ *      crp: partition to write.
+ *      filename: name of the output file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int writeCRP(const crp_t *crp, const char *filename){
+    static const char zeros[GRAPH_ALIGN] = {0};
+    crpHeader_t header;
+    uint64_t pos;
+    FILE *binOut;
+
+    memset(&header,0,sizeof(crpHeader_t));
+    header.magic = CRP_MAGIC;
+    header.version = CRP_VERSION;
+    header.nNodes = crp->graph->nNodes;
+    header.nEdges = crp->graph->nEdges;
+    header.nKept = crp->nKept;
+    header.depth = crp->depth;
+    header.fanBits = crp->fanBits;
+    header.nLevels = crp->nLevels;
+    pos = sizeof(crpHeader_t);
+    header.codeOffset = pos+(GRAPH_ALIGN-pos%GRAPH_ALIGN)%GRAPH_ALIGN;
+
+    binOut = fopen(filename,"wb");
+    if(binOut == NULL){
+        fprintf(stderr,"Could not create partition file.\n");
+        return 1;
+    }
+    if(fwrite(&header,sizeof(crpHeader_t),1,binOut) != 1 ||
+       fwrite(zeros,1,header.codeOffset-pos,binOut) != header.codeOffset-pos ||
+       fwrite(crp->code,sizeof(uint32_t),crp->nKept,binOut) != crp->nKept){
+        fprintf(stderr,"Could not write partition file.\n");
+        fclose(binOut);
+        return 1;
+    }
+    if(fclose(binOut) != 0){
+        fprintf(stderr,"Could not close partition file.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*  OPENCRP
+ *
+ *  Maps read-only a partition file, checking that it belongs to the
+ *  graph, and finds the boundary nodes of every level. The partition
+ *  must be customized before queries.
+ *
+ *  Input:
+ *      crp: partition to fill.
+ *      graph: graph the partition must belong to.
+ *      filename: name of the input file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int openCRP(crp_t *crp, const graph_t *graph, const char *filename){
+    const crpHeader_t *header;
+    struct stat st;
+    int fd;
+
+    memset(crp,0,sizeof(crp_t));
+    fd = open(filename,O_RDONLY);
+    if(fd < 0 || fstat(fd,&st) != 0 || (size_t) st.st_size < sizeof(crpHeader_t)){
+        fprintf(stderr,"Could not open partition file %s.\n",filename);
+        if(fd >= 0)
+            close(fd);
+        return 1;
+    }
+    crp->mapSize = st.st_size;
+    crp->map = mmap(NULL,crp->mapSize,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if(crp->map == MAP_FAILED){
+        fprintf(stderr,"Could not map partition file %s.\n",filename);
+        crp->map = NULL;
+        return 1;
+    }
+
+    header = crp->map;
+    if(header->magic != CRP_MAGIC || header->version != CRP_VERSION ||
+       header->nNodes != graph->nNodes || header->nEdges != graph->nEdges ||
+       header->nKept != graph->nKept || header->depth > 31 || header->fanBits == 0 ||
+       header->nLevels > CRP_MAX_LEVELS || header->nLevels*header->fanBits > header->depth+header->fanBits-1 ||
+       header->codeOffset+sizeof(uint32_t)*(uint64_t)header->nKept > crp->mapSize){
+        fprintf(stderr,"Partition file %s does not belong to the graph. Rebuild it with makeCRP.\n",
+                filename);
+        closeCRP(crp);
+        return 1;
+    }
+    crp->graph = graph;
+    crp->nKept = header->nKept;
+    crp->depth = header->depth;
+    crp->fanBits = header->fanBits;
+    crp->nLevels = header->nLevels;
+    crp->code = (const uint32_t *) ((const char *) crp->map+header->codeOffset);
+    buildLevels(crp);
+    return 0;
+}
+
+/*  CLOSECRP
+ *
+ *  Unmaps or frees the partition and its clique matrices.
+ *
+ *  Input:
+ *      crp: partition to close.
+ */
+void closeCRP(crp_t *crp){
+    uint32_t l;
+
+    for(l=0; l<crp->nLevels; l++){
+        free(crp->levels[l].cellOffsets);
+        free(crp->levels[l].nodes);
+        free(crp->levels[l].index);
+        free(crp->levels[l].matrixOffsets);
+        free(crp->levels[l].matrix);
+    }
+    if(crp->map != NULL){
+        munmap(crp->map,crp->mapSize);
+        crp->map = NULL;
+    }else
+        free((void *) crp->code);
+}
+
+/*  RELAXCELL
+ *
+ *  Relaxes an arc of a customization search.
+ *
+ *  Input:
+ *      worker: search memory.
+ *      x: head of the arc.
+ *      cost: distance of x through the arc.
+ *      clique: 1 if the arc is a clique arc of the level below.
+ */
+static inline void relaxCell(crpWorker_t *worker, uint32_t x, double cost, uint8_t clique){
+    if(worker->stamp[x] != worker->query){
+        worker->stamp[x] = worker->query;
+        worker->closed[x] = 0;
+        worker->dist[x] = cost;
+        worker->clique[x] = clique;
+        heapPush(&worker->heap,x,cost);
+    }else if(!worker->closed[x] && cost < worker->dist[x]){
+        worker->dist[x] = cost;
+        worker->clique[x] = clique;
+        heapDecreaseKey(&worker->heap,x,cost);
+    }
+}
+
+/*  CUSTOMIZECELL
+ *
+ *  Fills the clique matrix of a cell: a Dijkstra from each of its
+ *  boundary nodes, on the graph edges inside the cell for level 0, and
+ *  on the boundary nodes of the level below inside the cell otherwise.
+ *
+ *  Input:
+ *      worker: search memory.
+ *      l: level of the cell.
+ *      c: cell.
+ */
+static void customizeCell(crpWorker_t *worker, uint32_t l, uint32_t c){
+    const crp_t *crp = worker->shared->crp;
+    const graph_t *graph = crp->graph;
+    const crpLevel_t *level = &crp->levels[l], *below = l > 0 ? &crp->levels[l-1] : NULL;
+    const uint32_t *code = crp->code;
+    uint32_t first = level->cellOffsets[c], k = level->cellOffsets[c+1]-first;
+    uint32_t r, i, j, u, x, sub, subFirst, subK, shift = l*crp->fanBits;
+    uint32_t belowShift = l > 0 ? (l-1)*crp->fanBits : 0;
+    double *matrix = level->matrix+level->matrixOffsets[c], cost;
+    const double *subMatrix;
+
+    for(r=0; r<k; r++){
+        //New search: older stamps are invalid
+        if(++worker->query == 0){
+            memset(worker->stamp,0,sizeof(uint32_t)*crp->nKept);
+            worker->query = 1;
+        }
+        worker->heap.size = 0;
+        u = level->nodes[first+r];
+        relaxCell(worker,l > 0 ? below->index[u] : u,0.,0);
+        while(worker->heap.size > 0){
+            i = heapPop(&worker->heap);
+            worker->closed[i] = 1;
+            u = l > 0 ? below->nodes[i] : i;
+            /* Clique of the cell of the level below. Its distances are
+               shortest paths inside the cell, so a node reached along
+               it has nothing to improve through it */
+            if(l > 0 && !worker->clique[i]){
+                sub = code[u]>>belowShift;
+                subFirst = below->cellOffsets[sub];
+                subK = below->cellOffsets[sub+1]-subFirst;
+                subMatrix = below->matrix+below->matrixOffsets[sub]+(uint64_t)(i-subFirst)*subK;
+                for(j=0; j<subK; j++)
+                    if(subMatrix[j] != DBL_MAX)
+                        relaxCell(worker,subFirst+j,worker->dist[i]+subMatrix[j],1);
+            }
+            //Graph edges inside the cell (between cells of the level below)
+            for(j=graph->offsets[u]; j<graph->offsets[u+1]; j++){
+                x = graph->successors[j];
+                if((code[x]>>shift) != c || (l > 0 && ((code[u]^code[x])>>belowShift) == 0))
+                    continue;
+                cost = edgeCost(crp->overlay,0,j,graph->weights[j]);
+                if(cost != DBL_MAX)
+                    relaxCell(worker,l > 0 ? below->index[x] : x,worker->dist[i]+cost,0);
+            }
+        }
+        for(j=0; j<k; j++){
+            x = l > 0 ? below->index[level->nodes[first+j]] : level->nodes[first+j];
+            matrix[(uint64_t)r*k+j] = worker->stamp[x] == worker->query ? worker->dist[x] : DBL_MAX;
+        }
+    }
+}
+
+/*  CUSTOMIZEWORKER
+ *
+ *  Thread loop: takes the next cell of the level until none is left.
+ *
+ *  Input:
+ *      arg: crpWorker_t of the thread.
+ *
+ *  Return: NULL.
+ */
+static void *customizeWorker(void *arg){
+    crpWorker_t *worker = arg;
+    crpShared_t *shared = worker->shared;
+    uint32_t c;
+
+    for(;;){
+        pthread_mutex_lock(&shared->lock);
+        c = shared->next++;
+        pthread_mutex_unlock(&shared->lock);
+        if(c >= shared->crp->levels[shared->level].nCells)
+            break;
+        customizeCell(worker,shared->level,c);
+    }
+    return NULL;
+}
+
+/*  CUSTOMIZECRP
+ *
+ *  Computes the clique matrices of every cell for a metric: the stored
+ *  edge weights changed by an overlay, if any. Level 0 cells run a
+ *  Dijkstra from each boundary node restricted to the cell; cells of
+ *  higher levels run it on the boundary nodes of the level below,
+ *  using its matrices and the edges between its cells. The cells of a
+ *  level are shared by a pool of threads. Queries must not run
+ *  meanwhile.
+ *
+ *  Input:
+ *      crp: partition to customize.
+ *      overlay: edge cost changes, NULL for the stored weights. It
+ *               must live as long as the customization is used.
+ *      threads: number of threads.
+ */
+void customizeCRP(crp_t *crp, const overlay_t *overlay, uint32_t threads){
+    crpShared_t shared;
+    crpWorker_t *workers;
+    uint32_t i, l;
+
+    crp->overlay = overlayActive(overlay);
+    if(threads == 0)
+        threads = 1;
+    shared.crp = crp;
+    pthread_mutex_init(&shared.lock,NULL);
+    workers = calloc(threads,sizeof(crpWorker_t)); assert(workers);
+    for(i=0; i<threads; i++){
+        workers[i].shared = &shared;
+        heapCreate(&workers[i].heap,crp->nKept+1);
+        workers[i].dist = malloc(sizeof(double)*crp->nKept); assert(workers[i].dist != NULL || crp->nKept == 0);
+        workers[i].stamp = calloc(crp->nKept+1,sizeof(uint32_t)); assert(workers[i].stamp);
+        workers[i].closed = malloc(sizeof(uint8_t)*crp->nKept); assert(workers[i].closed != NULL || crp->nKept == 0);
+        workers[i].clique = malloc(sizeof(uint8_t)*crp->nKept); assert(workers[i].clique != NULL || crp->nKept == 0);
+    }
+
+    //Each level uses the matrices of the level below
+    for(l=0; l<crp->nLevels; l++){
+        shared.level = l;
+        shared.next = 0;
+        for(i=1; i<threads; i++)
+            if(pthread_create(&workers[i].thread,NULL,customizeWorker,&workers[i]) != 0){
+                fprintf(stderr,"ERROR: Can not create thread.\n");
+                exit(1);
+            }
+        customizeWorker(&workers[0]);
+        for(i=1; i<threads; i++)
+            pthread_join(workers[i].thread,NULL);
+    }
+
+    for(i=0; i<threads; i++){
+        heapFree(&workers[i].heap);
+        free(workers[i].dist);
+        free(workers[i].stamp);
+        free(workers[i].closed);
+        free(workers[i].clique);
+    }
+    free(workers);
+    pthread_mutex_destroy(&shared.lock);
+}
+
+/*  CRPWORKSPACECREATE / CRPWORKSPACEFREE
+ *
+ *  Allocates and frees the memory of multilevel queries.
+ *
+ *  Input:
+ *      ws: workspace.
+ *      crp: partition of the queries.
+ */
+void crpWorkspaceCreate(crpWorkspace_t *ws, const crp_t *crp){
+    uint32_t n = crp->nKept+1;
+    int d;
+
+    memset(ws,0,sizeof(crpWorkspace_t));
+    for(d=0; d<2; d++){
+        ws->dist[d] = malloc(sizeof(double)*n); assert(ws->dist[d]);
+        ws->parent[d] = malloc(sizeof(uint32_t)*n); assert(ws->parent[d]);
+        ws->step[d] = malloc(sizeof(uint8_t)*n); assert(ws->step[d]);
+        ws->stamp[d] = calloc(n,sizeof(uint32_t)); assert(ws->stamp[d]);
+        ws->closed[d] = malloc(sizeof(uint8_t)*n); assert(ws->closed[d]);
+        heapCreate(&ws->heap[d],n);
+    }
+    heapCreate(&ws->unpackHeap,n);
+    ws->unpackDist = malloc(sizeof(double)*n); assert(ws->unpackDist);
+    ws->unpackParent = malloc(sizeof(uint32_t)*n); assert(ws->unpackParent);
+    ws->unpackStamp = calloc(n,sizeof(uint32_t)); assert(ws->unpackStamp);
+    ws->unpackStep = malloc(sizeof(uint8_t)*n); assert(ws->unpackStep);
+    ws->stack = malloc(sizeof(crpStep_t)*n); assert(ws->stack);
+    ws->path = malloc(sizeof(uint32_t)*n); assert(ws->path);
+    ws->pathDist = malloc(sizeof(double)*n); assert(ws->pathDist);
+    ws->fullPath = malloc(sizeof(uint32_t)*n); assert(ws->fullPath);
+    ws->fullDist = malloc(sizeof(double)*n); assert(ws->fullDist);
+    ws->pathCap = ws->fullCap = n;
+    ws->nKept = crp->nKept;
+}
+
+void crpWorkspaceFree(crpWorkspace_t *ws){
+    int d;
+
+    for(d=0; d<2; d++){
+        free(ws->dist[d]); free(ws->parent[d]); free(ws->step[d]);
+        free(ws->stamp[d]); free(ws->closed[d]);
+        heapFree(&ws->heap[d]);
+    }
+    heapFree(&ws->unpackHeap);
+    free(ws->unpackDist); free(ws->unpackParent); free(ws->unpackStamp); free(ws->unpackStep);
+    free(ws->stack); free(ws->path); free(ws->pathDist);
+    free(ws->fullPath); free(ws->fullDist);
+}
+
+/*  QUERYLEVEL
+ *
+ *  Level a node is searched on: the highest level whose cell of the
+ *  node holds none of the ends of the query.
+ *
+ *  Input:
+ *      crp: partition.
+ *      ws: query memory with the codes of the ends.
+ *      u: position of the node.
+ *
+ *  Return: level, CRP_NO_LEVEL if the lowest cell of the node holds
+ *          an end.
+ */
+static inline uint8_t queryLevel(const crp_t *crp, const crpWorkspace_t *ws, uint32_t u){
+    uint32_t diff, level = crp->nLevels-1, l;
+    uint8_t e;
+
+    if(crp->nLevels == 0)
+        return CRP_NO_LEVEL;
+    for(e=0; e<ws->nSpecial; e++){
+        diff = crp->code[u]^ws->special[e];
+        if(diff == 0)
+            return CRP_NO_LEVEL;
+        //Cells of level l differ while diff >> (l*fanBits) is not 0
+        l = (31-__builtin_clz(diff))/crp->fanBits;
+        if(l < level)
+            level = l;
+    }
+    return level;
+}
+
+/*  RELAXQUERY
+ *
+ *  Relaxes an arc of a query search, and checks the path through its
+ *  head if the other search reached it.
+ *
+ *  Input:
+ *      ws: query memory.
+ *      d: direction of the search.
+ *      u: tail of the arc.
+ *      x: head of the arc.
+ *      cost: distance of x through the arc.
+ *      step: level of the clique of the arc, CRP_NO_LEVEL for an edge.
+ *      best: length of the best path, updated.
+ *      meet: node of the best path, updated.
+ */
+static inline void relaxQuery(crpWorkspace_t *ws, uint8_t d, uint32_t u, uint32_t x,
+                              double cost, uint8_t step, double *best, uint32_t *meet){
+    if(ws->stamp[d][x] != ws->query){
+        ws->stamp[d][x] = ws->query;
+        ws->closed[d][x] = 0;
+        ws->dist[d][x] = cost;
+        ws->parent[d][x] = u;
+        ws->step[d][x] = step;
+        heapPush(&ws->heap[d],x,cost);
+    }else if(!ws->closed[d][x] && cost < ws->dist[d][x]){
+        ws->dist[d][x] = cost;
+        ws->parent[d][x] = u;
+        ws->step[d][x] = step;
+        heapDecreaseKey(&ws->heap[d],x,cost);
+    }else
+        return;
+    if(ws->stamp[1-d][x] == ws->query && cost+ws->dist[1-d][x] < *best){
+        *best = cost+ws->dist[1-d][x];
+        *meet = x;
+    }
+}
+
+/*  RELAXUNPACK
+ *
+ *  Relaxes an arc of a search unpacking a clique arc.
+ *
+ *  Input:
+ *      ws: query memory.
+ *      x: head of the arc.
+ *      u: tail of the arc.
+ *      cost: distance of x through the arc.
+ *      step: level of the clique of the arc, CRP_NO_LEVEL for an edge.
+ */
+static inline void relaxUnpack(crpWorkspace_t *ws, uint32_t x, uint32_t u,
+                               double cost, uint8_t step){
+    if(ws->unpackStamp[x] != ws->unpackQuery){
+        ws->unpackStamp[x] = ws->unpackQuery;
+        heapPush(&ws->unpackHeap,x,cost);
+    }else if(cost < ws->unpackDist[x])
+        //Settled nodes never get shorter
+        heapDecreaseKey(&ws->unpackHeap,x,cost);
+    else
+        return;
+    ws->unpackDist[x] = cost;
+    ws->unpackParent[x] = u;
+    ws->unpackStep[x] = step;
+}
+
+/*  APPENDSTEP
+ *
+ *  Appends to the path a step of the search from its last node: an
+ *  edge, or a clique arc. A clique arc of level l is replaced by the
+ *  shortest path inside its cell found on the level below: cliques of
+ *  level l-1 and edges between their cells, or edges for level 0. The
+ *  cliques found are unpacked in turn, first to last.
+ *
+ *  Input:
+ *      crp: customized partition.
+ *      ws: query memory with the path so far.
+ *      b: end of the step, starting at the last node of the path.
+ *      step: level of the clique, CRP_NO_LEVEL for an edge.
+ *      distB: distance of b from the start.
+ */
+static void appendStep(const crp_t *crp, crpWorkspace_t *ws, uint32_t b,
+                       uint8_t step, double distB){
+    const graph_t *graph = crp->graph;
+    const crpLevel_t *below;
+    const double *subMatrix;
+    crpStep_t *next;
+    uint32_t shift, belowShift, cell, sub, subFirst, subK, a, i, j, u, x, from, to, top = 0;
+    double base, cost;
+
+    ws->stack[top++] = (crpStep_t) {distB, b, step};
+    while(top > 0){
+        next = &ws->stack[--top];
+        if(next->level == CRP_NO_LEVEL){
+            ws->path[ws->pathLen] = next->node;
+            ws->pathDist[ws->pathLen++] = next->dist;
+            continue;
+        }
+
+        //Search from the last node on the level below, inside the cell
+        a = ws->path[ws->pathLen-1];
+        b = next->node;
+        step = next->level;
+        distB = next->dist;
+        base = ws->pathDist[ws->pathLen-1];
+        shift = step*crp->fanBits;
+        cell = crp->code[a]>>shift;
+        below = step > 0 ? &crp->levels[step-1] : NULL;
+        belowShift = step > 0 ? (step-1)*crp->fanBits : 0;
+        from = step > 0 ? below->index[a] : a;
+        to = step > 0 ? below->index[b] : b;
+        if(++ws->unpackQuery == 0){
+            memset(ws->unpackStamp,0,sizeof(uint32_t)*ws->nKept);
+            ws->unpackQuery = 1;
+        }
+        ws->unpackHeap.size = 0;
+        relaxUnpack(ws,from,from,0.,CRP_NO_LEVEL);
+        while(ws->unpackHeap.size > 0){
+            i = heapPop(&ws->unpackHeap);
+            if(i == to)
+                break;
+            u = step > 0 ? below->nodes[i] : i;
+            if(step > 0 && ws->unpackStep[i] != step-1){
+                sub = crp->code[u]>>belowShift;
+                subFirst = below->cellOffsets[sub];
+                subK = below->cellOffsets[sub+1]-subFirst;
+                subMatrix = below->matrix+below->matrixOffsets[sub]+(uint64_t)(i-subFirst)*subK;
+                for(j=0; j<subK; j++)
+                    if(subMatrix[j] != DBL_MAX)
+                        relaxUnpack(ws,subFirst+j,i,ws->unpackDist[i]+subMatrix[j],step-1);
+            }
+            for(j=graph->offsets[u]; j<graph->offsets[u+1]; j++){
+                x = graph->successors[j];
+                if((crp->code[x]>>shift) != cell ||
+                   (step > 0 && ((crp->code[u]^crp->code[x])>>belowShift) == 0))
+                    continue;
+                cost = edgeCost(crp->overlay,0,j,graph->weights[j]);
+                if(cost != DBL_MAX)
+                    relaxUnpack(ws,step > 0 ? below->index[x] : x,i,
+                                ws->unpackDist[i]+cost,CRP_NO_LEVEL);
+            }
+        }
+
+        //Its steps, pushed backwards so the first one is on top
+        ws->stack[top++] = (crpStep_t) {distB, b, ws->unpackStep[to]};
+        for(i=ws->unpackParent[to]; i!=from; i=ws->unpackParent[i])
+            ws->stack[top++] = (crpStep_t) {base+ws->unpackDist[i],
+                                            step > 0 ? below->nodes[i] : i,
+                                            ws->unpackStep[i]};
+    }
+}
+
+/*  CRPQUERY
+ *
+ *  Shortest distance between two nodes with a multilevel
+ *  bidirectional Dijkstra into ws->distance, and unpacked path into
+ *  ws->path and ws->pathDist. A node is searched on the highest level
+ *  whose cell holds neither the start nor the target: along the edges
+ *  of the graph in their lowest cells, and along the cliques of its
+ *  cell and the edges leaving it above. Cliques of the path are
+ *  unpacked by a search restricted to their cell. On a simplified
+ *  graph the searches start from the ends of the nodes (see
+ *  graph_ends), as in chQuery.
+ *
+ *  Input:
+ *      crp: customized partition.
+ *      ws: query memory.
+ *      startNode: position of starting node in the graph.
+ *      targetNode: position of target node in the graph.
+ *
+ *  Return: 0 if a path was found, 1 otherwise.
+ */
+uint8_t crpQuery(const crp_t *crp, crpWorkspace_t *ws, uint32_t startNode,
+                 uint32_t targetNode){
+    const graph_t *graph = crp->graph;
+    const overlay_t *overlay = crp->overlay;
+    const uint32_t *offsets[2] = {graph->offsets, graph->rOffsets};
+    const uint32_t *adjacent[2] = {graph->successors, graph->rSources};
+    const float *weights[2] = {graph->weights, graph->rWeights};
+    const crpLevel_t *level;
+    const double *row;
+    uint32_t i, u, x, next, first, k, r, shift, meet = UINT32_MAX, ends[2], *auxPath, auxCap;
+    double best, cost, offsetsEnd[2], *auxDist;
+    uint8_t d, e, n, l;
+
+    //New query: older stamps are invalid
+    if(++ws->query == 0){
+        for(d=0; d<2; d++)
+            memset(ws->stamp[d],0,sizeof(uint32_t)*ws->nKept);
+        ws->query = 1;
+    }
+    ws->pathLen = 0;
+    ws->nSpecial = 0;
+    //A path along a contracted chain bounds the searches
+    if(!graph_chain_distance(graph,startNode,targetNode,&best))
+        best = DBL_MAX;
+    if(overlay != NULL && graph->geoOffsets != NULL &&
+       best != DBL_MAX && !overlayChainDistance(overlay,startNode,targetNode,&best))
+        best = DBL_MAX;
+    for(d=0; d<2; d++){
+        ws->heap[d].size = 0;
+        ws->settled[d] = 0;
+        n = graph_ends(graph,d == 0 ? startNode : targetNode,d,ends,offsetsEnd);
+        if(overlay != NULL && graph->geoOffsets != NULL)
+            n = overlayEnds(overlay,d == 0 ? startNode : targetNode,d,ends,offsetsEnd,n);
+        for(e=0; e<n; e++){
+            u = ends[e];
+            ws->special[ws->nSpecial++] = crp->code[u];
+            if(ws->stamp[d][u] == ws->query){
+                //Both ends of a loop
+                if(offsetsEnd[e] < ws->dist[d][u]){
+                    ws->dist[d][u] = offsetsEnd[e];
+                    heapDecreaseKey(&ws->heap[d],u,offsetsEnd[e]);
+                }
+                continue;
+            }
+            ws->dist[d][u] = offsetsEnd[e];
+            ws->parent[d][u] = u;
+            ws->step[d][u] = CRP_NO_LEVEL;
+            ws->stamp[d][u] = ws->query;
+            ws->closed[d][u] = 0;
+            heapPush(&ws->heap[d],u,offsetsEnd[e]);
+        }
+    }
+    //Ends shared by the start and the target
+    for(e=0; e<ws->heap[1].size; e++){
+        u = ws->heap[1].elems[e].id;
+        if(ws->stamp[0][u] == ws->query && ws->dist[0][u]+ws->dist[1][u] < best){
+            best = ws->dist[0][u]+ws->dist[1][u];
+            meet = u;
+        }
+    }
+
+    /* Expand the direction with the smallest key until no path through
+       the unsettled nodes can beat the best one */
+    while(ws->heap[0].size > 0 && ws->heap[1].size > 0 &&
+          ws->heap[0].elems[0].f+ws->heap[1].elems[0].f < best){
+        d = ws->heap[0].elems[0].f <= ws->heap[1].elems[0].f ? 0 : 1;
+        u = heapPop(&ws->heap[d]);
+        ws->closed[d][u] = 1;
+        ws->settled[d]++;
+        l = queryLevel(crp,ws,u);
+        shift = l != CRP_NO_LEVEL ? l*crp->fanBits : 0;
+        //Clique of the cell of the node (row forward, column backward), unless reached along it
+        if(l != CRP_NO_LEVEL && ws->step[d][u] != l){
+            level = &crp->levels[l];
+            first = level->cellOffsets[crp->code[u]>>shift];
+            k = level->cellOffsets[(crp->code[u]>>shift)+1]-first;
+            r = level->index[u]-first;
+            row = level->matrix+level->matrixOffsets[crp->code[u]>>shift];
+            for(i=0; i<k; i++){
+                cost = d == 0 ? row[(uint64_t)r*k+i] : row[(uint64_t)i*k+r];
+                if(i != r && cost != DBL_MAX)
+                    relaxQuery(ws,d,u,level->nodes[first+i],ws->dist[d][u]+cost,l,&best,&meet);
+            }
+        }
+        //Graph edges, only those leaving the cell above the lowest level
+        for(i=offsets[d][u]; i<offsets[d][u+1]; i++){
+            x = adjacent[d][i];
+            if(l != CRP_NO_LEVEL && ((crp->code[u]^crp->code[x])>>shift) == 0)
+                continue;
+            cost = edgeCost(overlay,d,i,weights[d][i]);
+            if(cost != DBL_MAX)
+                relaxQuery(ws,d,u,x,ws->dist[d][u]+cost,CRP_NO_LEVEL,&best,&meet);
+        }
+    }
+    if(meet == UINT32_MAX && best == DBL_MAX)
+        return 1;
+    ws->distance = best;
+
+    /* Forward steps from start to meeting node, then backward ones to
+       target. The forward parents are reversed in place to walk them
+       from start */
+    if(meet != UINT32_MAX){
+        x = UINT32_MAX;
+        for(u=meet; ws->parent[0][u]!=u; u=next){
+            next = ws->parent[0][u];
+            ws->parent[0][u] = x;
+            x = u;
+        }
+        ws->parent[0][u] = x;
+        ws->path[0] = u;
+        ws->pathDist[0] = ws->dist[0][u];
+        ws->pathLen = 1;
+        for(; ws->parent[0][u] != UINT32_MAX; u=x){
+            x = ws->parent[0][u];
+            appendStep(crp,ws,x,ws->step[0][x],ws->dist[0][x]);
+        }
+        for(u=meet; ws->parent[1][u]!=u; u=x){
+            x = ws->parent[1][u];
+            appendStep(crp,ws,x,ws->step[1][u],best-ws->dist[1][x]);
+        }
+    }
+
+    /* Full path of a simplified graph, swapped into the path buffer */
+    if(graph->geoOffsets != NULL){
+        auxPath = ws->fullPath;
+        auxDist = ws->fullDist;
+        auxCap = ws->fullCap;
+        ws->pathLen = graph_expand_path(graph,startNode,targetNode,best,
+                                        ws->path,ws->pathDist,ws->pathLen,
+                                        &auxPath,&auxDist,&auxCap);
+        ws->fullPath = ws->path;
+        ws->fullDist = ws->pathDist;
+        ws->fullCap = ws->pathCap;
+        ws->path = auxPath;
+        ws->pathDist = auxDist;
+        ws->pathCap = auxCap;
+    }
+    return 0;
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include "aStar.h"
+#include "graph.h"
+#include "overlay.h"
+#include <inttypes.h>
+#include <stddef.h>
+
+#define CRP_MAGIC 0x47505243        //"CRPG" in little endian
+#define CRP_VERSION 1
+#define CRP_MAX_LEVELS 8
+#define CRP_CELL_SIZE 128           //Default largest cell of the lowest level
+#define CRP_FAN_BITS 3              //Default log2 of the cells of a level inside a cell above
+#define CRP_NO_LEVEL 0xff           //Level of the steps along graph edges
+
+/*Header of a partition file, followed by the cell codes at an aligned
+ *offset */
+typedef struct crpHeader_s{
+    uint32_t magic;         //CRP_MAGIC
+    uint32_t version;       //CRP_VERSION
+    uint32_t nNodes;        //Nodes of the graph
+    uint32_t nEdges;        //Edges of the graph
+    uint32_t nKept;         //Nodes with a code (nodes with edges)
+    uint32_t depth;         //Bits of each code
+    uint32_t fanBits;       //Bits of the code added by each level
+    uint32_t nLevels;       //Number of levels
+    uint64_t codeOffset;    //Position of the codes
+} crpHeader_t;
+
+/*Boundary nodes and clique matrices of a level. A node is a boundary
+ *node of its cell if it has an edge from or to another cell of the
+ *level. The boundary nodes of cell c are nodes[cellOffsets[c]] ...
+ *nodes[cellOffsets[c+1]-1]; with k of them, the cost of the shortest
+ *path inside the cell from the i-th to the j-th one is
+ *matrix[matrixOffsets[c]+i*k+j].
+ */
+typedef struct crpLevel_s{
+    uint32_t nCells;            //Cells of the level
+    uint32_t nBoundary;         //Boundary nodes of the level
+    uint32_t *cellOffsets;      //Start of the boundary nodes of each cell (nCells+1)
+    uint32_t *nodes;            //Graph position of each boundary node
+    uint32_t *index;            //Boundary index of each node, UINT32_MAX if none (nKept)
+    uint64_t *matrixOffsets;    //Start of the matrix of each cell (nCells+1)
+    double *matrix;             //Clique matrices, DBL_MAX between unconnected nodes
+} crpLevel_t;
+
+/*Customizable route planning data of a graph. The partition is a
+ *recursive bisection of the nodes with edges into 2^depth cells of
+ *nearly equal size; code[v] is the cell of node v, and the cell of v
+ *at level l is code[v] >> (l*fanBits), so each cell of a level holds
+ *2^fanBits cells of the level below. The partition depends only on
+ *the graph; the clique matrices depend on the edge costs (the metric)
+ *and are rebuilt by customizeCRP.
+ */
+typedef struct crp_s{
+    const graph_t *graph;       //Graph of the partition
+    uint32_t nKept;             //Nodes with a code
+    uint32_t depth;             //Bits of each code
+    uint32_t fanBits;           //Bits of the code added by each level
+    uint32_t nLevels;           //Number of levels
+    const uint32_t *code;       //Cell of each node at the lowest level
+    crpLevel_t levels[CRP_MAX_LEVELS];
+    const overlay_t *overlay;   //Edge cost changes of the customized metric (NULL if none)
+    void *map;                  //Mapping of the file (NULL if owned)
+    size_t mapSize;             //Size of the mapping
+} crp_t;
+
+/*Step of a path left to unpack: the node it ends at, its distance
+ *from the start, and the level of its clique */
+typedef struct crpStep_s{
+    double dist;
+    uint32_t node;
+    uint8_t level;          //CRP_NO_LEVEL for an edge
+} crpStep_t;
+
+/*Memory of a multilevel query, reusable between queries */
+typedef struct crpWorkspace_s{
+    uint32_t nKept;         //Nodes with edges
+    heap_t heap[2];         //Forward and backward queues
+    double *dist[2];        //Forward and backward distances
+    uint32_t *parent[2];    //Previous node in each search tree
+    uint8_t *step[2];       //Level of the clique of the step from the parent, CRP_NO_LEVEL for an edge
+    uint32_t *stamp[2];     //Query in which dist and parent were set
+    uint8_t *closed[2];     //Node settled in each search
+    uint32_t query;         //Current query
+    uint32_t special[4];    //Codes of the ends of the start and target nodes
+    uint8_t nSpecial;
+    uint64_t settled[2];    //Nodes settled by each search
+    double distance;        //Length of the path found
+    heap_t unpackHeap;      //Memory of the searches unpacking cliques
+    double *unpackDist;
+    uint32_t *unpackParent, *unpackStamp, unpackQuery;
+    uint8_t *unpackStep;    //Level of the clique of the step from the parent
+    crpStep_t *stack;       //Steps left to unpack, the next one on top
+    uint32_t *path;         //Path, start to target
+    double *pathDist;       //Distance from start of each path node
+    uint32_t pathLen;       //Nodes in path
+    uint32_t pathCap;       //Room in path buffers
+    uint32_t *fullPath;     //Spare path buffers to expand paths of
+    double *fullDist;       //simplified graphs
+    uint32_t fullCap;       //Room in spare buffers
+} crpWorkspace_t;
+
+/*  BUILDCRP
+ *
+ *  Partitions the nodes with edges of a graph by recursive bisection:
+ *  each set is split at the median of its longest side, measured on
+ *  the sphere, until cells hold at most cellSize nodes. Nearby nodes
+ *  share cells, so few edges cross between them on road networks.
+ *  Levels are added while the level above has at least 2 cells.
+ *
+ *  Input:
+ *      graph: graph to partition.
+ *      cellSize: largest cell of the lowest level.
+ *      fanBits: log2 of the cells of a level inside a cell above.
+ *      crp: output partition, owned by the structure, not customized.
+ */
+void buildCRP(const graph_t *graph, uint32_t cellSize, uint32_t fanBits, crp_t *crp);
+
+/*  WRITECRP
+ *
+ *  Writes the partition into a file. The clique matrices are not
+ *  written: they are rebuilt for each metric by customizeCRP.
+ *
+ *  Input:
+ *      crp: partition to write.
+ *      filename: name of the output file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int writeCRP(const crp_t *crp, const char *filename);
+
+/*  OPENCRP
+ *
+ *  Maps read-only a partition file, checking that it belongs to the
+ *  graph, and finds the boundary nodes of every level. The partition
+ *  must be customized before queries.
+ *
+ *  Input:
+ *      crp: partition to fill.
+ *      graph: graph the partition must belong to.
+ *      filename: name of the input file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int openCRP(crp_t *crp, const graph_t *graph, const char *filename);
+
+/*  CLOSECRP
+ *
+ *  Unmaps or frees the partition and its clique matrices.
+ *
+ *  Input:
+ *      crp: partition to close.
+ */
+void closeCRP(crp_t *crp);
+
+/*  CUSTOMIZECRP
+ *
+ *  Computes the clique matrices of every cell for a metric: the stored
+ *  edge weights changed by an overlay, if any. Level 0 cells run a
+ *  Dijkstra from each boundary node restricted to the cell; cells of
+ *  higher levels run it on the boundary nodes of the level below,
+ *  using its matrices and the edges between its cells. The cells of a
+ *  level are shared by a pool of threads. Queries must not run
+ *  meanwhile.
+ *
+ *  Input:
+ *      crp: partition to customize.
+ *      overlay: edge cost changes, NULL for the stored weights. It
+ *               must live as long as the customization is used.
+ *      threads: number of threads.
+ */
+void customizeCRP(crp_t *crp, const overlay_t *overlay, uint32_t threads);
+
+/*  CRPWORKSPACECREATE / CRPWORKSPACEFREE
+ *
+ *  Allocates and frees the memory of multilevel queries.
+ *
+ *  Input:
+ *      ws: workspace.
+ *      crp: partition of the queries.
+ */
+void crpWorkspaceCreate(crpWorkspace_t *ws, const crp_t *crp);
+void crpWorkspaceFree(crpWorkspace_t *ws);
+
+/*  CRPQUERY
+ *
+ *  Shortest distance between two nodes with a multilevel
+ *  bidirectional Dijkstra into ws->distance, and unpacked path into
+ *  ws->path and ws->pathDist. A node is searched on the highest level
+ *  whose cell holds neither the start nor the target: along the edges
+ *  of the graph in their lowest cells, and along the cliques of its
+ *  cell and the edges leaving it above. Cliques of the path are
+ *  unpacked by a search restricted to their cell. On a simplified
+ *  graph the searches start from the ends of the nodes (see
+ *  graph_ends), as in chQuery.
+ *
+ *  Input:
+ *      crp: customized partition.
+ *      ws: query memory.
+ *      startNode: position of starting node in the graph.
+ *      targetNode: position of target node in the graph.
+ *
+ *  Return: 0 if a path was found, 1 otherwise.
+ */
+uint8_t crpQuery(const crp_t *crp, crpWorkspace_t *ws, uint32_t startNode,
+                 uint32_t targetNode);
@@ -0,0 +1,851 @@
+#include "graph.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*  write_padding
+
+    Writes zeros until the file position is a multiple of GRAPH_ALIGN.
+
+    Variables:
+        -binOut = output file.
+        -pos = current position, updated.
+
+    Return value:
+        0 if successfull, 1 otherwise.
+ */
+static int write_padding(FILE *binOut, uint64_t *pos){
+    static const char zeros[GRAPH_ALIGN] = {0};
+    uint64_t pad = (GRAPH_ALIGN-(*pos%GRAPH_ALIGN))%GRAPH_ALIGN;
+
+    *pos += pad;
+    return fwrite(zeros,1,pad,binOut) != pad;
+}
+
+
+/*  compare_key
+
+    Compares two (id << 32 | position) keys, for qsort.
+
+    Variables:
+        -a, b = pointers to the keys.
+
+    Return value:
+        -1, 0 or 1 if a is smaller, equal or bigger than b.
+ */
+static int compare_key(const void *a, const void *b){
+    uint64_t ka = *(const uint64_t *) a, kb = *(const uint64_t *) b;
+    return ka < kb ? -1 : (ka > kb ? 1 : 0);
+}
+
+
+/*  fill_index
+
+    Places the sorted keys into the Eytzinger order: an in-order walk
+    of the implicit tree rooted at k takes the keys in sorted order.
+
+    Variables:
+        -keys = sorted (id << 32 | position) keys.
+        -next = next key to place, updated.
+        -k = root of the subtree.
+        -n = number of keys.
+        -index, pos = output vectors.
+ */
+static void fill_index(const uint64_t *keys, uint32_t *next, uint64_t k, uint32_t n,
+                       uint32_t *index, uint32_t *pos){
+    if(k > n)
+        return;
+    fill_index(keys,next,2*k,n,index,pos);
+    index[k] = keys[*next] >> 32;
+    pos[k] = (uint32_t) keys[*next];
+    (*next)++;
+    fill_index(keys,next,2*k+1,n,index,pos);
+}
+
+
+/*  id_index_build
+
+    Builds the id index of a set of nodes. The ids need not be sorted.
+
+    Variables:
+        -ids = id of each node.
+        -n = number of nodes.
+        -index = output vector of n+1 ids in Eytzinger order.
+        -pos = output vector of n+1 node positions.
+ */
+void id_index_build(const uint32_t *ids, uint32_t n, uint32_t *index, uint32_t *pos){
+    uint64_t *keys;
+    uint32_t i, next = 0;
+    uint8_t sorted = 1;
+
+    keys = malloc(sizeof(uint64_t)*((uint64_t)n+1)); assert(keys);
+    for(i=0; i<n; i++){
+        keys[i] = (uint64_t) ids[i] << 32 | i;
+        if(i > 0 && keys[i] < keys[i-1])
+            sorted = 0;
+    }
+    if(!sorted)
+        qsort(keys,n,sizeof(uint64_t),compare_key);
+    index[0] = pos[0] = UINT32_MAX;
+    fill_index(keys,&next,1,n,index,pos);
+    free(keys);
+}
+
+
+/*  graph_index
+
+    Builds the id index (idIndex, idPos) of a graph, owned by it.
+
+    Variables:
+        -graph = graph to complete.
+ */
+void graph_index(graph_t *graph){
+    uint32_t *index, *pos;
+
+    index = malloc(sizeof(uint32_t)*((uint64_t)graph->nNodes+1)); assert(index);
+    pos = malloc(sizeof(uint32_t)*((uint64_t)graph->nNodes+1)); assert(pos);
+    id_index_build(graph->ids,graph->nNodes,index,pos);
+    graph->idIndex = index;
+    graph->idPos = pos;
+}
+
+
+/*  graph_tile
+
+    Builds the tile directory and the boundary edge tables of a graph,
+    owned by it. The nodes should be numbered along a Hilbert curve
+    (see reorder_graph) for the tiles to be compact regions.
+
+    Variables:
+        -graph = graph to complete.
+        -tileBits = log2 of the nodes of each tile.
+ */
+void graph_tile(graph_t *graph, uint32_t tileBits){
+    graphTile_t *tiles, *tile, *all;
+    uint32_t *boundary, *rBoundary, nTiles, nBoundary = 0, nRBoundary = 0, t, v, j, last;
+
+    nTiles = graph->nNodes > 0 ? ((graph->nNodes-1) >> tileBits)+1 : 0;
+    for(v=0; v<graph->nNodes; v++){
+        for(j=graph->offsets[v]; j<graph->offsets[v+1]; j++)
+            nBoundary += ((graph->successors[j]^v) >> tileBits) != 0;
+        for(j=graph->rOffsets[v]; j<graph->rOffsets[v+1]; j++)
+            nRBoundary += ((graph->rSources[j]^v) >> tileBits) != 0;
+    }
+    tiles = malloc(sizeof(graphTile_t)*((uint64_t)nTiles+1)); assert(tiles);
+    boundary = malloc(sizeof(uint32_t)*nBoundary); assert(boundary != NULL || nBoundary == 0);
+    rBoundary = malloc(sizeof(uint32_t)*nRBoundary); assert(rBoundary != NULL || nRBoundary == 0);
+
+    all = &tiles[nTiles];
+    all->minLat = all->minLon = INT32_MAX;
+    all->maxLat = all->maxLon = INT32_MIN;
+    nBoundary = nRBoundary = 0;
+    for(t=0; t<=nTiles; t++){
+        tile = &tiles[t];
+        tile->firstNode = t < nTiles ? t << tileBits : graph->nNodes;
+        tile->firstEdge = graph->offsets[tile->firstNode];
+        tile->firstREdge = graph->rOffsets[tile->firstNode];
+        tile->firstGeo = graph->geoOffsets != NULL ? graph->geoOffsets[tile->firstEdge] : 0;
+        tile->firstBoundary = nBoundary;
+        tile->firstRBoundary = nRBoundary;
+        if(t == nTiles)
+            break;
+        tile->minLat = tile->minLon = INT32_MAX;
+        tile->maxLat = tile->maxLon = INT32_MIN;
+        last = t+1 < nTiles ? (t+1) << tileBits : graph->nNodes;
+        for(v=tile->firstNode; v<last; v++){
+            if(graph->lat[v] < tile->minLat) tile->minLat = graph->lat[v];
+            if(graph->lat[v] > tile->maxLat) tile->maxLat = graph->lat[v];
+            if(graph->lon[v] < tile->minLon) tile->minLon = graph->lon[v];
+            if(graph->lon[v] > tile->maxLon) tile->maxLon = graph->lon[v];
+            for(j=graph->offsets[v]; j<graph->offsets[v+1]; j++)
+                if((graph->successors[j]^v) >> tileBits)
+                    boundary[nBoundary++] = j;
+            for(j=graph->rOffsets[v]; j<graph->rOffsets[v+1]; j++)
+                if((graph->rSources[j]^v) >> tileBits)
+                    rBoundary[nRBoundary++] = j;
+        }
+        if(tile->minLat < all->minLat) all->minLat = tile->minLat;
+        if(tile->maxLat > all->maxLat) all->maxLat = tile->maxLat;
+        if(tile->minLon < all->minLon) all->minLon = tile->minLon;
+        if(tile->maxLon > all->maxLon) all->maxLon = tile->maxLon;
+    }
+    graph->nTiles = nTiles;
+    graph->tileBits = tileBits;
+    graph->tiles = tiles;
+    graph->tileBoundary = boundary;
+    graph->tileRBoundary = rBoundary;
+}
+
+
+/*  graph_geo_edge
+
+    Edge of a simplified graph whose chain holds an entry of geoNodes.
+
+    Variables:
+        -graph = simplified graph.
+        -k = entry of geoNodes.
+
+    Return value:
+        Position of the edge.
+ */
+uint32_t graph_geo_edge(const graph_t *graph, uint32_t k){
+    uint32_t low = 0, high = graph->nEdges, mid;
+
+    //First edge whose chain ends after k
+    while(low < high){
+        mid = low+((high-low)>>1);
+        if(graph->geoOffsets[mid+1] <= k)
+            low = mid+1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+
+/*  graph_edge_source
+
+    Source node of an edge.
+
+    Variables:
+        -graph = graph of the edge.
+        -j = position of the edge.
+
+    Return value:
+        Position of the source node.
+ */
+uint32_t graph_edge_source(const graph_t *graph, uint32_t j){
+    uint32_t low = 0, high = graph->nNodes, mid;
+
+    //First node whose successors end after j
+    while(low < high){
+        mid = low+((high-low)>>1);
+        if(graph->offsets[mid+1] <= j)
+            low = mid+1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+
+/*  reverse_chain
+
+    Edge of a two-way chain going the opposite way.
+
+    Variables:
+        -graph = simplified graph.
+        -j = position of the edge.
+
+    Return value:
+        Position of the reverse edge, UINT32_MAX if the chain is one-way.
+ */
+static uint32_t reverse_chain(const graph_t *graph, uint32_t j){
+    uint32_t r, u = graph_edge_source(graph,j), w = graph->successors[j];
+    uint32_t len = graph->geoOffsets[j+1]-graph->geoOffsets[j];
+
+    if(len == 0)
+        return UINT32_MAX;
+    for(r=graph->offsets[w]; r<graph->offsets[w+1]; r++)
+        if(graph->successors[r] == u &&
+           graph->geoOffsets[r+1]-graph->geoOffsets[r] == len &&
+           graph->geoNodes[graph->geoOffsets[r]] == graph->geoNodes[graph->geoOffsets[j+1]-1])
+            return r;
+    return UINT32_MAX;
+}
+
+
+/*  graph_chain_edges
+
+    Edges whose chain holds a contracted node: the edge of its chain
+    and, for two-way chains, the reverse one.
+
+    Variables:
+        -graph = simplified graph.
+        -node = position of the contracted node.
+        -edges = output positions of the edges.
+        -geo = output entry of the node in geoNodes for each edge.
+
+    Return value:
+        Number of edges.
+ */
+uint8_t graph_chain_edges(const graph_t *graph, uint32_t node,
+                          uint32_t edges[2], uint32_t geo[2]){
+    geo[0] = graph->chainGeo[node-graph->nKept];
+    edges[0] = graph_geo_edge(graph,geo[0]);
+    edges[1] = reverse_chain(graph,edges[0]);
+    if(edges[1] == UINT32_MAX)
+        return 1;
+    geo[1] = graph->geoOffsets[edges[1]]+graph->geoOffsets[edges[0]+1]-1-geo[0];
+    return 2;
+}
+
+
+/*  graph_ends
+
+    Nodes of the search graph where a path starting or ending at a node
+    leaves or reaches the edges. A node with edges is its own end. A
+    node inside a contracted chain has the ends of its chain edge: the
+    target of the edge when the path starts at it, the source when the
+    path ends at it, and the opposite end for two-way chains.
+
+    Variables:
+        -graph = graph of the node.
+        -node = position of the node.
+        -asTarget = 1 if the path ends at the node, 0 if it starts.
+        -ends = output positions of up to 2 nodes with edges.
+        -offsets = output distance between the node and each end.
+
+    Return value:
+        Number of ends.
+ */
+uint8_t graph_ends(const graph_t *graph, uint32_t node, uint8_t asTarget,
+                   uint32_t ends[2], double offsets[2]){
+    uint32_t edges[2], geo[2];
+    uint8_t i, n;
+
+    if(node < graph->nKept){
+        ends[0] = node;
+        offsets[0] = 0.;
+        return 1;
+    }
+    n = graph_chain_edges(graph,node,edges,geo);
+    for(i=0; i<n; i++)
+        if(asTarget){
+            ends[i] = graph_edge_source(graph,edges[i]);
+            offsets[i] = graph->geoDist[geo[i]];
+        }else{
+            ends[i] = graph->successors[edges[i]];
+            offsets[i] = graph->weights[edges[i]]-graph->geoDist[geo[i]];
+        }
+    return n;
+}
+
+
+/*  graph_chain_span
+
+    Finds an edge whose chain holds two contracted nodes in order.
+
+    Variables:
+        -graph = simplified graph.
+        -start, target = positions of the nodes.
+        -ks, kt = entries of the nodes in geoNodes, if found.
+
+    Return value:
+        1 if found, 0 otherwise.
+ */
+int graph_chain_span(const graph_t *graph, uint32_t start, uint32_t target,
+                     uint32_t *ks, uint32_t *kt){
+    uint32_t edgesS[2], edgesT[2], geoS[2], geoT[2];
+    uint8_t i, l, nS, nT;
+
+    if(graph->geoOffsets == NULL || start < graph->nKept || target < graph->nKept)
+        return 0;
+    nS = graph_chain_edges(graph,start,edgesS,geoS);
+    nT = graph_chain_edges(graph,target,edgesT,geoT);
+    for(i=0; i<nS; i++)
+        for(l=0; l<nT; l++)
+            if(edgesS[i] == edgesT[l] && geoS[i] <= geoT[l]){
+                *ks = geoS[i];
+                *kt = geoT[l];
+                return 1;
+            }
+    return 0;
+}
+
+
+/*  graph_chain_distance
+
+    Checks if a path can go directly along a contracted chain: both
+    nodes lie inside the chain of the same edge, in this order. Paths
+    leaving the chain can still be shorter.
+
+    Variables:
+        -graph = graph of the nodes.
+        -start, target = positions of the nodes.
+        -distance = length of the path along the chain, if found.
+
+    Return value:
+        1 if the nodes lie in order in the same chain, 0 otherwise.
+ */
+int graph_chain_distance(const graph_t *graph, uint32_t start, uint32_t target,
+                         double *distance){
+    uint32_t ks, kt;
+
+    if(!graph_chain_span(graph,start,target,&ks,&kt))
+        return 0;
+    *distance = graph->geoDist[kt]-graph->geoDist[ks];
+    return 1;
+}
+
+
+/*  append_node
+
+    Appends a node to a growable path.
+
+    Variables:
+        -nodes, dist = path vectors, grown if needed.
+        -cap = room in the vectors, updated.
+        -len = nodes in the path, updated.
+        -node, distance = node to append and its distance.
+ */
+static void append_node(uint32_t **nodes, double **dist, uint32_t *cap,
+                        uint32_t *len, uint32_t node, double distance){
+    if(*len == *cap){
+        *cap = 2*(*cap)+64;
+        *nodes = realloc(*nodes,sizeof(uint32_t)*(*cap)); assert(*nodes);
+        *dist = realloc(*dist,sizeof(double)*(*cap)); assert(*dist);
+    }
+    (*nodes)[*len] = node;
+    (*dist)[(*len)++] = distance;
+}
+
+
+/*  graph_expand_path
+
+    Expands a path found on the search graph of a simplified graph
+    into the full path, inserting the nodes of the contracted chains
+    of its edges, and the parts of the chains from the start node to
+    the first node of the path and from its last node to the target
+    node when these are ends (see graph_ends). With no path, the
+    direct path along a chain is given (see graph_chain_distance).
+
+    Variables:
+        -graph = simplified graph.
+        -start, target = nodes asked for.
+        -distance = length of the path.
+        -path, pathDist = nodes of the search path and their distance
+                          from the start node.
+        -pathLen = number of nodes of the search path, 0 if the path
+                   goes directly along a chain.
+        -nodes, dist = output vectors, grown if needed.
+        -cap = room in the output vectors, updated.
+
+    Return value:
+        Number of nodes of the full path.
+ */
+uint32_t graph_expand_path(const graph_t *graph, uint32_t start, uint32_t target,
+                           double distance,
+                           const uint32_t *path, const double *pathDist,
+                           uint32_t pathLen, uint32_t **nodes, double **dist,
+                           uint32_t *cap){
+    uint32_t len = 0, i, j, k, best, edges[2], geo[2];
+    uint8_t e, n;
+    double diff;
+
+    /* Directly along a chain */
+    if(pathLen == 0){
+        if(graph_chain_span(graph,start,target,&geo[0],&geo[1]))
+            for(k=geo[0]; k<=geo[1]; k++)
+                append_node(nodes,dist,cap,&len,graph->geoNodes[k],
+                            graph->geoDist[k]-graph->geoDist[geo[0]]);
+        return len;
+    }
+
+    /* From a contracted start to the first node, along the chain
+       edge leading there with the right length */
+    if(start >= graph->nKept){
+        n = graph_chain_edges(graph,start,edges,geo);
+        for(e=0, i=1; i<n; i++)
+            if(graph->successors[edges[i]] == path[0] &&
+               (graph->successors[edges[e]] != path[0] ||
+                fabs(graph->weights[edges[i]]-graph->geoDist[geo[i]]-pathDist[0]) <
+                fabs(graph->weights[edges[e]]-graph->geoDist[geo[e]]-pathDist[0])))
+                e = i;
+        for(k=geo[e]; k<graph->geoOffsets[edges[e]+1]; k++)
+            append_node(nodes,dist,cap,&len,graph->geoNodes[k],
+                        graph->geoDist[k]-graph->geoDist[geo[e]]);
+    }
+
+    /* Search path, with the chain of each edge */
+    for(i=0; i<pathLen; i++){
+        if(i > 0){
+            //Edge between both nodes with the length of the step
+            best = UINT32_MAX;
+            diff = pathDist[i]-pathDist[i-1];
+            for(j=graph->offsets[path[i-1]]; j<graph->offsets[path[i-1]+1]; j++)
+                if(graph->successors[j] == path[i] &&
+                   (best == UINT32_MAX || fabs(graph->weights[j]-diff) < fabs(graph->weights[best]-diff)))
+                    best = j;
+            if(best != UINT32_MAX)
+                for(k=graph->geoOffsets[best]; k<graph->geoOffsets[best+1]; k++)
+                    append_node(nodes,dist,cap,&len,graph->geoNodes[k],
+                                pathDist[i-1]+graph->geoDist[k]);
+        }
+        append_node(nodes,dist,cap,&len,path[i],pathDist[i]);
+    }
+
+    /* From the last node to a contracted target */
+    if(target >= graph->nKept){
+        n = graph_chain_edges(graph,target,edges,geo);
+        diff = distance-pathDist[pathLen-1];
+        for(e=0, i=1; i<n; i++)
+            if(graph_edge_source(graph,edges[i]) == path[pathLen-1] &&
+               (graph_edge_source(graph,edges[e]) != path[pathLen-1] ||
+                fabs(graph->geoDist[geo[i]]-diff) < fabs(graph->geoDist[geo[e]]-diff)))
+                e = i;
+        for(k=graph->geoOffsets[edges[e]]; k<=geo[e]; k++)
+            append_node(nodes,dist,cap,&len,graph->geoNodes[k],
+                        pathDist[pathLen-1]+graph->geoDist[k]);
+    }
+    return len;
+}
+
+
+/*  graph_reverse
+
+    Builds the reverse adjacency (rOffsets, rSources, rWeights) of a
+    graph built in memory.
+
+    Variables:
+        -graph = graph to complete.
+ */
+void graph_reverse(graph_t *graph){
+    uint32_t i, j, *offsets, *sources, *fill;
+    float *weights;
+
+    offsets = calloc(graph->nNodes+1,sizeof(uint32_t)); assert(offsets);
+    sources = malloc(sizeof(uint32_t)*graph->nEdges); assert(sources != NULL || graph->nEdges == 0);
+    weights = malloc(sizeof(float)*graph->nEdges); assert(weights != NULL || graph->nEdges == 0);
+    fill = malloc(sizeof(uint32_t)*graph->nNodes); assert(fill != NULL || graph->nNodes == 0);
+
+    //Count incoming edges of each node
+    for(j=0; j<graph->nEdges; j++)
+        offsets[graph->successors[j]+1]++;
+    for(i=0; i<graph->nNodes; i++){
+        offsets[i+1] += offsets[i];
+        fill[i] = offsets[i];
+    }
+    //Place each edge in the list of its target
+    for(i=0; i<graph->nNodes; i++)
+        for(j=graph->offsets[i]; j<graph->offsets[i+1]; j++){
+            sources[fill[graph->successors[j]]] = i;
+            weights[fill[graph->successors[j]]++] = graph->weights[j];
+        }
+    free(fill);
+
+    graph->rOffsets = offsets;
+    graph->rSources = sources;
+    graph->rWeights = weights;
+}
+
+
+/*  graph_write
+
+    Writes the graph into a binary file: a graphHeader_t whose section
+    table gives the position of each array, followed by the arrays
+    themselves aligned to GRAPH_ALIGN bytes. The file has no pointers,
+    so it can be mapped and used directly.
+
+    Variables:
+        -graph = graph to write.
+        -filename = name of the output file.
+
+    Return value:
+        0 if successfull, 1 otherwise.
+ */
+int graph_write(const graph_t *graph, const char *filename){
+    FILE *binOut;
+    graphHeader_t header;
+    const void *data[GRAPH_MAX_SECTIONS];
+    uint64_t pos, size;
+    uint32_t i, n = graph->nNodes;
+
+    /* Section table */
+    memset(&header,0,sizeof(graphHeader_t));
+    header.magic = GRAPH_MAGIC;
+    header.version = GRAPH_VERSION;
+    header.nNodes = n;
+    header.nEdges = graph->nEdges;
+    header.tileBits = graph->tileBits;
+#define ADD_SECTION(TYPE,PTR,SIZE,COUNT) \
+    if((PTR) != NULL){ \
+        header.sections[header.nSections].type = (TYPE); \
+        header.sections[header.nSections].elemSize = (SIZE); \
+        header.sections[header.nSections].count = (COUNT); \
+        data[header.nSections++] = (PTR); \
+    }
+    ADD_SECTION(GRAPH_OFFSETS,graph->offsets,sizeof(uint32_t),(uint64_t)n+1);
+    ADD_SECTION(GRAPH_SUCCESSORS,graph->successors,sizeof(uint32_t),graph->nEdges);
+    ADD_SECTION(GRAPH_WEIGHTS,graph->weights,sizeof(float),graph->nEdges);
+    ADD_SECTION(GRAPH_REV_OFFSETS,graph->rOffsets,sizeof(uint32_t),(uint64_t)n+1);
+    ADD_SECTION(GRAPH_REV_SOURCES,graph->rSources,sizeof(uint32_t),graph->nEdges);
+    ADD_SECTION(GRAPH_REV_WEIGHTS,graph->rWeights,sizeof(float),graph->nEdges);
+    ADD_SECTION(GRAPH_IDS,graph->ids,sizeof(uint32_t),n);
+    ADD_SECTION(GRAPH_LAT,graph->lat,sizeof(int32_t),n);
+    ADD_SECTION(GRAPH_LON,graph->lon,sizeof(int32_t),n);
+    ADD_SECTION(GRAPH_UNITVEC,graph->unit,3*sizeof(double),n);
+    ADD_SECTION(GRAPH_NAME_OFFSETS,graph->nameOffsets,sizeof(uint32_t),n);
+    ADD_SECTION(GRAPH_NAMES,graph->names,sizeof(char),graph->nameLen);
+    ADD_SECTION(GRAPH_ID_INDEX,graph->idIndex,sizeof(uint32_t),(uint64_t)n+1);
+    ADD_SECTION(GRAPH_ID_POS,graph->idPos,sizeof(uint32_t),(uint64_t)n+1);
+    ADD_SECTION(GRAPH_GEO_OFFSETS,graph->geoOffsets,sizeof(uint32_t),(uint64_t)graph->nEdges+1);
+    ADD_SECTION(GRAPH_GEO_NODES,graph->geoNodes,sizeof(uint32_t),graph->nGeo);
+    ADD_SECTION(GRAPH_GEO_DIST,graph->geoDist,sizeof(float),graph->nGeo);
+    ADD_SECTION(GRAPH_CHAIN_GEO,graph->chainGeo,sizeof(uint32_t),n-graph->nKept);
+    ADD_SECTION(GRAPH_TILES,graph->tiles,sizeof(graphTile_t),(uint64_t)graph->nTiles+1);
+    ADD_SECTION(GRAPH_TILE_BOUNDARY,graph->tileBoundary,sizeof(uint32_t),
+                graph->tiles[graph->nTiles].firstBoundary);
+    ADD_SECTION(GRAPH_TILE_RBOUNDARY,graph->tileRBoundary,sizeof(uint32_t),
+                graph->tiles[graph->nTiles].firstRBoundary);
+#undef ADD_SECTION
+
+    //Aligned position of each section
+    pos = sizeof(graphHeader_t);
+    for(i=0; i<header.nSections; i++){
+        pos += (GRAPH_ALIGN-(pos%GRAPH_ALIGN))%GRAPH_ALIGN;
+        header.sections[i].offset = pos;
+        pos += header.sections[i].elemSize*header.sections[i].count;
+    }
+
+    binOut = fopen(filename,"wb");
+    if(binOut == NULL){
+        fprintf(stderr,"Could not create output binary file.\n");
+        return 1;
+    }
+    pos = sizeof(graphHeader_t);
+    if(fwrite(&header,sizeof(graphHeader_t),1,binOut) != 1){
+        fprintf(stderr,"Could not write graph header into binary file.\n");
+        fclose(binOut);
+        return 1;
+    }
+    for(i=0; i<header.nSections; i++){
+        size = header.sections[i].elemSize*header.sections[i].count;
+        if(write_padding(binOut,&pos) || fwrite(data[i],1,size,binOut) != size){
+            fprintf(stderr,"Could not write graph section %"PRIu32" into binary file.\n",
+                    header.sections[i].type);
+            fclose(binOut);
+            return 1;
+        }
+        pos += size;
+    }
+    if(fclose(binOut) != 0){
+        fprintf(stderr,"Could not close output binary file.\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+/*  find_section
+
+    Looks for a section in the table of a mapped graph file and checks
+    that it lies inside the file with the expected size.
+
+    Variables:
+        -graph = graph with the mapping.
+        -type = section type to find.
+        -elemSize = expected size of each element.
+        -count = expected number of elements.
+
+    Return value:
+        Pointer to the section data, NULL if missing or malformed.
+ */
+static const void *find_section(const graph_t *graph, uint32_t type,
+                                uint32_t elemSize, uint64_t count){
+    const graphHeader_t *header = graph->map;
+    const graphSection_t *s;
+    uint32_t i;
+
+    for(i=0; i<header->nSections && i<GRAPH_MAX_SECTIONS; i++){
+        s = &header->sections[i];
+        if(s->type != type)
+            continue;
+        if(s->elemSize != elemSize || s->count != count ||
+           s->offset%GRAPH_ALIGN != 0 ||
+           s->offset+s->count*s->elemSize > graph->mapSize)
+            return NULL;
+        return (const char *) graph->map+s->offset;
+    }
+    return NULL;
+}
+
+
+/*  section_count
+
+    Number of elements of a section of a mapped graph file.
+
+    Variables:
+        -graph = graph with the mapping.
+        -type = section type to find.
+
+    Return value:
+        Number of elements, 0 if the section is missing.
+ */
+static uint64_t section_count(const graph_t *graph, uint32_t type){
+    const graphHeader_t *header = graph->map;
+    uint32_t i;
+
+    for(i=0; i<header->nSections && i<GRAPH_MAX_SECTIONS; i++)
+        if(header->sections[i].type == type)
+            return header->sections[i].count;
+    return 0;
+}
+
+
+/*  graph_open
+
+    Maps read-only a graph written by graph_write, checking its magic
+    number, version and section table. No data is copied, except for
+    the id index, which is built if the file does not have it.
+
+    Variables:
+        -graph = graph to fill.
+        -filename = name of the input file.
+
+    Return value:
+        0 if successfull, 1 otherwise.
+ */
+int graph_open(graph_t *graph, const char *filename){
+    const graphHeader_t *header;
+    struct stat st;
+    uint32_t n;
+    int fd;
+
+    memset(graph,0,sizeof(graph_t));
+    fd = open(filename,O_RDONLY);
+    if(fd < 0 || fstat(fd,&st) != 0){
+        fprintf(stderr,"Could not open graph file %s.\n",filename);
+        if(fd >= 0)
+            close(fd);
+        return 1;
+    }
+    if((size_t) st.st_size < sizeof(graphHeader_t)){
+        fprintf(stderr,"Problems reading header.\n");
+        close(fd);
+        return 1;
+    }
+    graph->mapSize = st.st_size;
+    graph->map = mmap(NULL,graph->mapSize,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if(graph->map == MAP_FAILED){
+        fprintf(stderr,"Could not map graph file %s.\n",filename);
+        graph->map = NULL;
+        return 1;
+    }
+
+    header = graph->map;
+    if(header->magic != GRAPH_MAGIC || header->version != GRAPH_VERSION){
+        fprintf(stderr,"Graph file is not a version %d graph. Rebuild it with makeGraph.\n",
+                GRAPH_VERSION);
+        graph_close(graph);
+        return 1;
+    }
+    n = graph->nNodes = header->nNodes;
+    graph->nEdges = header->nEdges;
+    graph->nameLen = section_count(graph,GRAPH_NAMES);
+    graph->nGeo = section_count(graph,GRAPH_GEO_NODES);
+    graph->nKept = n-section_count(graph,GRAPH_CHAIN_GEO);
+
+    graph->offsets = find_section(graph,GRAPH_OFFSETS,sizeof(uint32_t),(uint64_t)n+1);
+    graph->successors = find_section(graph,GRAPH_SUCCESSORS,sizeof(uint32_t),graph->nEdges);
+    graph->weights = find_section(graph,GRAPH_WEIGHTS,sizeof(float),graph->nEdges);
+    graph->rOffsets = find_section(graph,GRAPH_REV_OFFSETS,sizeof(uint32_t),(uint64_t)n+1);
+    graph->rSources = find_section(graph,GRAPH_REV_SOURCES,sizeof(uint32_t),graph->nEdges);
+    graph->rWeights = find_section(graph,GRAPH_REV_WEIGHTS,sizeof(float),graph->nEdges);
+    graph->ids = find_section(graph,GRAPH_IDS,sizeof(uint32_t),n);
+    graph->lat = find_section(graph,GRAPH_LAT,sizeof(int32_t),n);
+    graph->lon = find_section(graph,GRAPH_LON,sizeof(int32_t),n);
+    graph->unit = find_section(graph,GRAPH_UNITVEC,3*sizeof(double),n);
+    graph->nameOffsets = find_section(graph,GRAPH_NAME_OFFSETS,sizeof(uint32_t),n);
+    graph->names = find_section(graph,GRAPH_NAMES,sizeof(char),graph->nameLen);
+    graph->idIndex = find_section(graph,GRAPH_ID_INDEX,sizeof(uint32_t),(uint64_t)n+1);
+    graph->idPos = find_section(graph,GRAPH_ID_POS,sizeof(uint32_t),(uint64_t)n+1);
+    if(graph->offsets == NULL || graph->successors == NULL ||
+       graph->weights == NULL || graph->rOffsets == NULL ||
+       graph->rSources == NULL || graph->rWeights == NULL || graph->ids == NULL ||
+       graph->lat == NULL || graph->lon == NULL || graph->unit == NULL ||
+       graph->nameOffsets == NULL ||
+       graph->names == NULL){
+        fprintf(stderr,"Graph file %s has missing or malformed sections.\n",filename);
+        graph_close(graph);
+        return 1;
+    }
+    //Chains of a simplified graph
+    graph->geoOffsets = find_section(graph,GRAPH_GEO_OFFSETS,sizeof(uint32_t),(uint64_t)graph->nEdges+1);
+    if(graph->geoOffsets != NULL){
+        graph->geoNodes = find_section(graph,GRAPH_GEO_NODES,sizeof(uint32_t),graph->nGeo);
+        graph->geoDist = find_section(graph,GRAPH_GEO_DIST,sizeof(float),graph->nGeo);
+        graph->chainGeo = find_section(graph,GRAPH_CHAIN_GEO,sizeof(uint32_t),n-graph->nKept);
+        if((graph->nGeo > 0 && (graph->geoNodes == NULL || graph->geoDist == NULL)) ||
+           (graph->nKept < n && graph->chainGeo == NULL)){
+            fprintf(stderr,"Graph file %s has malformed chain sections.\n",filename);
+            graph_close(graph);
+            return 1;
+        }
+    }else
+        graph->nKept = n;
+    //Tiles of a graph split by makeGraph -T
+    if(section_count(graph,GRAPH_TILES) > 0){
+        graph->nTiles = section_count(graph,GRAPH_TILES)-1;
+        graph->tileBits = header->tileBits;
+        graph->tiles = find_section(graph,GRAPH_TILES,sizeof(graphTile_t),(uint64_t)graph->nTiles+1);
+        if(graph->tiles == NULL || graph->tileBits > 31 ||
+           (graph->nTiles > 0 && ((uint64_t)(graph->nTiles-1) << graph->tileBits) >= n) ||
+           ((uint64_t)graph->nTiles << graph->tileBits) < n ||
+           (graph->tileBoundary = find_section(graph,GRAPH_TILE_BOUNDARY,sizeof(uint32_t),
+                              graph->tiles[graph->nTiles].firstBoundary)) == NULL ||
+           (graph->tileRBoundary = find_section(graph,GRAPH_TILE_RBOUNDARY,sizeof(uint32_t),
+                              graph->tiles[graph->nTiles].firstRBoundary)) == NULL){
+            fprintf(stderr,"Graph file %s has malformed tile sections.\n",filename);
+            graph_close(graph);
+            return 1;
+        }
+    }
+    //The id index is optional in the file
+    if(graph->idIndex == NULL || graph->idPos == NULL){
+        graph_index(graph);
+        graph->ownIndex = 1;
+    }
+    return 0;
+}
+
+
+/*  graph_close
+
+    Unmaps a graph filled by graph_open, or frees the arrays of a
+    graph built in memory.
+
+    Variables:
+        -graph = graph to close.
+ */
+void graph_close(graph_t *graph){
+    if(graph->map != NULL){
+        munmap(graph->map,graph->mapSize);
+        graph->map = NULL;
+        if(graph->ownIndex){
+            free((void *) graph->idIndex);
+            free((void *) graph->idPos);
+        }
+    }else{
+        free((void *) graph->offsets);
+        free((void *) graph->successors);
+        free((void *) graph->weights);
+        free((void *) graph->rOffsets);
+        free((void *) graph->rSources);
+        free((void *) graph->rWeights);
+        free((void *) graph->ids);
+        free((void *) graph->lat);
+        free((void *) graph->lon);
+        free((void *) graph->unit);
+        free((void *) graph->nameOffsets);
+        free((void *) graph->names);
+        free((void *) graph->idIndex);
+        free((void *) graph->idPos);
+        free((void *) graph->geoOffsets);
+        free((void *) graph->geoNodes);
+        free((void *) graph->geoDist);
+        free((void *) graph->chainGeo);
+        free((void *) graph->tiles);
+        free((void *) graph->tileBoundary);
+        free((void *) graph->tileRBoundary);
+    }
+}
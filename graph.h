@@ -0,0 +1,394 @@
+#pragma once
+#include <inttypes.h>
+#include <stddef.h>
+
+#define GRAPH_MAGIC 0x48505247 //"GRPH" in little endian
+#define GRAPH_VERSION 9
+#define GRAPH_ALIGN 64         //Alignment of each section in the file
+#define GRAPH_MAX_SECTIONS 32
+#define COORD_SCALE 1e7        //Coordinates are stored in 1e-7 degrees (about 1 cm)
+
+/* Sections that can appear in a graph file */
+enum graphSection {GRAPH_OFFSETS, GRAPH_SUCCESSORS, GRAPH_IDS, GRAPH_LAT,
+                   GRAPH_LON, GRAPH_NAME_OFFSETS, GRAPH_NAMES, GRAPH_WEIGHTS,
+                   GRAPH_UNITVEC, GRAPH_REV_OFFSETS, GRAPH_REV_SOURCES,
+                   GRAPH_REV_WEIGHTS, GRAPH_ID_INDEX, GRAPH_ID_POS,
+                   GRAPH_GEO_OFFSETS, GRAPH_GEO_NODES, GRAPH_GEO_DIST,
+                   GRAPH_CHAIN_GEO, GRAPH_TILES, GRAPH_TILE_BOUNDARY,
+                   GRAPH_TILE_RBOUNDARY};
+
+/* Entry of the section table of a graph file */
+typedef struct graphSection_s{
+    uint32_t type;          // Section type (enum graphSection)
+    uint32_t elemSize;      // Size of each element in bytes
+    uint64_t offset;        // Position of the section in the file
+    uint64_t count;         // Number of elements
+} graphSection_t;
+
+/* Header of a graph file, followed by the sections at aligned offsets */
+typedef struct graphHeader_s{
+    uint32_t magic;         // GRAPH_MAGIC
+    uint32_t version;       // GRAPH_VERSION
+    uint32_t nNodes;        // Number of nodes
+    uint32_t nEdges;        // Number of edges
+    uint32_t nSections;     // Number of used entries in sections
+    uint32_t tileBits;      // Log2 of the nodes of each tile, if there is a tile directory
+    graphSection_t sections[GRAPH_MAX_SECTIONS];
+} graphHeader_t;
+
+/* Entry of the tile directory of a graph. Tile t holds the nodes
+ * t << tileBits ... ((t+1) << tileBits)-1; in a graph numbered along a
+ * Hilbert curve they fill a compact region. The data of a tile lies in
+ * one range of each section: its nodes, the edges and reverse edges
+ * of its nodes, and the chain nodes of its edges, up to the first
+ * ones of the next entry. The directory ends with an entry holding
+ * the totals and the bounding box of the graph.
+ */
+typedef struct graphTile_s{
+    uint32_t firstNode;     // First node of the tile
+    uint32_t firstEdge;     // First edge of its nodes
+    uint32_t firstREdge;    // First reverse edge of its nodes
+    uint32_t firstGeo;      // First chain node of its edges (0 if not simplified)
+    uint32_t firstBoundary; // First of its edges to another tile in tileBoundary
+    uint32_t firstRBoundary; // First of its reverse edges in tileRBoundary
+    int32_t minLat, minLon; // Bounding box of its nodes in 1/COORD_SCALE degrees
+    int32_t maxLat, maxLon;
+} graphTile_t;
+
+/*  Graph in compressed sparse row form. The successors of node i are
+ *  successors[offsets[i]] ... successors[offsets[i+1]-1], and the nodes
+ *  with an edge into node i are rSources[rOffsets[i]] ...
+ *  rSources[rOffsets[i+1]-1]. Node data is kept in separate arrays so
+ *  the search only touches what it needs.
+ *  In a simplified graph only the first nKept nodes have edges: the
+ *  other nodes lie inside chains of degree 2 nodes contracted into a
+ *  single edge. The nodes inside the chain of edge j are
+ *  geoNodes[geoOffsets[j]] ... geoNodes[geoOffsets[j+1]-1], from the
+ *  source of the edge to its target, and chainGeo[v-nKept] is the
+ *  entry of a contracted node v in geoNodes.
+ *  A graph may be split into tiles (see graphTile_t) so searches can
+ *  keep only the tiles they reach resident (see tiles.h). The edges
+ *  from each tile to another one are listed in tileBoundary, and the
+ *  reverse edges into each tile from another one in tileRBoundary, so
+ *  a search finds the tiles it crosses into without scanning every
+ *  edge.
+ *  The arrays either point into a read-only mapping of the graph file
+ *  or are owned by the graph when it was built in memory.
+ */
+typedef struct graph_s{
+    uint32_t nNodes;                // Number of nodes
+    uint32_t nEdges;                // Number of edges (successors)
+    uint32_t nameLen;               // Total lenght of node names
+    uint32_t nKept;                 // Nodes with edges (nNodes if not simplified)
+    uint32_t nGeo;                  // Nodes inside contracted chains, with repetition
+    const uint32_t *offsets;        // Start of successors of each node (nNodes+1)
+    const uint32_t *successors;     // Position in node vectors
+    const float *weights;           // Length of each edge in meters
+    const uint32_t *rOffsets;       // Start of predecessors of each node (nNodes+1)
+    const uint32_t *rSources;       // Position of the predecessors
+    const float *rWeights;          // Length of each reverse edge
+    const uint32_t *ids;            // Identification numbers
+    const int32_t *lat, *lon;       // Spherical coordinates in 1/COORD_SCALE degrees
+    const double *unit;             // Unit vector of each node (x,y,z)
+    const uint32_t *nameOffsets;    // Start of the name of each node in names (shared by equal names)
+    const char *names;              // Distinct node names, '\0' separated
+    const uint32_t *idIndex;        // Sorted ids in Eytzinger order (nNodes+1, from 1)
+    const uint32_t *idPos;          // Node position of each idIndex entry
+    const uint32_t *geoOffsets;     // Start of the chain of each edge (nEdges+1), NULL if not simplified
+    const uint32_t *geoNodes;       // Nodes inside the chains
+    const float *geoDist;           // Distance from the source of the edge to each of them
+    const uint32_t *chainGeo;       // Entry in geoNodes of each contracted node (nNodes-nKept)
+    uint32_t nTiles;                // Number of tiles, 0 without a tile directory
+    uint32_t tileBits;              // Log2 of the nodes of each tile
+    const graphTile_t *tiles;       // Tile directory (nTiles+1)
+    const uint32_t *tileBoundary;   // Edges leaving each tile, grouped by tile in edge order
+    const uint32_t *tileRBoundary;  // Reverse edges entering each tile, grouped likewise
+    void *map;                      // Mapping of the file (NULL if owned)
+    size_t mapSize;                 // Size of the mapping
+    uint8_t ownIndex;               // Id index built for a mapped file
+} graph_t;
+
+
+/*  graph_name
+
+    Name of a node of the graph.
+
+    Variables:
+        -graph = graph of the node.
+        -node = position of the node.
+
+    Return value:
+        '\0' terminated name of the node.
+ */
+static inline const char *graph_name(const graph_t *graph, uint32_t node){
+    return graph->names+graph->nameOffsets[node];
+}
+
+
+/*  id_index_find
+
+    Looks for an id in an id index. The sorted ids are stored in
+    Eytzinger (breadth first) order: the first probes of every search
+    share a few cache lines, and the children of a probe are prefetched
+    while it is compared, so the search does not wait on each level.
+
+    Variables:
+        -index = ids in Eytzinger order (n+1 elements, from 1).
+        -pos = node position of each entry of index.
+        -n = number of ids.
+        -id = id to look for.
+
+    Return value:
+        Position of the node with the id, UINT32_MAX if not found.
+ */
+static inline uint32_t id_index_find(const uint32_t *index, const uint32_t *pos,
+                                     uint32_t n, uint32_t id){
+    uint64_t k = 1;
+
+    while(k <= n){
+        __builtin_prefetch(index+16*k);
+        k = 2*k+(index[k] < id);
+    }
+    //Undo the right turns taken after the last left turn
+    k >>= __builtin_ffsll(~k);
+    return k != 0 && index[k] == id ? pos[k] : UINT32_MAX;
+}
+
+
+/*  id_index_build
+
+    Builds the id index of a set of nodes. The ids need not be sorted.
+
+    Variables:
+        -ids = id of each node.
+        -n = number of nodes.
+        -index = output vector of n+1 ids in Eytzinger order.
+        -pos = output vector of n+1 node positions.
+ */
+void id_index_build(const uint32_t *ids, uint32_t n, uint32_t *index, uint32_t *pos);
+
+
+/*  graph_find
+
+    Position of the node of a graph with an id.
+
+    Variables:
+        -graph = graph of the node.
+        -id = id to look for.
+
+    Return value:
+        Position of the node, UINT32_MAX if not found.
+ */
+static inline uint32_t graph_find(const graph_t *graph, uint32_t id){
+    return id_index_find(graph->idIndex,graph->idPos,graph->nNodes,id);
+}
+
+
+/*  graph_index
+
+    Builds the id index (idIndex, idPos) of a graph, owned by it.
+
+    Variables:
+        -graph = graph to complete.
+ */
+void graph_index(graph_t *graph);
+
+
+/*  graph_tile
+
+    Builds the tile directory and the boundary edge tables of a graph,
+    owned by it. The nodes should be numbered along a Hilbert curve
+    (see reorder_graph) for the tiles to be compact regions.
+
+    Variables:
+        -graph = graph to complete.
+        -tileBits = log2 of the nodes of each tile.
+ */
+void graph_tile(graph_t *graph, uint32_t tileBits);
+
+
+/*  graph_geo_edge
+
+    Edge of a simplified graph whose chain holds an entry of geoNodes.
+
+    Variables:
+        -graph = simplified graph.
+        -k = entry of geoNodes.
+
+    Return value:
+        Position of the edge.
+ */
+uint32_t graph_geo_edge(const graph_t *graph, uint32_t k);
+
+
+/*  graph_edge_source
+
+    Source node of an edge.
+
+    Variables:
+        -graph = graph of the edge.
+        -j = position of the edge.
+
+    Return value:
+        Position of the source node.
+ */
+uint32_t graph_edge_source(const graph_t *graph, uint32_t j);
+
+
+/*  graph_chain_edges
+
+    Edges whose chain holds a contracted node: the edge of its chain
+    and, for two-way chains, the reverse one.
+
+    Variables:
+        -graph = simplified graph.
+        -node = position of the contracted node.
+        -edges = output positions of the edges.
+        -geo = output entry of the node in geoNodes for each edge.
+
+    Return value:
+        Number of edges.
+ */
+uint8_t graph_chain_edges(const graph_t *graph, uint32_t node,
+                          uint32_t edges[2], uint32_t geo[2]);
+
+
+/*  graph_ends
+
+    Nodes of the search graph where a path starting or ending at a node
+    leaves or reaches the edges. A node with edges is its own end. A
+    node inside a contracted chain has the ends of its chain edge: the
+    target of the edge when the path starts at it, the source when the
+    path ends at it, and the opposite end for two-way chains.
+
+    Variables:
+        -graph = graph of the node.
+        -node = position of the node.
+        -asTarget = 1 if the path ends at the node, 0 if it starts.
+        -ends = output positions of up to 2 nodes with edges.
+        -offsets = output distance between the node and each end.
+
+    Return value:
+        Number of ends.
+ */
+uint8_t graph_ends(const graph_t *graph, uint32_t node, uint8_t asTarget,
+                   uint32_t ends[2], double offsets[2]);
+
+
+/*  graph_chain_span
+
+    Finds an edge whose chain holds two contracted nodes in order.
+
+    Variables:
+        -graph = simplified graph.
+        -start, target = positions of the nodes.
+        -ks, kt = entries of the nodes in geoNodes, if found.
+
+    Return value:
+        1 if found, 0 otherwise.
+ */
+int graph_chain_span(const graph_t *graph, uint32_t start, uint32_t target,
+                     uint32_t *ks, uint32_t *kt);
+
+
+/*  graph_chain_distance
+
+    Checks if a path can go directly along a contracted chain: both
+    nodes lie inside the chain of the same edge, in this order. Paths
+    leaving the chain can still be shorter.
+
+    Variables:
+        -graph = graph of the nodes.
+        -start, target = positions of the nodes.
+        -distance = length of the path along the chain, if found.
+
+    Return value:
+        1 if the nodes lie in order in the same chain, 0 otherwise.
+ */
+int graph_chain_distance(const graph_t *graph, uint32_t start, uint32_t target,
+                         double *distance);
+
+
+/*  graph_expand_path
+
+    Expands a path found on the search graph of a simplified graph
+    into the full path, inserting the nodes of the contracted chains
+    of its edges, and the parts of the chains from the start node to
+    the first node of the path and from its last node to the target
+    node when these are ends (see graph_ends). With no path, the
+    direct path along a chain is given (see graph_chain_distance).
+
+    Variables:
+        -graph = simplified graph.
+        -start, target = nodes asked for.
+        -distance = length of the path.
+        -path, pathDist = nodes of the search path and their distance
+                          from the start node.
+        -pathLen = number of nodes of the search path, 0 if the path
+                   goes directly along a chain.
+        -nodes, dist = output vectors, grown if needed.
+        -cap = room in the output vectors, updated.
+
+    Return value:
+        Number of nodes of the full path.
+ */
+uint32_t graph_expand_path(const graph_t *graph, uint32_t start, uint32_t target,
+                           double distance,
+                           const uint32_t *path, const double *pathDist,
+                           uint32_t pathLen, uint32_t **nodes, double **dist,
+                           uint32_t *cap);
+
+
+/*  graph_reverse
+
+    Builds the reverse adjacency (rOffsets, rSources, rWeights) of a
+    graph built in memory.
+
+    Variables:
+        -graph = graph to complete.
+ */
+void graph_reverse(graph_t *graph);
+
+
+/*  graph_write
+
+    Writes the graph into a binary file: a graphHeader_t whose section
+    table gives the position of each array, followed by the arrays
+    themselves aligned to GRAPH_ALIGN bytes. The file has no pointers,
+    so it can be mapped and used directly.
+
+    Variables:
+        -graph = graph to write.
+        -filename = name of the output file.
+
+    Return value:
+        0 if successfull, 1 otherwise.
+ */
+int graph_write(const graph_t *graph, const char *filename);
+
+
+/*  graph_open
+
+    Maps read-only a graph written by graph_write, checking its magic
+    number, version and section table. No data is copied, except for
+    the id index, which is built if the file does not have it.
+
+    Variables:
+        -graph = graph to fill.
+        -filename = name of the input file.
+
+    Return value:
+        0 if successfull, 1 otherwise.
+ */
+int graph_open(graph_t *graph, const char *filename);
+
+
+/*  graph_close
+
+    Unmaps a graph filled by graph_open, or frees the arrays of a
+    graph built in memory.
+
+    Variables:
+        -graph = graph to close.
+ */
+void graph_close(graph_t *graph);
@@ -0,0 +1,298 @@
+#include "landmarks.h"
+#include "aStar.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*  DIJKSTRAALL
+ *
+ *  Computes the distance from a source node to every node of a
+ *  graph in compressed sparse row form. Unreachable nodes get
+ *  DBL_MAX.
+ *
+ *  Input:
+ *      nNodes: number of nodes.
+ *      offsets, successors, weights: adjacency of the graph.
+ *      source: position of the source node.
+ *      dist: output vector of nNodes distances.
+ */
+void dijkstraAll(uint32_t nNodes, const uint32_t *offsets,
+                 const uint32_t *successors, const float *weights,
+                 uint32_t source, double *dist){
+    heap_t heap;
+    uint8_t *whq;
+    uint32_t i, currentNode, successorNode;
+    double cost;
+
+    whq = calloc(nNodes,sizeof(uint8_t)); assert(whq != NULL || nNodes == 0);
+    heapCreate(&heap,nNodes);
+    for(i=0; i<nNodes; i++)
+        dist[i] = DBL_MAX;
+
+    dist[source] = 0.;
+    whq[source] = OPEN;
+    heapPush(&heap,source,0.);
+    while(heap.size > 0){
+        currentNode = heapPop(&heap);
+        whq[currentNode] = CLOSED;
+        for(i=offsets[currentNode]; i<offsets[currentNode+1]; i++){
+            successorNode = successors[i];
+            cost = dist[currentNode]+weights[i];
+            if(whq[successorNode] == CLOSED || dist[successorNode] <= cost)
+                continue;
+            dist[successorNode] = cost;
+            if(whq[successorNode] == OPEN)
+                heapDecreaseKey(&heap,successorNode,cost);
+            else{
+                whq[successorNode] = OPEN;
+                heapPush(&heap,successorNode,cost);
+            }
+        }
+    }
+    heapFree(&heap);
+    free(whq);
+}
+
+/*  COMPUTELANDMARKS
+ *
+ *  Selects landmarks by farthest selection and computes their
+ *  forward and backward distance tables. The first landmark is the
+ *  node farthest from a seeded random node; every next one is the
+ *  reachable node farthest from the landmarks already selected.
+ *
+ *  Input:
+ *      graph: graph to preprocess.
+ *      nLandmarks: number of landmarks to select.
+ *      seed: seed of the random starting node.
+ *      landmarks: output tables, owned by the structure.
+ */
+void computeLandmarks(const graph_t *graph, uint32_t nLandmarks, uint32_t seed,
+                      landmarks_t *landmarks){
+    uint32_t n = graph->nNodes, i, l, best, *nodes;
+    float *fwd, *bwd;
+    double *dist, *minDist;
+
+    memset(landmarks,0,sizeof(landmarks_t));
+    landmarks->nNodes = n;
+    landmarks->nEdges = graph->nEdges;
+    landmarks->nLandmarks = nLandmarks;
+    nodes = malloc(sizeof(uint32_t)*nLandmarks); assert(nodes);
+    fwd = malloc(sizeof(float)*n*nLandmarks); assert(fwd != NULL || n == 0);
+    bwd = malloc(sizeof(float)*n*nLandmarks); assert(bwd != NULL || n == 0);
+    dist = malloc(sizeof(double)*n); assert(dist != NULL || n == 0);
+    minDist = malloc(sizeof(double)*n); assert(minDist != NULL || n == 0);
+
+    //Random starting node with some edge, first landmark farthest from it
+    srand(seed);
+    best = rand()%n;
+    for(i=0; i<n && graph->offsets[best] == graph->offsets[best+1]; i++)
+        best = (best+1)%n;
+    dijkstraAll(n,graph->offsets,graph->successors,graph->weights,best,dist);
+    for(i=0; i<n; i++)
+        minDist[i] = dist[i];
+
+    for(l=0; l<nLandmarks; l++){
+        //Reachable node farthest from the landmarks already selected
+        for(i=0; i<n; i++)
+            if(minDist[i] != DBL_MAX && (minDist[best] == DBL_MAX || minDist[i] > minDist[best]))
+                best = i;
+        nodes[l] = best;
+        fprintf(stderr,"Landmark %"PRIu32": node %"PRIu32" (id %"PRIu32")\n",
+                l,best,graph->ids[best]);
+
+        dijkstraAll(n,graph->offsets,graph->successors,graph->weights,best,dist);
+        for(i=0; i<n; i++){
+            fwd[(size_t)i*nLandmarks+l] = dist[i] == DBL_MAX ? LANDMARK_UNREACHABLE : (float) dist[i];
+            if(l == 0 || dist[i] < minDist[i])
+                minDist[i] = dist[i];
+        }
+        //Backward search over the reverse graph (oneway edges)
+        dijkstraAll(n,graph->rOffsets,graph->rSources,graph->rWeights,best,dist);
+        for(i=0; i<n; i++)
+            bwd[(size_t)i*nLandmarks+l] = dist[i] == DBL_MAX ? LANDMARK_UNREACHABLE : (float) dist[i];
+    }
+
+    landmarks->nodes = nodes;
+    landmarks->fwd = fwd;
+    landmarks->bwd = bwd;
+    free(dist); free(minDist);
+}
+
+/*  WRITELANDMARKS
+ *
+ *  Writes the landmark tables into a sidecar file of the graph.
+ *
+ *  Input:
+ *      landmarks: tables to write.
+ *      filename: name of the output file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int writeLandmarks(const landmarks_t *landmarks, const char *filename){
+    static const char zeros[GRAPH_ALIGN] = {0};
+    landmarksHeader_t header;
+    FILE *binOut;
+    uint64_t tableSize = sizeof(float)*(uint64_t)landmarks->nNodes*landmarks->nLandmarks;
+    uint64_t pad;
+
+    memset(&header,0,sizeof(landmarksHeader_t));
+    header.magic = LANDMARKS_MAGIC;
+    header.version = LANDMARKS_VERSION;
+    header.nNodes = landmarks->nNodes;
+    header.nEdges = landmarks->nEdges;
+    header.nLandmarks = landmarks->nLandmarks;
+    header.nodesOffset = GRAPH_ALIGN;
+    header.fwdOffset = header.nodesOffset+sizeof(uint32_t)*landmarks->nLandmarks;
+    header.fwdOffset += (GRAPH_ALIGN-header.fwdOffset%GRAPH_ALIGN)%GRAPH_ALIGN;
+    header.bwdOffset = header.fwdOffset+tableSize;
+    header.bwdOffset += (GRAPH_ALIGN-header.bwdOffset%GRAPH_ALIGN)%GRAPH_ALIGN;
+
+    binOut = fopen(filename,"wb");
+    if(binOut == NULL){
+        fprintf(stderr,"Could not create landmarks file.\n");
+        return 1;
+    }
+    pad = header.fwdOffset-header.nodesOffset-sizeof(uint32_t)*landmarks->nLandmarks;
+    if(fwrite(&header,sizeof(landmarksHeader_t),1,binOut) != 1 ||
+       fwrite(zeros,1,GRAPH_ALIGN-sizeof(landmarksHeader_t),binOut) != GRAPH_ALIGN-sizeof(landmarksHeader_t) ||
+       fwrite(landmarks->nodes,sizeof(uint32_t),landmarks->nLandmarks,binOut) != landmarks->nLandmarks ||
+       fwrite(zeros,1,pad,binOut) != pad ||
+       fwrite(landmarks->fwd,1,tableSize,binOut) != tableSize ||
+       fwrite(zeros,1,header.bwdOffset-header.fwdOffset-tableSize,binOut) !=
+            header.bwdOffset-header.fwdOffset-tableSize ||
+       fwrite(landmarks->bwd,1,tableSize,binOut) != tableSize){
+        fprintf(stderr,"Could not write landmarks file.\n");
+        fclose(binOut);
+        return 1;
+    }
+    if(fclose(binOut) != 0){
+        fprintf(stderr,"Could not close landmarks file.\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*  OPENLANDMARKS
+ *
+ *  Maps read-only a landmarks file, checking that it belongs to
+ *  the graph.
+ *
+ *  Input:
+ *      landmarks: tables to fill.
+ *      graph: graph the tables must belong to.
+ *      filename: name of the input file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int openLandmarks(landmarks_t *landmarks, const graph_t *graph,
+                  const char *filename){
+    const landmarksHeader_t *header;
+    struct stat st;
+    uint64_t tableSize;
+    int fd;
+
+    memset(landmarks,0,sizeof(landmarks_t));
+    fd = open(filename,O_RDONLY);
+    if(fd < 0 || fstat(fd,&st) != 0 || (size_t) st.st_size < sizeof(landmarksHeader_t)){
+        fprintf(stderr,"Could not open landmarks file %s.\n",filename);
+        if(fd >= 0)
+            close(fd);
+        return 1;
+    }
+    landmarks->mapSize = st.st_size;
+    landmarks->map = mmap(NULL,landmarks->mapSize,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if(landmarks->map == MAP_FAILED){
+        fprintf(stderr,"Could not map landmarks file %s.\n",filename);
+        landmarks->map = NULL;
+        return 1;
+    }
+
+    header = landmarks->map;
+    tableSize = sizeof(float)*(uint64_t)header->nNodes*header->nLandmarks;
+    if(header->magic != LANDMARKS_MAGIC || header->version != LANDMARKS_VERSION ||
+       header->nNodes != graph->nNodes || header->nEdges != graph->nEdges ||
+       header->nLandmarks == 0 ||
+       header->nodesOffset+sizeof(uint32_t)*header->nLandmarks > landmarks->mapSize ||
+       header->fwdOffset+tableSize > landmarks->mapSize ||
+       header->bwdOffset+tableSize > landmarks->mapSize){
+        fprintf(stderr,"Landmarks file %s does not belong to the graph. Rebuild it with makeLandmarks.\n",
+                filename);
+        closeLandmarks(landmarks);
+        return 1;
+    }
+    landmarks->nNodes = header->nNodes;
+    landmarks->nEdges = header->nEdges;
+    landmarks->nLandmarks = header->nLandmarks;
+    landmarks->nodes = (const uint32_t *) ((const char *) landmarks->map+header->nodesOffset);
+    landmarks->fwd = (const float *) ((const char *) landmarks->map+header->fwdOffset);
+    landmarks->bwd = (const float *) ((const char *) landmarks->map+header->bwdOffset);
+    return 0;
+}
+
+/*  CLOSELANDMARKS
+ *
+ *  Unmaps or frees the landmark tables.
+ *
+ *  Input:
+ *      landmarks: tables to close.
+ */
+void closeLandmarks(landmarks_t *landmarks){
+    if(landmarks->map != NULL){
+        munmap(landmarks->map,landmarks->mapSize);
+        landmarks->map = NULL;
+    }else{
+        free((void *) landmarks->nodes);
+        free((void *) landmarks->fwd);
+        free((void *) landmarks->bwd);
+    }
+}
+
+/*  HEURISTICALT
+ *
+ *  ALT heuristic for the a* algorithm. By the triangle inequality,
+ *  for every landmark l:
+ *      d(v,t) >= d(l,t) - d(l,v)   (forward table)
+ *      d(v,t) >= d(v,l) - d(t,l)   (backward table)
+ *  The heuristic is the maximum of these bounds over the landmarks
+ *  and the chord bound, each lowered by ALT_SLACK to absorb the
+ *  rounding of the stored distances.
+ *
+ *  Input:
+ *      graph: graph of the nodes.
+ *      currentNode: position of current node to find heuristic distance.
+ *      destinationNode: position of destination node.
+ *      data: landmarks_t with the tables of the graph.
+ *
+ *  Return: heuristic distance.
+ */
+double heuristicALT(const graph_t *graph, uint32_t currentNode,
+                    uint32_t destinationNode, const void *data){
+    const landmarks_t *landmarks = data;
+    uint32_t l, k = landmarks->nLandmarks;
+    const float *fwdC = landmarks->fwd+(size_t)currentNode*k;
+    const float *fwdD = landmarks->fwd+(size_t)destinationNode*k;
+    const float *bwdC = landmarks->bwd+(size_t)currentNode*k;
+    const float *bwdD = landmarks->bwd+(size_t)destinationNode*k;
+    double h = heuristicChord(graph,currentNode,destinationNode,NULL), bound;
+
+    for(l=0; l<k; l++){
+        if(fwdD[l] != LANDMARK_UNREACHABLE && fwdC[l] != LANDMARK_UNREACHABLE){
+            bound = ((double) fwdD[l]-fwdC[l])-ALT_SLACK*((double) fwdD[l]+fwdC[l]);
+            if(bound > h)
+                h = bound;
+        }
+        if(bwdC[l] != LANDMARK_UNREACHABLE && bwdD[l] != LANDMARK_UNREACHABLE){
+            bound = ((double) bwdC[l]-bwdD[l])-ALT_SLACK*((double) bwdC[l]+bwdD[l]);
+            if(bound > h)
+                h = bound;
+        }
+    }
+    return h;
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include "graph.h"
+#include <float.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+#define LANDMARKS_MAGIC 0x4b524d4c      //"LMRK" in little endian
+#define LANDMARKS_VERSION 1
+#define LANDMARK_UNREACHABLE FLT_MAX    //Distance stored for unreachable nodes
+#define ALT_SLACK 1.2e-7                //Relative rounding of stored distances
+
+/*Header of a landmarks file, followed by the tables at aligned offsets */
+typedef struct landmarksHeader_s{
+    uint32_t magic;         //LANDMARKS_MAGIC
+    uint32_t version;       //LANDMARKS_VERSION
+    uint32_t nNodes;        //Nodes of the graph the tables belong to
+    uint32_t nEdges;        //Edges of the graph the tables belong to
+    uint32_t nLandmarks;    //Number of landmarks
+    uint32_t reserved;
+    uint64_t nodesOffset;   //Position of the landmark node vector
+    uint64_t fwdOffset;     //Position of the forward table
+    uint64_t bwdOffset;     //Position of the backward table
+} landmarksHeader_t;
+
+/*Landmark distance tables. Both are stored node by node, so all the
+ *distances of a node lie together:
+ *  fwd[v*nLandmarks+l] = distance from landmark l to node v.
+ *  bwd[v*nLandmarks+l] = distance from node v to landmark l.
+ */
+typedef struct landmarks_s{
+    uint32_t nNodes;        //Number of nodes
+    uint32_t nEdges;        //Number of edges
+    uint32_t nLandmarks;    //Number of landmarks
+    const uint32_t *nodes;  //Position of each landmark in the graph
+    const float *fwd;       //Distances from the landmarks
+    const float *bwd;       //Distances to the landmarks
+    void *map;              //Mapping of the file (NULL if owned)
+    size_t mapSize;         //Size of the mapping
+} landmarks_t;
+
+/*  DIJKSTRAALL
+ *
+ *  Computes the distance from a source node to every node of a
+ *  graph in compressed sparse row form. Unreachable nodes get
+ *  DBL_MAX.
+ *
+ *  Input:
+ *      nNodes: number of nodes.
+ *      offsets, successors, weights: adjacency of the graph.
+ *      source: position of the source node.
+ *      dist: output vector of nNodes distances.
+ */
+void dijkstraAll(uint32_t nNodes, const uint32_t *offsets,
+                 const uint32_t *successors, const float *weights,
+                 uint32_t source, double *dist);
+
+/*  COMPUTELANDMARKS
+ *
+ *  Selects landmarks by farthest selection and computes their
+ *  forward and backward distance tables. The first landmark is the
+ *  node farthest from a seeded random node; every next one is the
+ *  reachable node farthest from the landmarks already selected.
+ *
+ *  Input:
+ *      graph: graph to preprocess.
+ *      nLandmarks: number of landmarks to select.
+ *      seed: seed of the random starting node.
+ *      landmarks: output tables, owned by the structure.
+ */
+void computeLandmarks(const graph_t *graph, uint32_t nLandmarks, uint32_t seed,
+                      landmarks_t *landmarks);
+
+/*  WRITELANDMARKS
+ *
+ *  Writes the landmark tables into a sidecar file of the graph.
+ *
+ *  Input:
+ *      landmarks: tables to write.
+ *      filename: name of the output file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int writeLandmarks(const landmarks_t *landmarks, const char *filename);
+
+/*  OPENLANDMARKS
+ *
+ *  Maps read-only a landmarks file, checking that it belongs to
+ *  the graph.
+ *
+ *  Input:
+ *      landmarks: tables to fill.
+ *      graph: graph the tables must belong to.
+ *      filename: name of the input file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int openLandmarks(landmarks_t *landmarks, const graph_t *graph,
+                  const char *filename);
+
+/*  CLOSELANDMARKS
+ *
+ *  Unmaps or frees the landmark tables.
+ *
+ *  Input:
+ *      landmarks: tables to close.
+ */
+void closeLandmarks(landmarks_t *landmarks);
+
+/*  HEURISTICALT
+ *
+ *  ALT heuristic for the a* algorithm. By the triangle inequality,
+ *  for every landmark l:
+ *      d(v,t) >= d(l,t) - d(l,v)   (forward table)
+ *      d(v,t) >= d(v,l) - d(t,l)   (backward table)
+ *  The heuristic is the maximum of these bounds over the landmarks
+ *  and the chord bound, each lowered by ALT_SLACK to absorb the
+ *  rounding of the stored distances.
+ *
+ *  Input:
+ *      graph: graph of the nodes.
+ *      currentNode: position of current node to find heuristic distance.
+ *      destinationNode: position of destination node.
+ *      data: landmarks_t with the tables of the graph.
+ *
+ *  Return: heuristic distance.
+ */
+double heuristicALT(const graph_t *graph, uint32_t currentNode,
+                    uint32_t destinationNode, const void *data);
@@ -1,122 +1,476 @@
 #include "aStar.h"
-#include "mkGr.h"
+#include "batch.h"
+#include "ch.h"
+#include "crp.h"
+#include "graph.h"
+#include "landmarks.h"
+#include "matrix.h"
+#include "overlay.h"
+#include "tiles.h"
 #include <assert.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <unistd.h>
+
+/*Phases of a single query, timed separately */
+enum phase {PHASE_LOAD, PHASE_LOOKUP, PHASE_SEARCH, PHASE_OUTPUT, N_PHASES};
+
+/*  LAPTIME
+ *
+ *  Seconds since the last lap, starting a new one.
+ *
+ *  Input:
+ *      lap: time of the last lap, updated.
+ *
+ *  Return: seconds elapsed.
+ */
+static double lapTime(struct timeval *lap){
+    struct timeval now, diff;
+
+    gettimeofday(&now,NULL);
+    timersub(&now,lap,&diff);
+    *lap = now;
+    return diff.tv_sec+1e-6*diff.tv_usec;
+}
+
+/*  PRINTQUERYJSON
+ *
+ *  Writes the result, the phase times (microseconds) and the search
+ *  counters of a single query as a JSON object.
+ *
+ *  Input:
+ *      out: stream to write to.
+ *      startId, targetId: ids of the query.
+ *      found: 1 if a path was found.
+ *      distance: length of the path.
+ *      pathLen: nodes of the path.
+ *      phases: seconds spent in each phase (enum phase).
+ *      stats: counters of the forward and backward searches.
+ */
+static void printQueryJSON(FILE *out, uint32_t startId, uint32_t targetId,
+                           uint8_t found, double distance, uint32_t pathLen,
+                           const double *phases, const AStarStats_t *stats){
+    fprintf(out,"{\"start\":%"PRIu32",\"target\":%"PRIu32",",startId,targetId);
+    if(found)
+        fprintf(out,"\"distance\":%.6lf,\"path_nodes\":%"PRIu32",",distance,pathLen);
+    else
+        fprintf(out,"\"distance\":null,\"path_nodes\":0,");
+    fprintf(out,"\"load_us\":%.3lf,\"lookup_us\":%.3lf,\"search_us\":%.3lf,"
+                "\"output_us\":%.3lf,\"stats\":[",
+            1e6*phases[PHASE_LOAD],1e6*phases[PHASE_LOOKUP],
+            1e6*phases[PHASE_SEARCH],1e6*phases[PHASE_OUTPUT]);
+    writeStatsJSON(out,&stats[0]);
+    fputc(',',out);
+    writeStatsJSON(out,&stats[1]);
+    fprintf(out,"]}\n");
+}
 
 int main(int argc, char *argv[]){
     
-    uint32_t nNodes,nSucc,nameLen; //Number of nodes, succesors, and total name lenght
     uint32_t startId, targetId, startNode, targetNode; //nodeIDs and vectorIDs
-    uint32_t aux1,aux2,i;
-    uint32_t *successors; //Successors vector
-    char *nodeNames;    //Nodenamevector
-    AStarStatus_t *status; //A star status vector for all nodes
-    node_t *nodes; //Node vector
-    FILE *binIn, *solutionF; //Binary input file and solution file
-    struct timeval tval_before, tval_after, tval_result; //Timing
+    uint32_t i;
+    uint8_t found; //Search result
+    AStarContext_t ctx; //Memory of the searches
+    ch_t ch; //Contraction hierarchy
+    chWorkspace_t chWs; //Memory of hierarchy queries
+    char *chFile = NULL;
+    crp_t crp; //Customizable route planning partition
+    crpWorkspace_t crpWs; //Memory of partition queries
+    char *crpFile = NULL;
+    uint32_t *path, pathLen; //Path of a hierarchy or partition query
+    double *pathDist, distance;
+    uint64_t *settled;
+    graph_t graph; //Graph in compressed sparse row form
+    FILE *solutionF; //Solution file
+    struct timeval tval_before, tval_after, tval_result, tval_recomp; //Timing
+    struct timeval lap; //Start of the current phase
+    double phases[N_PHASES] = {0.}; //Seconds of each phase
+    AStarStats_t chStats[2]; //Counters of a hierarchy or partition query
+    uint8_t json = 0; //Statistics of the query as JSON
+    AStarOptions_t options = {HEAP_QUEUE, STORED_EDGES, HAVERSINE_HEURISTIC, NULL, 0}; //Search options
+    landmarks_t landmarks; //ALT distance tables
+    char *landmarksFile = NULL;
+    uint8_t compareEdges = 0; //Also time search recomputing edge lengths
+    char *batchFile = NULL; //Pairs to answer, "-" for stdin
+    batchOptions_t batchOptions = {BATCH_TEXT, 0, NULL, 1, NULL, NULL, NULL}; //Batch output
+    batchStats_t batchStats; //Batch counters
+    FILE *batchF;
+    char *matrixFile = NULL; //Output of the distance matrix
+    uint32_t *sourceIds, *targetIds, nSources, nTargets;
+    double *matrix;
+    matrixStats_t matrixStats;
+    overlayHolder_t overlay; //Edge cost changes
+    char *overlayFile = NULL;
+    tilePager_t pager; //Tiles of the graph kept resident
+    uint32_t maxTiles = 0; //Most resident tiles, 0 to keep the graph mapped whole
+    int opt;
     
     /* INPUT */
-    if (argc < 4 ||
-        sscanf(argv[2],"%"SCNi32, &startId)!=1 ||
-        sscanf(argv[3],"%"SCNi32, &targetId)!=1 
+    while((opt = getopt(argc,argv,"q:eH:l:c:R:bB:PO:t:M:jw:L:")) != -1){
+        switch(opt){
+            case 'q':
+                if(strcmp(optarg,"list") == 0)
+                    options.queueType = LIST_QUEUE;
+                else if(strcmp(optarg,"heap") == 0)
+                    options.queueType = HEAP_QUEUE;
+                else
+                    argc = 0;
+                break;
+            case 'e':
+                compareEdges = 1;
+                break;
+            case 'H':
+                if(strcmp(optarg,"haversine") == 0)
+                    options.heuristic = HAVERSINE_HEURISTIC;
+                else if(strcmp(optarg,"chord") == 0)
+                    options.heuristic = CHORD_HEURISTIC;
+                else if(strcmp(optarg,"alt") == 0)
+                    options.heuristic = ALT_HEURISTIC;
+                else
+                    argc = 0;
+                break;
+            case 'l':
+                landmarksFile = optarg;
+                break;
+            case 'c':
+                chFile = optarg;
+                break;
+            case 'R':
+                crpFile = optarg;
+                break;
+            case 'b':
+                options.bidirectional = 1;
+                break;
+            case 'B':
+                batchFile = optarg;
+                break;
+            case 'P':
+                batchOptions.printPath = 1;
+                break;
+            case 'O':
+                if(strcmp(optarg,"text") == 0)
+                    batchOptions.format = BATCH_TEXT;
+                else if(strcmp(optarg,"binary") == 0)
+                    batchOptions.format = BATCH_BINARY;
+                else if(strcmp(optarg,"json") == 0)
+                    batchOptions.format = BATCH_JSON;
+                else
+                    argc = 0;
+                break;
+            case 'M':
+                matrixFile = optarg;
+                break;
+            case 'j':
+                json = 1;
+                batchOptions.format = BATCH_JSON;
+                break;
+            case 'w':
+                overlayFile = optarg;
+                break;
+            case 'L':
+                if(sscanf(optarg,"%"SCNu32,&maxTiles) != 1 || maxTiles == 0)
+                    argc = 0;
+                break;
+            case 't':
+                if(sscanf(optarg,"%"SCNu32,&batchOptions.threads) != 1 ||
+                   batchOptions.threads == 0)
+                    argc = 0;
+                break;
+            default:
+                argc = 0;
+        }
+    }
+    if (argc-optind < (batchFile != NULL ? 1 : 3) ||
+        (batchFile == NULL && matrixFile == NULL &&
+         (sscanf(argv[optind+1],"%"SCNi32, &startId)!=1 ||
+          sscanf(argv[optind+2],"%"SCNi32, &targetId)!=1)) ||
+        (options.heuristic == ALT_HEURISTIC && landmarksFile == NULL) ||
+        (overlayFile != NULL && (chFile != NULL || matrixFile != NULL)) ||
+        (crpFile != NULL && (chFile != NULL || matrixFile != NULL)) ||
+        (maxTiles > 0 && (chFile != NULL || crpFile != NULL || matrixFile != NULL)) ||
+        (options.queueType == LIST_QUEUE &&
+         (options.bidirectional || chFile != NULL || crpFile != NULL || matrixFile != NULL))
        ) {
-          fprintf(stderr,"%s filename startId targetId\n",argv[0]);
+          fprintf(stderr,"%s [-q list|heap] [-e] [-H haversine|chord|alt] [-l landmarks] [-c hierarchy | -R partition] [-b] [-w overlay] [-L tiles] [-t threads] [-j] filename startId targetId\n"
+                         "%s [-H ...] [-l landmarks] [-c hierarchy | -R partition] [-b] [-w overlay] [-L tiles] -B pairs|- [-P] [-O text|binary|json] [-j] [-t threads] filename\n"
+                         "%s -M matrix [-t threads] filename sources targets\n",argv[0],argv[0],argv[0]);
           return 1;
     }
 
     /* READ GRAPH FROM BINARY FILE */
-    binIn = fopen(argv[1],"r");
-    //Read header variables
-    if((fread(&nNodes,sizeof(uint32_t),1,binIn) +
-        fread(&nSucc,sizeof(uint32_t),1,binIn)+
-        fread(&nameLen,sizeof(uint32_t),1,binIn)) != 3){
-            fprintf(stderr,"Problems reading header. Exiting...\n");
-            fclose(binIn);
+    gettimeofday(&lap,NULL);
+    if(graph_open(&graph,argv[optind]) != 0){
+        fprintf(stderr,"Problems reading graph. Exiting...\n");
+        return 1;
+    }
+    if(options.heuristic == ALT_HEURISTIC){
+        if(openLandmarks(&landmarks,&graph,landmarksFile) != 0){
+            graph_close(&graph);
             return 1;
+        }
+        options.heuristicData = &landmarks;
     }
-
-    //Alloc memory
-    nodes = malloc(sizeof(node_t)*nNodes); assert(nodes);
-    successors = malloc(sizeof(uint32_t)*nSucc); assert(successors);
-    nodeNames = malloc(sizeof(char)*nameLen); assert(nodeNames);
-
-    //Read nodes, successors and nodeNames together
-    if((fread(nodes,sizeof(node_t),nNodes,binIn) +
-        fread(successors,sizeof(uint32_t),nSucc,binIn) +
-        fread(nodeNames,sizeof(char),nameLen,binIn)) != (nNodes+nSucc+nameLen)){
-            fprintf(stderr,"Problems reading graph data. Exiting...\n");
-            free(nodes);
-            free(successors);
-            free(nodeNames);
-            fclose(binIn);
+    if(chFile != NULL && openCH(&ch,&graph,chFile) != 0){
+        graph_close(&graph);
+        return 1;
+    }
+    //Hierarchies and matrices are built on the stored costs: a-star and partitions only
+    if(overlayFile != NULL && overlayHolderOpen(&overlay,&graph,overlayFile) != 0){
+        if(options.heuristic == ALT_HEURISTIC)
+            closeLandmarks(&landmarks);
+        graph_close(&graph);
+        return 1;
+    }
+    if(maxTiles > 0 && tilePagerOpen(&pager,&graph,maxTiles) != 0){
+        if(overlayFile != NULL)
+            overlayHolderClose(&overlay);
+        if(options.heuristic == ALT_HEURISTIC)
+            closeLandmarks(&landmarks);
+        graph_close(&graph);
+        return 1;
+    }
+    if(crpFile != NULL){
+        if(openCRP(&crp,&graph,crpFile) != 0){
+            if(overlayFile != NULL)
+                overlayHolderClose(&overlay);
+            if(options.heuristic == ALT_HEURISTIC)
+                closeLandmarks(&landmarks);
+            graph_close(&graph);
             return 1;
+        }
+        gettimeofday(&tval_before,NULL);
+        customizeCRP(&crp,overlayFile != NULL ? overlay.current : NULL,batchOptions.threads);
+        gettimeofday(&tval_after,NULL);
+        timersub(&tval_after,&tval_before,&tval_result);
+        fprintf(stderr,"Customization with %"PRIu32" threads: %ld.%06ld seconds.\n",
+                batchOptions.threads,(long int)tval_result.tv_sec,(long int)tval_result.tv_usec);
     }
 
-    fclose(binIn);
-    
-    //Put node name and successors into each node
-    aux1 = aux2 = 0;
-    for(i=0;i<nNodes;i++){
-        if(nodes[i].nsucc != 0){
-            nodes[i].successors = successors+aux1;
-            aux1 += nodes[i].nsucc;
+    /* Distance matrix: one search per source */
+    if(matrixFile != NULL){
+        opt = 1;
+        if(readIds(argv[optind+1],&sourceIds,&nSources) == 0){
+            if(readIds(argv[optind+2],&targetIds,&nTargets) == 0){
+                matrix = malloc(sizeof(double)*nSources*nTargets); assert(matrix != NULL || nSources*nTargets == 0);
+                computeMatrix(&graph,sourceIds,nSources,targetIds,nTargets,
+                              batchOptions.threads,matrix,&matrixStats);
+                fprintf(stderr,"Matrix: %"PRIu32"x%"PRIu32" (%"PRIu32" unknown ids) in %.3lf s, "
+                               "%"PRIu64" settled nodes, %"PRIu32" threads\n",
+                        nSources,nTargets,matrixStats.unknown,matrixStats.seconds,
+                        matrixStats.settled,batchOptions.threads);
+                opt = writeMatrix(matrix,nSources,nTargets,matrixFile);
+                free(matrix);
+                free(targetIds);
+            }
+            free(sourceIds);
         }
-        nodes[i].name = nodeNames+aux2;
-        aux2 += 1+strlen(nodeNames+aux2);
+        if(chFile != NULL)
+            closeCH(&ch);
+        if(options.heuristic == ALT_HEURISTIC)
+            closeLandmarks(&landmarks);
+        graph_close(&graph);
+        return opt;
     }
+
+    /* Batch of pairs: load once, answer all, report throughput */
+    if(batchFile != NULL){
+        batchF = strcmp(batchFile,"-") == 0 ? stdin : fopen(batchFile,"r");
+        if(batchF == NULL){
+            fprintf(stderr,"Could not open pairs file %s.\n",batchFile);
+            opt = 1;
+        }else{
+            batchOptions.ch = chFile != NULL ? &ch : NULL;
+            batchOptions.overlay = overlayFile != NULL ? &overlay : NULL;
+            batchOptions.crp = crpFile != NULL ? &crp : NULL;
+            batchOptions.tiles = maxTiles > 0 ? &pager : NULL;
+            opt = runBatch(&graph,&options,&batchOptions,batchF,stdout,&batchStats);
+            if(batchF != stdin)
+                fclose(batchF);
+            fprintf(stderr,"Batch: %"PRIu64" queries (%"PRIu64" found, %"PRIu64" unknown ids) in %.3lf s, %.1lf queries/s\n"
+                            "%"PRIu32" threads, %"PRIu64" steals\n",
+                    batchStats.queries,batchStats.found,batchStats.unknown,batchStats.seconds,
+                    batchStats.seconds > 0. ? batchStats.queries/batchStats.seconds : 0.,
+                    batchOptions.threads,batchStats.steals);
+            if(maxTiles > 0)
+                fprintf(stderr,"Tiles: %"PRIu64" faults, %"PRIu64" evictions, at most %"PRIu32" of %"PRIu32" resident\n",
+                        pager.faults,pager.evictions,pager.capacity,graph.nTiles);
+        }
+        if(chFile != NULL)
+            closeCH(&ch);
+        if(crpFile != NULL)
+            closeCRP(&crp);
+        if(maxTiles > 0)
+            tilePagerClose(&pager);
+        if(overlayFile != NULL)
+            overlayHolderClose(&overlay);
+        if(options.heuristic == ALT_HEURISTIC)
+            closeLandmarks(&landmarks);
+        graph_close(&graph);
+        return opt;
+    }
+    
+    phases[PHASE_LOAD] = lapTime(&lap);
     
     /* Find initial and target nodes */
-    startNode = findNode(nodes,nNodes,startId);
-    if(startNode == -1){
+    startNode = findNode(&graph,startId);
+    if(startNode == UINT32_MAX){
         fprintf(stderr,"ERROR: Start node not found in graph.\n");
         return -1;
     }else
         fprintf(stderr,"Starting node found in position %"PRIu32".\n",startNode);
-    targetNode = findNode(nodes,nNodes,targetId);
-    if(targetNode == -1){
+    targetNode = findNode(&graph,targetId);
+    if(targetNode == UINT32_MAX){
         fprintf(stderr,"ERROR: Target node not found in graph.\n");
         return -2;
     }else
         fprintf(stderr,"Target node found in position %"PRIu32".\n",targetNode);
-    /* Initiate status */
-    status = malloc(sizeof(AStarStatus_t)*nNodes); assert(status);
-    for(i=0; i<nNodes;i++)
-        status[i].whq = NONE;
+    phases[PHASE_LOOKUP] = lapTime(&lap);
+    /* Contraction hierarchy or partition query */
+    if(chFile != NULL || crpFile != NULL){
+        if(chFile != NULL)
+            chWorkspaceCreate(&chWs,graph.nNodes);
+        else
+            crpWorkspaceCreate(&crpWs,&crp);
+        gettimeofday(&tval_before,NULL);
+        if(chFile != NULL)
+            found = chQuery(&ch,&chWs,startNode,targetNode) == 0;
+        else
+            found = crpQuery(&crp,&crpWs,startNode,targetNode) == 0;
+        gettimeofday(&tval_after,NULL);
+        timersub(&tval_after,&tval_before,&tval_result);
+        lap = tval_after;
+        phases[PHASE_SEARCH] = tval_result.tv_sec+1e-6*tval_result.tv_usec;
+        path = chFile != NULL ? chWs.path : crpWs.path;
+        pathDist = chFile != NULL ? chWs.pathDist : crpWs.pathDist;
+        pathLen = chFile != NULL ? chWs.pathLen : crpWs.pathLen;
+        settled = chFile != NULL ? chWs.settled : crpWs.settled;
+        distance = chFile != NULL ? (found ? pathDist[pathLen-1] : 0.) : crpWs.distance;
+        if(found)
+            fprintf(stderr,"Solution found, with distance %lf\n",distance);
+        else
+            fprintf(stderr,"ERROR: No path was found\n");
+        if(!json){
+            fprintf(stdout,"Time of algorithm: %2ld.%06ld\n",
+                    (long int)tval_result.tv_sec,(long int)tval_result.tv_usec);
+            fprintf(stdout,"Settled nodes: %"PRIu64" forward, %"PRIu64" backward\n",
+                    settled[0],settled[1]);
+        }
+
+        //Print solution
+        solutionF = found ? fopen("solution.dat","w") : NULL;
+        if(solutionF != NULL){
+            for(i=pathLen; i>0; i--)
+                fprintf(solutionF,"Node id: %10"PRIu32" | Distance: %10.2lf | Name: %s\n",
+                        graph.ids[path[i-1]],pathDist[i-1],
+                        graph_name(&graph,path[i-1]));
+            fclose(solutionF);
+        }else if(found){
+            fprintf(stderr,"Could not create solution file\n");
+        }
+        phases[PHASE_OUTPUT] = lapTime(&lap);
+        if(json){
+            memset(chStats,0,sizeof(chStats));
+            chStats[0].expanded = settled[0];
+            chStats[1].expanded = settled[1];
+            printQueryJSON(stdout,startId,targetId,found,
+                           found ? distance : 0.,
+                           found ? pathLen : 0,phases,chStats);
+        }
+        if(chFile != NULL){
+            chWorkspaceFree(&chWs);
+            closeCH(&ch);
+        }else{
+            crpWorkspaceFree(&crpWs);
+            closeCRP(&crp);
+        }
+        if(overlayFile != NULL)
+            overlayHolderClose(&overlay);
+        if(options.heuristic == ALT_HEURISTIC)
+            closeLandmarks(&landmarks);
+        graph_close(&graph);
+        return 0;
+    }
 
     /* A-star algorithm */
+    aStarContextCreate(&ctx,&graph,&options);
+    if(overlayFile != NULL)
+        ctx.overlay = overlay.current;
+    if(maxTiles > 0){
+        ctx.tiles = &pager;
+        tilePagerTrim(&pager);
+    }
     gettimeofday(&tval_before,NULL);
-    if(aStarAlgorithm(nodes,status,nNodes,startNode,targetNode) == 0){
-        fprintf(stderr,"Solution found, with distance %lf\n",status[targetNode].g);
+    found = aStarAlgorithm(&ctx,startNode,targetNode) == 0;
+    gettimeofday(&tval_after,NULL);
+    timersub(&tval_after,&tval_before,&tval_result);
+    lap = tval_after;
+    phases[PHASE_SEARCH] = tval_result.tv_sec+1e-6*tval_result.tv_usec;
+    if(found){
+        fprintf(stderr,"Solution found, with distance %lf\n",ctx.distance);
     }else{
         fprintf(stderr,"ERROR: No path was found\n");
     }
-    gettimeofday(&tval_after,NULL);
-    timersub(&tval_after,&tval_before,&tval_result);
-    fprintf(stdout,"Time of algorithm: %2ld.%06ld\n",
-            (long int)tval_result.tv_sec,(long int)tval_result.tv_usec);
+    if(!json){
+        fprintf(stdout,"Time of algorithm: %2ld.%06ld\n",
+                (long int)tval_result.tv_sec,(long int)tval_result.tv_usec);
+        if(options.bidirectional)
+            fprintf(stdout,"Expanded nodes: %"PRIu64" forward, %"PRIu64" backward\n",
+                    ctx.stats[0].expanded,ctx.stats[1].expanded);
+        else
+            fprintf(stdout,"Expanded nodes: %"PRIu64" (%.1lf ns per expansion)\n",ctx.stats[0].expanded,
+                    ctx.stats[0].expanded ? 1e9*(tval_result.tv_sec+1e-6*tval_result.tv_usec)/ctx.stats[0].expanded : 0.);
+        if(maxTiles > 0)
+            fprintf(stdout,"Tile faults: %"PRIu64" (at most %"PRIu32" of %"PRIu32" tiles resident)\n",
+                    ctx.stats[0].tileFaults+ctx.stats[1].tileFaults,pager.capacity,graph.nTiles);
+    }
+
+    /* Same search computing edge lengths on the fly, to measure the
+       time saved by the stored edge lengths */
+    if(compareEdges){
+        AStarContext_t ctxRecomp;
+        AStarOptions_t optionsRecomp = options;
+        optionsRecomp.edgeCost = HAVERSINE_EDGES;
+        aStarContextCreate(&ctxRecomp,&graph,&optionsRecomp);
+        gettimeofday(&tval_before,NULL);
+        aStarAlgorithm(&ctxRecomp,startNode,targetNode);
+        gettimeofday(&tval_after,NULL);
+        timersub(&tval_after,&tval_before,&tval_recomp);
+        fprintf(stdout,"Time of algorithm recomputing edges: %2ld.%06ld (stored edges save %.1lf%%)\n",
+                (long int)tval_recomp.tv_sec,(long int)tval_recomp.tv_usec,
+                100.*(1.-(tval_result.tv_sec+1e-6*tval_result.tv_usec)/
+                         (tval_recomp.tv_sec+1e-6*tval_recomp.tv_usec)));
+        aStarContextFree(&ctxRecomp);
+        gettimeofday(&lap,NULL);
+    }
 
     //Print solution
-    solutionF = fopen("solution.dat","w");
+    solutionF = found ? fopen("solution.dat","w") : NULL;
     if(solutionF != NULL){
-        aux1 = targetNode;
-        while(aux1 != startNode){
+        for(i=ctx.pathLen; i>0; i--)
             fprintf(solutionF,"Node id: %10"PRIu32" | Distance: %10.2lf | Name: %s\n",
-                    nodes[aux1].id,status[aux1].g,nodes[aux1].name);
-            aux1 = status[aux1].parent;
-        }
-        fprintf(solutionF,"Node id: %10"PRIu32" | Distance: %10.2lf | Name: %s\n",
-                nodes[aux1].id,status[aux1].g,nodes[aux1].name);
+                    graph.ids[ctx.path[i-1]],ctx.pathDist[i-1],
+                    graph_name(&graph,ctx.path[i-1]));
         fclose(solutionF);
-    }else{
+    }else if(found){
         fprintf(stderr,"Could not create solution file\n");
     }
+    phases[PHASE_OUTPUT] = lapTime(&lap);
+    if(json)
+        printQueryJSON(stdout,startId,targetId,found,ctx.distance,ctx.pathLen,
+                       phases,ctx.stats);
 
     //Free memory
-    free(nodes); free(successors); free(nodeNames); free(status);
+    aStarContextFree(&ctx);
+    if(maxTiles > 0)
+        tilePagerClose(&pager);
+    if(overlayFile != NULL)
+        overlayHolderClose(&overlay);
+    if(options.heuristic == ALT_HEURISTIC)
+        closeLandmarks(&landmarks);
+    graph_close(&graph);
     
     return 0;
 }
@@ -0,0 +1,42 @@
+#include "ch.h"
+#include "graph.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[]){
+
+    graph_t graph;
+    ch_t ch;
+
+    /* INPUT */
+    if (argc < 3) {
+          fprintf(stderr,"%s graphname outputname\n",argv[0]);
+          return 1;
+    }
+
+    /* READ GRAPH */
+    if(graph_open(&graph,argv[1]) != 0){
+        fprintf(stderr,"Problems reading graph. Exiting...\n");
+        return 1;
+    }
+
+    /* CONTRACT GRAPH */
+    buildCH(&graph,&ch);
+    fprintf(stderr,"Hierarchy has %"PRIu32" upward and %"PRIu32" downward edges (graph has %"PRIu32").\n",
+            ch.nFwd,ch.nBwd,graph.nEdges);
+
+    /* WRITE HIERARCHY */
+    if(writeCH(&ch,argv[2]) != 0){
+        fprintf(stderr,"Could not write hierarchy file. Program closing...\n");
+        closeCH(&ch);
+        graph_close(&graph);
+        return 1;
+    }
+
+    /* FREE MEMORY */
+    closeCH(&ch);
+    graph_close(&graph);
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "crp.h"
+#include "graph.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]){
+
+    uint32_t cellSize = CRP_CELL_SIZE, fanBits = CRP_FAN_BITS, nThreads = 0, l;
+    struct timeval tval_before, tval_after, tval_result;
+    graph_t graph;
+    crp_t crp;
+    int opt, bad = 0;
+
+    /* INPUT */
+    while((opt = getopt(argc,argv,"s:f:t:")) != -1){
+        switch(opt){
+            case 's':
+                bad |= sscanf(optarg,"%"SCNu32,&cellSize) != 1 || cellSize == 0;
+                break;
+            case 'f':
+                bad |= sscanf(optarg,"%"SCNu32,&fanBits) != 1 || fanBits == 0 || fanBits > 16;
+                break;
+            case 't':
+                bad |= sscanf(optarg,"%"SCNu32,&nThreads) != 1 || nThreads == 0;
+                break;
+            default:
+                bad = 1;
+        }
+    }
+    if (bad || argc-optind < 2) {
+          fprintf(stderr,"%s [-s cellSize] [-f fanBits] [-t threads] graphname outputname\n",argv[0]);
+          return 1;
+    }
+    if(nThreads == 0)
+        nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* READ GRAPH */
+    if(graph_open(&graph,argv[optind]) != 0){
+        fprintf(stderr,"Problems reading graph. Exiting...\n");
+        return 1;
+    }
+
+    /* PARTITION GRAPH */
+    buildCRP(&graph,cellSize,fanBits,&crp);
+    for(l=0; l<crp.nLevels; l++)
+        fprintf(stderr,"Level %"PRIu32": %"PRIu32" cells, %"PRIu32" boundary nodes.\n",
+                l,crp.levels[l].nCells,crp.levels[l].nBoundary);
+
+    //Customize once with the stored weights, to report its time
+    gettimeofday(&tval_before,NULL);
+    customizeCRP(&crp,NULL,nThreads);
+    gettimeofday(&tval_after,NULL);
+    timersub(&tval_after,&tval_before,&tval_result);
+    fprintf(stderr,"Customization with %"PRIu32" threads: %ld.%06ld seconds.\n",
+            nThreads,(long int)tval_result.tv_sec,(long int)tval_result.tv_usec);
+
+    /* WRITE PARTITION */
+    if(writeCRP(&crp,argv[optind+1]) != 0){
+        fprintf(stderr,"Could not write partition file. Program closing...\n");
+        closeCRP(&crp);
+        graph_close(&graph);
+        return 1;
+    }
+
+    /* FREE MEMORY */
+    closeCRP(&crp);
+    graph_close(&graph);
+
+    return 0;
+}
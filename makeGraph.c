@@ -4,113 +4,90 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 int main(int argc, char *argv[]){
     
-    char *line;
-    uint8_t i,commLin;
-    uint32_t nNodes, nWays,j,nSucc,nameLen,maxChar;
+    uint32_t nNodes, nWays, j, nThreads, tileBits = 0;
+    char *separator = "|";
     node_t *nodes;
-    FILE *input, *binOut;
+    graph_t graph, full;
+    int opt, simplify = 0, bad = 0, tiled = 0, ordered = 0;
+    uint8_t order = ORDER_INPUT;
     
     /* INPUT */
-    if (argc < 8
-        || sscanf(argv[4],"%"SCNi8, &commLin)!=1
-        || sscanf(argv[5],"%"SCNi32, &nNodes)!=1
-        || sscanf(argv[6],"%"SCNi32, &nWays)!=1
-        || sscanf(argv[7],"%"SCNi32, &maxChar)!=1
+    while((opt = getopt(argc,argv,"so:T:")) != -1){
+        if(opt == 's')
+            simplify = 1;
+        else if(opt == 'T'){
+            tiled = 1;
+            bad |= sscanf(optarg,"%"SCNu32,&tileBits) != 1 || tileBits > 31;
+        }else if(opt == 'o' && strcmp(optarg,"hilbert") == 0)
+            order = ORDER_HILBERT;
+        else if(opt == 'o' && strcmp(optarg,"bfs") == 0)
+            order = ORDER_BFS;
+        else if(opt != 'o' || strcmp(optarg,"input") != 0)
+            bad = 1;
+        ordered |= opt == 'o';
+    }
+    if (bad || argc-optind < 2
+        || (argc-optind > 3 && (sscanf(argv[optind+3],"%"SCNu32, &nThreads)!=1 || nThreads == 0))
        ) {
-          fprintf(stderr,"%s inputname outputname delim commentedLines numNodes numWays maxChar\n",argv[0]);
+          fprintf(stderr,"%s [-s] [-o input|hilbert|bfs] [-T tileBits] inputname outputname [delim] [threads]\n",argv[0]);
           return 1;
     }
-    
-    //Open file
-    input = fopen(argv[1],"r");
-    if(input == NULL){
-        fprintf(stderr,"Error: file with inputname not found.\n");
-        return 1;
-    }
-
-    /* MEMORY ALLOC */
-    line = malloc(sizeof(char)*maxChar+1); assert(line);
-    nodes = malloc(sizeof(node_t)*nNodes); assert(nodes);
+    if(argc-optind > 2)
+        separator = argv[optind+2];
+    if(argc-optind <= 3)
+        nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    //Tiles are compact regions along a Hilbert curve
+    if(tiled && !ordered)
+        order = ORDER_HILBERT;
 
 
     /* MAKE GRAPH */
-    //Skip comment lines
-    for(i=0; i<commLin; i++)
-        fgets(line,maxChar,input);
-
-    //Read nodes
-    for(j=0; j<nNodes; j++){
-        fgets(line,maxChar,input);
-        nodes[j] = load_node(line,argv[3]);
-    }
-    
-    //Read ways
-    for(j=0; j<nWays; j++){
-        fgets(line,maxChar,input);
-        add_way(nodes,nNodes,line,argv[3]);
+    //Read nodes and ways, in parallel chunks of the file
+    if(read_csv(argv[optind],separator,nThreads,&nodes,&nNodes,&nWays) != 0){
+        fprintf(stderr,"Error: file with inputname not found.\n");
+        return 1;
     }
-    
-    fclose(input);
+    fprintf(stderr,"Read %"PRIu32" nodes and %"PRIu32" ways.\n",nNodes,nWays);
 
     /* WRITE GRAPH INTO BINARY FILE */
-    nSucc = nameLen = 0;
-    //Compute total successors and name lenghts
+    build_graph(&graph,nodes,nNodes);
     for(j=0; j<nNodes; j++){
-        nSucc += nodes[j].nsucc;
-        nameLen += strlen(nodes[j].name)+1;
-    }
-    
-    //Write header
-    binOut = fopen(argv[2],"wb");
-    if(binOut==NULL){
-        fprintf(stderr,"Could not create output binary file. Program closing...\n");
-        return 1;
+        free(nodes[j].successors);
+        free(nodes[j].name);
     }
-    if((fwrite(&nNodes,sizeof(uint32_t),1,binOut)+
-        fwrite(&nSucc,sizeof(uint32_t),1,binOut)+
-        fwrite(&nameLen,sizeof(uint32_t),1,binOut)) != 3){
-            fprintf(stderr,"Could not print header into binary file. Program closing...\n");
-            fclose(binOut);
-            return -1;
+    //Contract the chains of nodes into single edges
+    if(simplify){
+        full = graph;
+        simplify_graph(&full,&graph);
+        fprintf(stderr,"Simplified to %"PRIu32" of %"PRIu32" nodes and %"PRIu32" of %"PRIu32" edges.\n",
+                graph.nKept,full.nNodes,graph.nEdges,full.nEdges);
+        graph_close(&full);
     }
-    
-    //Write nodes
-    if(fwrite(nodes,sizeof(node_t),nNodes,binOut)!= nNodes){
-        fprintf(stderr,"Could not write nodes into binary file. Program closing...\n");
-        fclose(binOut);
-        return -1;
+    //Number the nodes so neighbours are close in memory
+    if(order != ORDER_INPUT){
+        full = graph;
+        reorder_graph(&full,order,&graph);
+        graph_close(&full);
     }
-    
-    //Write successors and free successor vectors
-    for(j=0; j<nNodes; j++){
-        if(nodes[j].nsucc != 0){
-            if(fwrite(nodes[j].successors,sizeof(uint32_t),nodes[j].nsucc,binOut) != nodes[j].nsucc){
-                fprintf(stderr,"Could not write successors into binary file. Program closing...\n");
-                fclose(binOut);
-                return -1;
-            }
-        }
-        free(nodes[j].successors);
+    //Split it into tiles of 2^tileBits nodes
+    if(tiled){
+        graph_tile(&graph,tileBits);
+        fprintf(stderr,"Split into %"PRIu32" tiles with %"PRIu32" boundary edges.\n",
+                graph.nTiles,graph.tiles[graph.nTiles].firstBoundary);
     }
-    
-    //Write names and free node names
-    for(j=0; j<nNodes; j++){
-        if((fwrite(nodes[j].name,sizeof(char),strlen(nodes[j].name),binOut)+
-            fwrite("\0",sizeof(char),1,binOut)) != (strlen(nodes[j].name)+1)){
-                fprintf(stderr,"Could not write node names into binary file. Program closing...\n");
-                fclose(binOut);
-                return -1;
-        }
-        free(nodes[j].name);
+    if(graph_write(&graph,argv[optind+1]) != 0){
+        fprintf(stderr,"Could not write graph into binary file. Program closing...\n");
+        graph_close(&graph);
+        return -1;
     }
 
     /* FREE MEMORY */
-    fclose(binOut);
-    
-    free(nodes); free(line);
+    graph_close(&graph);
+    free(nodes);
     
     return 0;
 }
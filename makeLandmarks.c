@@ -0,0 +1,44 @@
+#include "graph.h"
+#include "landmarks.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[]){
+
+    uint32_t nLandmarks, seed = 1;
+    graph_t graph;
+    landmarks_t landmarks;
+
+    /* INPUT */
+    if (argc < 4
+        || sscanf(argv[3],"%"SCNu32, &nLandmarks)!=1 || nLandmarks == 0
+        || (argc > 4 && sscanf(argv[4],"%"SCNu32, &seed)!=1)
+       ) {
+          fprintf(stderr,"%s graphname outputname numLandmarks [seed]\n",argv[0]);
+          return 1;
+    }
+
+    /* READ GRAPH */
+    if(graph_open(&graph,argv[1]) != 0){
+        fprintf(stderr,"Problems reading graph. Exiting...\n");
+        return 1;
+    }
+
+    /* SELECT LANDMARKS AND COMPUTE DISTANCE TABLES */
+    computeLandmarks(&graph,nLandmarks,seed,&landmarks);
+
+    /* WRITE TABLES INTO SIDECAR FILE */
+    if(writeLandmarks(&landmarks,argv[2]) != 0){
+        fprintf(stderr,"Could not write landmarks file. Program closing...\n");
+        closeLandmarks(&landmarks);
+        graph_close(&graph);
+        return 1;
+    }
+
+    /* FREE MEMORY */
+    closeLandmarks(&landmarks);
+    graph_close(&graph);
+
+    return 0;
+}
@@ -0,0 +1,237 @@
+#include "matrix.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/*State shared by the threads of a matrix computation */
+typedef struct matrixShared_s{
+    const graph_t *graph;
+    const uint32_t *sources;    //Position of each source, UINT32_MAX if unknown
+    const uint8_t *isTarget;    //Flag of the target nodes
+    uint32_t nDistinct;         //Number of distinct target nodes
+    const uint32_t *columns;    //Position of each target, UINT32_MAX if unknown
+    uint32_t nSources, nTargets;
+    double *matrix;             //Output distances
+    pthread_mutex_t lock;       //Protects next
+    uint32_t next;              //Next row to compute
+} matrixShared_t;
+
+/*Search memory of a thread */
+typedef struct matrixWorker_s{
+    matrixShared_t *shared;
+    AStarContext_t ctx;
+    uint64_t settled;           //Nodes settled by the thread
+    pthread_t thread;
+} matrixWorker_t;
+
+/*  READIDS
+ *
+ *  Reads a list of node ids, one per line. Empty lines and lines
+ *  starting with '#' are skipped.
+ *
+ *  Input:
+ *      filename: name of the input file.
+ *      ids: output vector of ids, allocated.
+ *      nIds: number of ids read.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int readIds(const char *filename, uint32_t **ids, uint32_t *nIds){
+    FILE *fin;
+    char line[64], *p;
+    uint32_t cap = 1024;
+
+    fin = fopen(filename,"r");
+    if(fin == NULL){
+        fprintf(stderr,"Could not open ids file %s.\n",filename);
+        return 1;
+    }
+    *nIds = 0;
+    *ids = malloc(sizeof(uint32_t)*cap); assert(*ids);
+    while(fgets(line,sizeof(line),fin) != NULL){
+        p = line+strspn(line," \t\r\n");
+        if(*p == '\0' || *p == '#')
+            continue;
+        if(*nIds == cap){
+            cap *= 2;
+            *ids = realloc(*ids,sizeof(uint32_t)*cap); assert(*ids);
+        }
+        if(sscanf(p,"%"SCNu32,*ids+*nIds) != 1){
+            fprintf(stderr,"ERROR: Can not parse id in %s.\n",filename);
+            free(*ids);
+            fclose(fin);
+            return 1;
+        }
+        (*nIds)++;
+    }
+    fclose(fin);
+    return 0;
+}
+
+/*  MATRIXWORKER
+ *
+ *  Thread loop: takes the next row to compute until none is left.
+ *
+ *  Input:
+ *      arg: matrixWorker_t of the thread.
+ *
+ *  Return: NULL.
+ */
+static void *matrixWorker(void *arg){
+    matrixWorker_t *worker = arg;
+    matrixShared_t *shared = worker->shared;
+    double *row;
+    uint32_t i, j;
+
+    for(;;){
+        pthread_mutex_lock(&shared->lock);
+        i = shared->next < shared->nSources ? shared->next++ : UINT32_MAX;
+        pthread_mutex_unlock(&shared->lock);
+        if(i == UINT32_MAX)
+            break;
+        row = shared->matrix+(size_t)i*shared->nTargets;
+        if(shared->sources[i] == UINT32_MAX){
+            for(j=0; j<shared->nTargets; j++)
+                row[j] = -1.;
+            continue;
+        }
+        aStarOneToMany(&worker->ctx,shared->sources[i],shared->isTarget,
+                       shared->nDistinct,shared->columns,shared->nTargets,row);
+        worker->settled += worker->ctx.stats[0].expanded;
+    }
+    return NULL;
+}
+
+/*  COMPUTEMATRIX
+ *
+ *  Computes the distances from every source to every target. Each
+ *  source is searched once, settling nodes until all the targets are
+ *  settled. Sources are shared out dynamically between threads, each
+ *  with its own search context.
+ *
+ *  Input:
+ *      graph: graph to search.
+ *      sourceIds, nSources: ids of the rows.
+ *      targetIds, nTargets: ids of the columns.
+ *      threads: number of threads.
+ *      matrix: output of nSources*nTargets distances, row by row,
+ *              -1 for unreachable pairs or unknown ids.
+ *      stats: counters of the computation, filled if not NULL.
+ */
+void computeMatrix(const graph_t *graph, const uint32_t *sourceIds,
+                   uint32_t nSources, const uint32_t *targetIds,
+                   uint32_t nTargets, uint32_t threads, double *matrix,
+                   matrixStats_t *stats){
+    matrixShared_t shared;
+    matrixWorker_t *workers;
+    AStarOptions_t options = {HEAP_QUEUE, STORED_EDGES, HAVERSINE_HEURISTIC, NULL, 0};
+    uint32_t *sources, *columns, i, ends[2];
+    uint8_t *isTarget, e;
+    double offsets[2];
+    matrixStats_t count = {0, 0, 0.};
+    struct timeval tval_before, tval_after, tval_result;
+
+    if(threads == 0)
+        threads = 1;
+    sources = malloc(sizeof(uint32_t)*nSources); assert(sources != NULL || nSources == 0);
+    columns = malloc(sizeof(uint32_t)*nTargets); assert(columns != NULL || nTargets == 0);
+    isTarget = calloc(graph->nNodes,sizeof(uint8_t)); assert(isTarget != NULL || graph->nNodes == 0);
+    shared.nDistinct = 0;
+    for(i=0; i<nSources; i++)
+        if((sources[i] = findNode(graph,sourceIds[i])) == UINT32_MAX)
+            count.unknown++;
+    for(i=0; i<nTargets; i++){
+        columns[i] = findNode(graph,targetIds[i]);
+        if(columns[i] == UINT32_MAX)
+            count.unknown++;
+        else
+            //The search settles the ends of the target (see graph_ends)
+            for(e=graph_ends(graph,columns[i],1,ends,offsets); e>0; e--)
+                if(!isTarget[ends[e-1]]){
+                    isTarget[ends[e-1]] = 1;
+                    shared.nDistinct++;
+                }
+    }
+    shared.graph = graph;
+    shared.sources = sources;
+    shared.isTarget = isTarget;
+    shared.columns = columns;
+    shared.nSources = nSources;
+    shared.nTargets = nTargets;
+    shared.matrix = matrix;
+    shared.next = 0;
+    pthread_mutex_init(&shared.lock,NULL);
+
+    workers = calloc(threads,sizeof(matrixWorker_t)); assert(workers);
+    for(i=0; i<threads; i++){
+        workers[i].shared = &shared;
+        aStarContextCreate(&workers[i].ctx,graph,&options);
+    }
+    gettimeofday(&tval_before,NULL);
+    for(i=1; i<threads; i++)
+        if(pthread_create(&workers[i].thread,NULL,matrixWorker,&workers[i]) != 0){
+            fprintf(stderr,"ERROR: Can not create thread.\n");
+            exit(1);
+        }
+    matrixWorker(&workers[0]);
+    for(i=1; i<threads; i++)
+        pthread_join(workers[i].thread,NULL);
+    gettimeofday(&tval_after,NULL);
+    timersub(&tval_after,&tval_before,&tval_result);
+    count.seconds = tval_result.tv_sec+1e-6*tval_result.tv_usec;
+
+    for(i=0; i<threads; i++){
+        count.settled += workers[i].settled;
+        aStarContextFree(&workers[i].ctx);
+    }
+    pthread_mutex_destroy(&shared.lock);
+    free(workers);
+    free(isTarget);
+    free(columns);
+    free(sources);
+    if(stats != NULL)
+        *stats = count;
+}
+
+/*  WRITEMATRIX
+ *
+ *  Writes a distance matrix into a file.
+ *
+ *  Input:
+ *      matrix: nSources*nTargets distances, row by row.
+ *      nSources, nTargets: size of the matrix.
+ *      filename: name of the output file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int writeMatrix(const double *matrix, uint32_t nSources, uint32_t nTargets,
+                const char *filename){
+    matrixHeader_t header;
+    FILE *binOut;
+    size_t size = (size_t)nSources*nTargets;
+
+    header.magic = MATRIX_MAGIC;
+    header.version = MATRIX_VERSION;
+    header.nSources = nSources;
+    header.nTargets = nTargets;
+    binOut = fopen(filename,"wb");
+    if(binOut == NULL){
+        fprintf(stderr,"Could not create matrix file.\n");
+        return 1;
+    }
+    if(fwrite(&header,sizeof(matrixHeader_t),1,binOut) != 1 ||
+       fwrite(matrix,sizeof(double),size,binOut) != size){
+        fprintf(stderr,"Could not write matrix file.\n");
+        fclose(binOut);
+        return 1;
+    }
+    if(fclose(binOut) != 0){
+        fprintf(stderr,"Could not close matrix file.\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "aStar.h"
+#include "graph.h"
+#include <inttypes.h>
+#include <stdio.h>
+
+#define MATRIX_MAGIC 0x5852544d     //"MTRX" in little endian
+#define MATRIX_VERSION 1
+
+/*Header of a distance matrix file, followed by the nSources*nTargets
+ *distances (double) row by row, -1 for unreachable pairs or unknown ids */
+typedef struct matrixHeader_s{
+    uint32_t magic;         //MATRIX_MAGIC
+    uint32_t version;       //MATRIX_VERSION
+    uint32_t nSources;      //Rows
+    uint32_t nTargets;      //Columns
+} matrixHeader_t;
+
+/*Counters of a matrix computation */
+typedef struct matrixStats_s{
+    uint64_t settled;       //Nodes settled by all searches
+    uint32_t unknown;       //Ids not in the graph
+    double seconds;         //Wall time of the searches
+} matrixStats_t;
+
+/*  READIDS
+ *
+ *  Reads a list of node ids, one per line. Empty lines and lines
+ *  starting with '#' are skipped.
+ *
+ *  Input:
+ *      filename: name of the input file.
+ *      ids: output vector of ids, allocated.
+ *      nIds: number of ids read.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int readIds(const char *filename, uint32_t **ids, uint32_t *nIds);
+
+/*  COMPUTEMATRIX
+ *
+ *  Computes the distances from every source to every target. Each
+ *  source is searched once, settling nodes until all the targets are
+ *  settled. Sources are shared out dynamically between threads, each
+ *  with its own search context.
+ *
+ *  Input:
+ *      graph: graph to search.
+ *      sourceIds, nSources: ids of the rows.
+ *      targetIds, nTargets: ids of the columns.
+ *      threads: number of threads.
+ *      matrix: output of nSources*nTargets distances, row by row,
+ *              -1 for unreachable pairs or unknown ids.
+ *      stats: counters of the computation, filled if not NULL.
+ */
+void computeMatrix(const graph_t *graph, const uint32_t *sourceIds,
+                   uint32_t nSources, const uint32_t *targetIds,
+                   uint32_t nTargets, uint32_t threads, double *matrix,
+                   matrixStats_t *stats);
+
+/*  WRITEMATRIX
+ *
+ *  Writes a distance matrix into a file.
+ *
+ *  Input:
+ *      matrix: nSources*nTargets distances, row by row.
+ *      nSources, nTargets: size of the matrix.
+ *      filename: name of the output file.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int writeMatrix(const double *matrix, uint32_t nSources, uint32_t nTargets,
+                const char *filename);
@@ -1,85 +1,139 @@
 #include "mkGr.h"
+#include "aStar.h"
+#include "myFunctions.h"
 #include <string.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 
-/*  strtok_single
+/*  tok_init
 
-    strtok manual implementation where zero string elements are
-    taken into account.
+    Starts the tokenization of a line. The line is not modified and
+    needs no terminating '\0': fields are returned as views into it.
+    The tokenizer keeps all its state, so any number of lines can be
+    tokenized at the same time.
 
     Variables:
-        -str = Input string to find next delims.
-        -delims = string to separate the input.
-    
-    Return value:
-        Pointer to next start of word, modifiying the delims
-        character by '\0' character.
+        -tok = tokenizer to initialize.
+        -line = first character of the line.
+        -end = end of the line (after its last character).
+        -delims = characters separating the fields ('\0' terminated).
  */
-char * strtok_single (char * str, char const * delims){
+void tok_init(tokenizer_t *tok, const char *line, const char *end, const char *delims){
+    tok->pos = line;
+    tok->end = end;
+    tok->delims = delims;
+}
 
-    static char  * src = NULL;
-    char  *  p,  * ret = 0;
 
-    if (str != NULL)
-        src = str;
+/*  tok_next
 
-    if (src == NULL)
-        return NULL;
+    Returns the next field of the line. As strtok_single did, empty
+    fields between two consecutive delimiters are returned, but a
+    delimiter at the end of the line does not add an empty field.
 
-    if ((p = strpbrk (src, delims)) != NULL) {
-        *p  = 0;
-        ret = src;
-        src = ++p;
+    Variables:
+        -tok = tokenizer of the line.
+        -field = output view of the field.
 
-    } else if (*src) {
-        ret = src;
-        src = NULL;
-    }
+    Return value:
+        1 if a field was returned, 0 at the end of the line.
+ */
+int tok_next(tokenizer_t *tok, field_t *field){
+    const char *p = tok->pos;
 
-    return ret;
+    if(p >= tok->end)
+        return 0;
+    if(tok->delims[0] != '\0' && tok->delims[1] == '\0')
+        p = memchr(p,tok->delims[0],tok->end-p);
+    else{
+        while(p < tok->end && strchr(tok->delims,*p) == NULL)
+            p++;
+        if(p == tok->end)
+            p = NULL;
+    }
+    field->str = tok->pos;
+    if(p != NULL){
+        field->len = p-tok->pos;
+        tok->pos = p+1;
+    }else{
+        field->len = tok->end-tok->pos;
+        tok->pos = tok->end;
+    }
+    return 1;
 }
 
 
-/*  sep_line
+/*  field_u32
 
-    Given an input string (line) and a string of characters for separation
-    (separatos), it separates the line and puts each string in a vector
-    of strings (elements). It also computes the number of elements (n).
-
-    Important: The line is useless after this function, so make sure to
-    first make a copy if needed.
+    Reads a decimal unsigned integer from a field.
 
     Variables:
-        -line = Input string to be separated.
-        -separators = Characters to separate the string.
-        -elements = Output vector of strings.
-        -n = number of elements obtained.
- 
+        -field = field to read.
+        -value = output value.
+
+    Return value:
+        1 if the field starts with a digit, 0 otherwise.
  */
-void sep_line(char *line, char *separators, char ***elements, uint32_t *n){
-    char *token;
+int field_u32(field_t field, uint32_t *value){
+    uint32_t i = 0;
 
-    *n = 0;
-    *elements = (char **) malloc(sizeof(char *)); assert(*elements);
+    while(i < field.len && (field.str[i] == ' ' || field.str[i] == '\t'))
+        i++;
+    if(i == field.len || field.str[i] < '0' || field.str[i] > '9')
+        return 0;
+    *value = 0;
+    for(; i < field.len && field.str[i] >= '0' && field.str[i] <= '9'; i++)
+        *value = 10*(*value)+(field.str[i]-'0');
+    return 1;
+}
 
-    token = strtok_single(line,separators);
 
-    while(token != NULL){
-        (*n)++;
-        *elements = (char **) realloc(*elements,sizeof(char *)*(*n));assert(*elements);
-        (*elements)[(*n)-1]  = (char *) malloc(sizeof(char)*strlen(token)+1);assert((*elements)[(*n)-1]);
-        strcpy((*elements)[(*n)-1],token);
-        token = strtok_single(NULL,separators);
-    }
+/*  field_double
+
+    Reads a floating point number from a field.
+
+    Variables:
+        -field = field to read.
 
+    Return value:
+        value of the field, 0 if it is not a number.
+ */
+double field_double(field_t field){
+    char buffer[64];
+    uint32_t len = field.len < sizeof(buffer)-1 ? field.len : sizeof(buffer)-1;
+
+    //Copy, since the field is not terminated
+    memcpy(buffer,field.str,len);
+    buffer[len] = '\0';
+    return strtod(buffer,NULL);
 }
 
 
+/*  field_is
+
+    Compares a field with a string.
+
+    Variables:
+        -field = field to compare.
+        -str = '\0' terminated string.
+
+    Return value:
+        1 if they are equal, 0 otherwise.
+ */
+int field_is(field_t field, const char *str){
+    return strlen(str) == field.len && memcmp(field.str,str,field.len) == 0;
+}
 
 
 /*  load_node
@@ -93,62 +147,46 @@ void sep_line(char *line, char *separators, char ***elements, uint32_t *n){
 
     Variables:
         -line = Input line with node data.
+        -end = end of the line.
         -separator = string to separate the input.
     
     Return value:
         node filled with the data of the line
  */
-node_t load_node(char *line, char *separator){
-    char **elements;
-    uint32_t i,n;
+node_t load_node(const char *line, const char *end, const char *separator){
+    tokenizer_t tok;
+    field_t field;
+    uint32_t i;
     node_t node;
 
-    sep_line(line,separator, &elements,&n);
-    
-    sscanf(elements[1],"%"SCNi32,&node.id); // node ID
-
-    node.name = (char *) malloc(strlen(elements[2])+1);
-    strcpy(node.name,elements[2]); // node name (if available)
-    
-    sscanf(elements[9],"%lf",&node.lat); //node latitude
-    sscanf(elements[10],"%lf",&node.lon); //node longitude
+    node.id = 0;
+    node.name = NULL;
+    node.lat = node.lon = 0.;
+    tok_init(&tok,line,end,separator);
+    for(i=0; i<=10 && tok_next(&tok,&field); i++){
+        if(i == 1)
+            field_u32(field,&node.id); // node ID
+        else if(i == 2){
+            node.name = (char *) malloc(field.len+1); assert(node.name);
+            memcpy(node.name,field.str,field.len); // node name (if available)
+            node.name[field.len] = '\0';
+        }else if(i == 9)
+            node.lat = field_double(field); //node latitude
+        else if(i == 10)
+            node.lon = field_double(field); //node longitude
+    }
+    if(node.name == NULL){
+        node.name = (char *) malloc(1); assert(node.name);
+        node.name[0] = '\0';
+    }
 
     node.nsucc = 0; //initiate number of successors
 
     node.successors = (uint32_t *) malloc(sizeof(uint32_t)*2);assert(node.successors);
 
-    //Free memory
-    for(i=0; i<n; i++)
-        free(elements[i]);
-
-    free(elements);
-
     return node;
 } 
 
-/*  compare_id
-
-    Compares the id's of two nodes. It is implemented to use bsearch
-    from <stdlib.h>. 
-
-    Variables:
-        -node1 = pointer to first node.
-        -node2 = pointer to second node.
-    
-    Return value:
-        -1 if id_1 < id_2
-        0  if id_1 == id_2
-        1  if id_1 > id_2
- */
- 
-int compare_id(const void *node1, const void *node2){
-    uint32_t id_1 = ((node_t *) node1)->id;
-    uint32_t id_2 = ((node_t *) node2)->id;
-    return id_1 < id_2 ? -1: (id_1 > id_2 ? 1 : 0);
-}
-
-
-
 /*  add_succ
 
     Adds a successor to a node, changing the size of the
@@ -159,7 +197,7 @@ int compare_id(const void *node1, const void *node2){
         -vPos = position in the node vector.
  */
 void add_succ(node_t *node, uint32_t vPos){
-    uint8_t i;
+    uint32_t i;
 
     /* To not add duplicates */
     for(i=0; i< node->nsucc; i++)
@@ -180,57 +218,907 @@ void add_succ(node_t *node, uint32_t vPos){
 }
 
 
-/*  add_way
+/*  push_edge
+
+    Appends an edge to an edge buffer, growing it if needed.
+
+    Variables:
+        -edges = buffer to modify.
+        -from = position of the origin node.
+        -to = position of the destination node.
+ */
+static void push_edge(edge_buffer_t *edges, uint32_t from, uint32_t to){
+    if(edges->n == edges->cap){
+        edges->cap = edges->cap ? 2*edges->cap : 1024;
+        edges->edges = realloc(edges->edges,sizeof(uint32_t)*2*edges->cap);
+        assert(edges->edges);
+    }
+    edges->edges[2*edges->n] = from;
+    edges->edges[2*edges->n+1] = to;
+    edges->n++;
+}
+
+
+/*  way_edges
 
     Computes for a way the nodes appearing in it, their position in the node
-    vector, and depending of oneway or twoway, adds the edges to the nodes.
+    vector, and depending of oneway or twoway, appends its edges to a
+    buffer in the order they have to be added to the nodes.
     
     Variables:
-        -nodes = vector of nodes.
-        -nnodes = number of nodes.
+        -index, pos = id index of the nodes (see id_index_build).
+        -nNodes = number of nodes.
         -line = string of the way line.
+        -end = end of the line.
         -separator = string to delimite the columns of the line.
+        -edges = buffer of edges to append to.
  */
-void add_way(node_t *nodes, uint32_t nNodes, char *line, char *separator){
-    uint32_t n, i, nnInWay = 0;
-    uint32_t *nPos;
-    node_t auxNode, *p;
-    char **elements;
-    
-    //Separate line into elements by separator character
-    sep_line(line,separator, &elements,&n);
-    
-    /* There has to be more than one node in the way */
-    if(n > 10){
-        nPos = (uint32_t *) malloc(sizeof(uint32_t)*(n-9));assert(nPos);
-        /* Find node positions in the node vector from their id's */
-        for(i=9; i<n; i++){
-            sscanf(elements[i],"%"SCNi32,&auxNode.id);
-            p = (node_t *) bsearch(&auxNode, nodes, nNodes,sizeof(node_t),compare_id);
-            /* If found in our nodes */
-            if(p != NULL){
-                nPos[nnInWay] = (p-nodes);
-                nnInWay++;
+void way_edges(const uint32_t *index, const uint32_t *pos, uint32_t nNodes,
+               const char *line, const char *end, const char *separator,
+               edge_buffer_t *edges){
+    tokenizer_t tok;
+    field_t field;
+    uint32_t i, id, node, prev = UINT32_MAX;
+    uint8_t oneway = 0;
+
+    tok_init(&tok,line,end,separator);
+    for(i=0; tok_next(&tok,&field); i++){
+        if(i == 7)
+            oneway = field_is(field,"oneway");
+        if(i < 9 || !field_u32(field,&id))
+            continue;
+        /* Find node position in the node vector from its id */
+        node = id_index_find(index,pos,nNodes,id);
+        /* If found in our nodes, join it to the previous one */
+        if(node == UINT32_MAX)
+            continue;
+        if(prev != UINT32_MAX){
+            push_edge(edges,prev,node);
+            /* Twoway way */
+            if(!oneway)
+                push_edge(edges,node,prev);
+        }
+        prev = node;
+    }
+}
+
+
+/*  line_type
+
+    Kind of a line of the csv file, from its first field.
+
+    Variables:
+        -line = first character of the line.
+        -end = end of the line.
+        -separator = string to delimite the columns of the line.
+
+    Return value:
+        CSV_NODE, CSV_WAY or CSV_OTHER (comments, relations...).
+ */
+static uint8_t line_type(const char *line, const char *end, const char *separator){
+    tokenizer_t tok;
+    field_t field;
+
+    tok_init(&tok,line,end,separator);
+    if(!tok_next(&tok,&field))
+        return CSV_OTHER;
+    if(field_is(field,"node"))
+        return CSV_NODE;
+    if(field_is(field,"way"))
+        return CSV_WAY;
+    return CSV_OTHER;
+}
+
+
+/*  csv_worker
+
+    Work of a thread of read_csv over its chunk of the file, depending
+    on the phase of the job: counting the node and way lines of the
+    chunk, loading its node lines, or collecting the edges of its way
+    lines. Lines are views into the mapped file, without their end of
+    line characters.
+
+    Variables:
+        -arg = csv_chunk_t of the thread.
+
+    Return value:
+        NULL
+ */
+static void *csv_worker(void *arg){
+    csv_chunk_t *chunk = arg;
+    const csv_job_t *job = chunk->job;
+    const char *p = chunk->start, *q, *end;
+    uint32_t node = chunk->first_node;
+    uint8_t type;
+
+    if(job->phase == CSV_COUNT)
+        chunk->n_nodes = chunk->n_ways = 0;
+    while(p < chunk->end){
+        q = memchr(p,'\n',chunk->end-p);
+        if(q == NULL)
+            q = chunk->end;
+        end = q;
+        while(end > p && end[-1] == '\r')
+            end--;
+        type = line_type(p,end,job->separator);
+        if(job->phase == CSV_COUNT){
+            chunk->n_nodes += type == CSV_NODE;
+            chunk->n_ways += type == CSV_WAY;
+        }else if(job->phase == CSV_NODES && type == CSV_NODE)
+            job->nodes[node++] = load_node(p,end,job->separator);
+        else if(job->phase == CSV_WAYS && type == CSV_WAY)
+            way_edges(job->index,job->pos,job->n_nodes,p,end,job->separator,&chunk->edges);
+        p = q+1;
+    }
+    return NULL;
+}
+
+
+/*  run_phase
+
+    Runs a phase of read_csv on every chunk, one thread per chunk.
+
+    Variables:
+        -chunks = chunks of the file.
+        -nThreads = number of chunks.
+ */
+static void run_phase(csv_chunk_t *chunks, uint32_t nThreads){
+    uint32_t t;
+
+    for(t=1; t<nThreads; t++)
+        if(pthread_create(&chunks[t].thread,NULL,csv_worker,&chunks[t]) != 0){
+            fprintf(stderr,"ERROR: Can not create thread.\n");
+            exit(1);
+        }
+    csv_worker(&chunks[0]);
+    for(t=1; t<nThreads; t++)
+        pthread_join(chunks[t].thread,NULL);
+}
+
+
+/*  read_csv
+
+    Reads the nodes and the ways of the csv file using several threads.
+    The first field of a line gives its kind. Only "node" and "way"
+    lines are read, and any other line (comments, relations) is
+    skipped, so no counts have to be given.
+    The file is mapped and split into nThreads chunks that end at a
+    newline. Every thread runs three phases on its chunk. First it
+    counts the node and way lines. Then it loads its node lines into
+    their position of the node vector. Last it collects the edges of
+    its way lines into its own buffer, finding the nodes of the ways
+    with an id index.
+    The buffers are added to the nodes in file order, so the graph is
+    the same as reading the file line by line.
+
+    Variables:
+        -filename = name of the csv file.
+        -separator = string to delimite the columns of the lines.
+        -nThreads = number of threads.
+        -nodes = output vector of nodes, allocated.
+        -nNodes = output number of nodes.
+        -nWays = output number of ways.
+
+    Return value:
+        0 if successfull, 1 otherwise.
+ */
+int read_csv(const char *filename, const char *separator, uint32_t nThreads,
+             node_t **nodes, uint32_t *nNodes, uint32_t *nWays){
+    csv_job_t job;
+    csv_chunk_t *chunks;
+    const char *map, *p;
+    uint32_t *ids, *index, *pos;
+    struct stat st;
+    size_t k;
+    uint32_t t;
+    int fd;
+
+    fd = open(filename,O_RDONLY);
+    if(fd < 0 || fstat(fd,&st) != 0){
+        if(fd >= 0)
+            close(fd);
+        return 1;
+    }
+    map = st.st_size > 0 ? mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0) : NULL;
+    close(fd);
+    if(map == MAP_FAILED || map == NULL)
+        return 1;
+
+    /* Newline-aligned chunks */
+    if(nThreads == 0)
+        nThreads = 1;
+    chunks = calloc(nThreads,sizeof(csv_chunk_t)); assert(chunks);
+    for(t=0; t<nThreads; t++){
+        p = map+(uint64_t)st.st_size*t/nThreads;
+        if(t > 0 && p > chunks[t-1].start){
+            p = memchr(p-1,'\n',map+st.st_size-(p-1));
+            p = p != NULL ? p+1 : map+st.st_size;
+        }else if(t > 0)
+            p = chunks[t-1].start;
+        chunks[t].start = p;
+        chunks[t].job = &job;
+        if(t > 0)
+            chunks[t-1].end = p;
+    }
+    chunks[nThreads-1].end = map+st.st_size;
+
+    /* Count node and way lines, then place the nodes of each chunk */
+    job.separator = separator;
+    job.phase = CSV_COUNT;
+    run_phase(chunks,nThreads);
+    *nNodes = *nWays = 0;
+    for(t=0; t<nThreads; t++){
+        chunks[t].first_node = *nNodes;
+        *nNodes += chunks[t].n_nodes;
+        *nWays += chunks[t].n_ways;
+    }
+
+    /* Nodes */
+    *nodes = malloc(sizeof(node_t)*(*nNodes)); assert(*nodes != NULL || *nNodes == 0);
+    job.nodes = *nodes;
+    job.n_nodes = *nNodes;
+    job.phase = CSV_NODES;
+    run_phase(chunks,nThreads);
+
+    /* Ways, with an id index of the nodes, then their edges in file order */
+    ids = malloc(sizeof(uint32_t)*((uint64_t)*nNodes+1)); assert(ids);
+    index = malloc(sizeof(uint32_t)*((uint64_t)*nNodes+1)); assert(index);
+    pos = malloc(sizeof(uint32_t)*((uint64_t)*nNodes+1)); assert(pos);
+    for(k=0; k<*nNodes; k++)
+        ids[k] = (*nodes)[k].id;
+    id_index_build(ids,*nNodes,index,pos);
+    free(ids);
+    job.index = index;
+    job.pos = pos;
+    job.phase = CSV_WAYS;
+    run_phase(chunks,nThreads);
+    free(index);
+    free(pos);
+    for(t=0; t<nThreads; t++){
+        for(k=0; k<chunks[t].edges.n; k++)
+            add_succ(&(*nodes)[chunks[t].edges.edges[2*k]],chunks[t].edges.edges[2*k+1]);
+        free(chunks[t].edges.edges);
+    }
+
+    free(chunks);
+    munmap((void *)map,st.st_size);
+    return 0;
+}
+
+
+/*  name_hash
+
+    FNV-1a hash of a name.
+
+    Variables:
+        -name = '\0' terminated name.
+
+    Return value:
+        hash of the name.
+ */
+static uint32_t name_hash(const char *name){
+    uint32_t h = 2166136261u;
+
+    for(; *name != '\0'; name++)
+        h = (h^(uint8_t) *name)*16777619u;
+    return h;
+}
+
+
+/*  name_pool_init
+
+    Starts an empty pool of names, holding the empty name at offset 0.
+
+    Variables:
+        -pool = pool to initialize.
+ */
+static void name_pool_init(name_pool_t *pool){
+    pool->cap = 4096;
+    pool->names = malloc(sizeof(char)*pool->cap); assert(pool->names);
+    pool->names[0] = '\0';
+    pool->len = 1;
+    pool->nSlots = 1024;
+    pool->slots = calloc(pool->nSlots,sizeof(uint32_t)); assert(pool->slots);
+    pool->slots[name_hash("")&(pool->nSlots-1)] = 1;
+    pool->count = 1;
+}
+
+
+/*  name_pool_add
+
+    Adds a name to a pool, unless an equal name is already there. The
+    hash table is doubled when it gets half full.
+
+    Variables:
+        -pool = pool of names.
+        -name = '\0' terminated name.
+
+    Return value:
+        offset of the name in the pool.
+ */
+static uint32_t name_pool_add(name_pool_t *pool, const char *name){
+    uint32_t mask = pool->nSlots-1, k, j, *slots;
+    size_t len;
+
+    for(k=name_hash(name)&mask; pool->slots[k] != 0; k=(k+1)&mask)
+        if(strcmp(pool->names+pool->slots[k]-1,name) == 0)
+            return pool->slots[k]-1;
+
+    len = strlen(name)+1;
+    while(pool->len+len > pool->cap){
+        pool->cap *= 2;
+        pool->names = realloc(pool->names,sizeof(char)*pool->cap); assert(pool->names);
+    }
+    memcpy(pool->names+pool->len,name,len);
+    pool->slots[k] = pool->len+1;
+    pool->len += len;
+
+    if(++pool->count*2 > pool->nSlots){
+        slots = calloc(2*(size_t)pool->nSlots,sizeof(uint32_t)); assert(slots);
+        mask = 2*pool->nSlots-1;
+        for(j=0; j<pool->nSlots; j++){
+            if(pool->slots[j] == 0)
+                continue;
+            for(k=name_hash(pool->names+pool->slots[j]-1)&mask; slots[k] != 0; k=(k+1)&mask);
+            slots[k] = pool->slots[j];
+        }
+        free(pool->slots);
+        pool->slots = slots;
+        pool->nSlots *= 2;
+    }
+    return pool->len-len;
+}
+
+
+/*  name_pool_finish
+
+    Frees the hash table of a pool and moves its names to a graph.
+
+    Variables:
+        -pool = pool of names.
+        -graph = graph to give the names to.
+ */
+static void name_pool_finish(name_pool_t *pool, graph_t *graph){
+    free(pool->slots);
+    graph->names = realloc(pool->names,sizeof(char)*pool->len); assert(graph->names);
+    graph->nameLen = pool->len;
+}
+
+
+/*  build_graph
+
+    Packs the vector of nodes into the compressed sparse row graph
+    written to disk, computing the length of every edge, the unit
+    vector of every node, the reverse adjacency and the id index. Node
+    successors and names are copied, so the node vector can be freed
+    afterwards. Repeated names (most are empty or street names shared
+    by many nodes) are stored once, with the offset of every node
+    pointing to the shared copy.
+
+    Variables:
+        -graph = output graph.
+        -nodes = vector of nodes.
+        -nNodes = number of nodes.
+ */
+void build_graph(graph_t *graph, node_t *nodes, uint32_t nNodes){
+    uint32_t j, k, *offsets, *successors, *ids, *nameOffsets;
+    int32_t *lat, *lon;
+    double *unit, length;
+    float *weights;
+    name_pool_t pool;
+
+    memset(graph,0,sizeof(graph_t));
+    graph->nNodes = nNodes;
+    graph->nKept = nNodes;
+    //Compute total successors
+    for(j=0; j<nNodes; j++)
+        graph->nEdges += nodes[j].nsucc;
+
+    offsets = malloc(sizeof(uint32_t)*(nNodes+1)); assert(offsets);
+    successors = malloc(sizeof(uint32_t)*graph->nEdges); assert(successors != NULL || graph->nEdges == 0);
+    weights = malloc(sizeof(float)*graph->nEdges); assert(weights != NULL || graph->nEdges == 0);
+    ids = malloc(sizeof(uint32_t)*nNodes); assert(ids != NULL || nNodes == 0);
+    lat = malloc(sizeof(int32_t)*nNodes); assert(lat != NULL || nNodes == 0);
+    lon = malloc(sizeof(int32_t)*nNodes); assert(lon != NULL || nNodes == 0);
+    unit = malloc(sizeof(double)*3*nNodes); assert(unit != NULL || nNodes == 0);
+    nameOffsets = malloc(sizeof(uint32_t)*nNodes); assert(nameOffsets != NULL || nNodes == 0);
+    name_pool_init(&pool);
+
+    offsets[0] = 0;
+    for(j=0; j<nNodes; j++){
+        memcpy(successors+offsets[j],nodes[j].successors,
+               sizeof(uint32_t)*nodes[j].nsucc);
+        offsets[j+1] = offsets[j]+nodes[j].nsucc;
+        ids[j] = nodes[j].id;
+        //Edge lengths and unit vectors from the stored coordinates
+        lat[j] = (int32_t) lround(nodes[j].lat*COORD_SCALE);
+        lon[j] = (int32_t) lround(nodes[j].lon*COORD_SCALE);
+        unit[3*j] = cos(lat[j]*(DEG2RAD/COORD_SCALE))*cos(lon[j]*(DEG2RAD/COORD_SCALE));
+        unit[3*j+1] = cos(lat[j]*(DEG2RAD/COORD_SCALE))*sin(lon[j]*(DEG2RAD/COORD_SCALE));
+        unit[3*j+2] = sin(lat[j]*(DEG2RAD/COORD_SCALE));
+        nameOffsets[j] = name_pool_add(&pool,nodes[j].name);
+    }
+    name_pool_finish(&pool,graph);
+
+    graph->offsets = offsets;
+    graph->successors = successors;
+    graph->ids = ids;
+    graph->lat = lat;
+    graph->lon = lon;
+    graph->unit = unit;
+    graph->nameOffsets = nameOffsets;
+
+    /* Edge lengths, rounded up so the heuristic stays a lower bound */
+    for(j=0; j<nNodes; j++)
+        for(k=offsets[j]; k<offsets[j+1]; k++){
+            length = dis2nodes(graph,j,successors[k]);
+            weights[k] = (float) length;
+            if(weights[k] < length)
+                weights[k] = nextafterf(weights[k],FLT_MAX);
+        }
+    graph->weights = weights;
+    graph_reverse(graph);
+    graph_index(graph);
+}
+
+
+/*  chain_next
+
+    Edge leaving a contracted node along its chain.
+
+    Variables:
+        -graph = graph of the chain.
+        -prev = node the chain comes from.
+        -cur = contracted node.
+
+    Return value:
+        Position of the edge of cur to a node which is not prev.
+ */
+static uint32_t chain_next(const graph_t *graph, uint32_t prev, uint32_t cur){
+    uint32_t j = graph->offsets[cur];
+
+    if(graph->successors[j] == prev && j+1 < graph->offsets[cur+1])
+        j++;
+    return j;
+}
+
+
+/*  contractible
+
+    Checks if a node only links two others: a one-way chain node, with
+    a single predecessor and a different single successor, or a two-way
+    chain node, with the same two different neighbours as predecessors
+    and successors.
+
+    Variables:
+        -graph = graph of the node.
+        -v = position of the node.
+
+    Return value:
+        1 if the node can be contracted, 0 otherwise.
+ */
+static int contractible(const graph_t *graph, uint32_t v){
+    uint32_t out = graph->offsets[v+1]-graph->offsets[v];
+    uint32_t in = graph->rOffsets[v+1]-graph->rOffsets[v];
+    const uint32_t *s = graph->successors+graph->offsets[v];
+    const uint32_t *p = graph->rSources+graph->rOffsets[v];
+
+    if(out == 1 && in == 1)
+        return p[0] != s[0] && p[0] != v && s[0] != v;
+    if(out == 2 && in == 2)
+        return s[0] != s[1] && s[0] != v && s[1] != v &&
+               ((p[0] == s[0] && p[1] == s[1]) || (p[0] == s[1] && p[1] == s[0]));
+    return 0;
+}
+
+
+/*  simplify_graph
+
+    Builds the search graph of a graph: nodes without edges are
+    dropped, and every chain of contractible nodes (one predecessor
+    and one other successor, or the same two neighbours both ways) is
+    replaced by a single edge with the length of the chain. The
+    contracted nodes are placed after the nodes with edges (nKept),
+    with no edges, and the chain of every edge is stored in geoOffsets,
+    geoNodes and geoDist, so full paths can be expanded and searches
+    can start or end at any node (see graph_ends). A cycle made only of
+    contractible nodes keeps its first node.
+
+    Variables:
+        -in = graph built by build_graph.
+        -out = output simplified graph.
+ */
+void simplify_graph(const graph_t *in, graph_t *out){
+    enum {DROPPED, KEPT, CHAIN};
+    uint32_t n = in->nNodes, v, u, j, k, prev, cur, nOut, nChain;
+    uint32_t *newPos, *offsets, *successors, *ids, *nameOffsets;
+    uint32_t *geoOffsets, *geoNodes, *chainGeo;
+    uint8_t *state, *seen, pass;
+    int32_t *lat, *lon;
+    double *unit, acc;
+    float *weights, *geoDist;
+    name_pool_t pool;
+
+    memset(out,0,sizeof(graph_t));
+    state = malloc(sizeof(uint8_t)*n); assert(state != NULL || n == 0);
+    seen = calloc((uint64_t)n+1,sizeof(uint8_t)); assert(seen);
+    newPos = malloc(sizeof(uint32_t)*n); assert(newPos != NULL || n == 0);
+
+    /* Kind of every node */
+    for(v=0; v<n; v++){
+        if(in->offsets[v] == in->offsets[v+1] && in->rOffsets[v] == in->rOffsets[v+1])
+            state[v] = DROPPED;
+        else
+            state[v] = contractible(in,v) ? CHAIN : KEPT;
+    }
+    //Mark the chains leaving kept nodes, then keep a node of every cycle left
+    for(pass=0; pass<2; pass++)
+        for(u=0; u<n; u++){
+            if(pass == 1 && state[u] == CHAIN && !seen[u])
+                state[u] = KEPT;
+            else if(pass == 1 || state[u] != KEPT)
+                continue;
+            for(j=in->offsets[u]; j<in->offsets[u+1]; j++)
+                for(prev=u, cur=in->successors[j]; state[cur] == CHAIN && !seen[cur]; ){
+                    seen[cur] = 1;
+                    k = in->successors[chain_next(in,prev,cur)];
+                    prev = cur;
+                    cur = k;
+                }
+        }
+    free(seen);
+
+    /* Kept nodes first, then contracted ones */
+    nOut = 0;
+    for(v=0; v<n; v++)
+        if(state[v] == KEPT)
+            newPos[v] = nOut++;
+    out->nKept = nOut;
+    for(v=0; v<n; v++)
+        if(state[v] == CHAIN)
+            newPos[v] = nOut++;
+    out->nNodes = nOut;
+    nChain = nOut-out->nKept;
+
+    offsets = malloc(sizeof(uint32_t)*((uint64_t)nOut+1)); assert(offsets);
+    successors = malloc(sizeof(uint32_t)*in->nEdges); assert(successors != NULL || in->nEdges == 0);
+    weights = malloc(sizeof(float)*in->nEdges); assert(weights != NULL || in->nEdges == 0);
+    geoOffsets = malloc(sizeof(uint32_t)*((uint64_t)in->nEdges+1)); assert(geoOffsets);
+    geoNodes = malloc(sizeof(uint32_t)*in->nEdges); assert(geoNodes != NULL || in->nEdges == 0);
+    geoDist = malloc(sizeof(float)*in->nEdges); assert(geoDist != NULL || in->nEdges == 0);
+    chainGeo = malloc(sizeof(uint32_t)*nChain); assert(chainGeo != NULL || nChain == 0);
+    for(v=0; v<nChain; v++)
+        chainGeo[v] = UINT32_MAX;
+
+    /* One edge per chain leaving a kept node */
+    offsets[0] = 0;
+    geoOffsets[0] = 0;
+    for(u=0; u<n; u++){
+        if(state[u] != KEPT)
+            continue;
+        for(j=in->offsets[u]; j<in->offsets[u+1]; j++){
+            acc = in->weights[j];
+            for(prev=u, cur=in->successors[j]; state[cur] == CHAIN; ){
+                if(chainGeo[newPos[cur]-out->nKept] == UINT32_MAX)
+                    chainGeo[newPos[cur]-out->nKept] = out->nGeo;
+                geoNodes[out->nGeo] = newPos[cur];
+                geoDist[out->nGeo++] = (float) acc;
+                k = chain_next(in,prev,cur);
+                acc += in->weights[k];
+                prev = cur;
+                cur = in->successors[k];
             }
+            successors[out->nEdges] = newPos[cur];
+            //Rounded up, so the heuristic stays a lower bound
+            weights[out->nEdges] = (float) acc;
+            if(weights[out->nEdges] < acc)
+                weights[out->nEdges] = nextafterf(weights[out->nEdges],FLT_MAX);
+            geoOffsets[++out->nEdges] = out->nGeo;
         }
+        offsets[newPos[u]+1] = out->nEdges;
+    }
+    for(v=out->nKept; v<nOut; v++)
+        offsets[v+1] = out->nEdges;
 
-        /* There are enough nodes belonging to our graph */
-        if(nnInWay >= 2){
-            /* Oneway way */
-            if(strcmp("oneway",elements[7]) == 0)
-                for(i=0; i<(nnInWay-1);i++)
-                    add_succ(&nodes[nPos[i]],nPos[i+1]);
-            /* Twoway way */
-            else{
-                for(i=0; i<(nnInWay-1);i++){
-                    add_succ(&nodes[nPos[i]],nPos[i+1]);
-                    add_succ(&nodes[nPos[i+1]],nPos[i]);
+    /* Node data in the new order */
+    ids = malloc(sizeof(uint32_t)*nOut); assert(ids != NULL || nOut == 0);
+    lat = malloc(sizeof(int32_t)*nOut); assert(lat != NULL || nOut == 0);
+    lon = malloc(sizeof(int32_t)*nOut); assert(lon != NULL || nOut == 0);
+    unit = malloc(sizeof(double)*3*nOut); assert(unit != NULL || nOut == 0);
+    nameOffsets = malloc(sizeof(uint32_t)*nOut); assert(nameOffsets != NULL || nOut == 0);
+    name_pool_init(&pool);
+    for(v=0; v<n; v++){
+        if(state[v] == DROPPED)
+            continue;
+        u = newPos[v];
+        ids[u] = in->ids[v];
+        lat[u] = in->lat[v];
+        lon[u] = in->lon[v];
+        memcpy(unit+3*u,in->unit+3*v,sizeof(double)*3);
+        nameOffsets[u] = name_pool_add(&pool,graph_name(in,v));
+    }
+    name_pool_finish(&pool,out);
+    free(state);
+    free(newPos);
+
+    out->offsets = offsets;
+    out->successors = realloc(successors,sizeof(uint32_t)*out->nEdges);
+    out->weights = realloc(weights,sizeof(float)*out->nEdges);
+    out->geoOffsets = realloc(geoOffsets,sizeof(uint32_t)*((uint64_t)out->nEdges+1));
+    out->geoNodes = realloc(geoNodes,sizeof(uint32_t)*out->nGeo);
+    out->geoDist = realloc(geoDist,sizeof(float)*out->nGeo);
+    out->chainGeo = chainGeo;
+    out->ids = ids;
+    out->lat = lat;
+    out->lon = lon;
+    out->unit = unit;
+    out->nameOffsets = nameOffsets;
+    graph_reverse(out);
+    graph_index(out);
+}
+
+
+/*  compare_key
+
+    Compares two (key << 32 | position) values, for qsort.
+
+    Variables:
+        -a, b = pointers to the values.
+
+    Return value:
+        -1, 0 or 1 if a is smaller, equal or bigger than b.
+ */
+static int compare_key(const void *a, const void *b){
+    uint64_t ka = *(const uint64_t *) a, kb = *(const uint64_t *) b;
+    return ka < kb ? -1 : (ka > kb ? 1 : 0);
+}
+
+
+/*  hilbert_key
+
+    Position of a point along a Hilbert curve filling a grid of
+    2^16 x 2^16 cells: points close in the curve are close in space.
+
+    Variables:
+        -x, y = cell of the point (16 bits each).
+
+    Return value:
+        Position along the curve.
+ */
+static uint32_t hilbert_key(uint32_t x, uint32_t y){
+    uint32_t s, rx, ry, t, d = 0;
+
+    for(s=1u<<15; s>0; s>>=1){
+        rx = (x & s) != 0;
+        ry = (y & s) != 0;
+        d += s*s*((3*rx)^ry);
+        //Rotate the quadrant
+        if(ry == 0){
+            if(rx == 1){
+                x = 0xffff-x;
+                y = 0xffff-y;
+            }
+            t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return d;
+}
+
+
+/*  hilbert_order
+
+    Numbers a range of nodes along a Hilbert curve over the bounding
+    box of the graph.
+
+    Variables:
+        -graph = graph of the nodes.
+        -first, last = range of nodes to number.
+        -perm = new position of each node, filled for the range.
+ */
+static void hilbert_order(const graph_t *graph, uint32_t first, uint32_t last,
+                          uint32_t *perm){
+    double minLat = DBL_MAX, maxLat = -DBL_MAX, minLon = DBL_MAX, maxLon = -DBL_MAX;
+    uint64_t *keys;
+    uint32_t v, x, y;
+
+    if(last <= first)
+        return;
+    for(v=0; v<graph->nNodes; v++){
+        minLat = graph->lat[v] < minLat ? graph->lat[v] : minLat;
+        maxLat = graph->lat[v] > maxLat ? graph->lat[v] : maxLat;
+        minLon = graph->lon[v] < minLon ? graph->lon[v] : minLon;
+        maxLon = graph->lon[v] > maxLon ? graph->lon[v] : maxLon;
+    }
+    keys = malloc(sizeof(uint64_t)*(last-first)); assert(keys);
+    for(v=first; v<last; v++){
+        x = maxLon > minLon ? (uint32_t) ((graph->lon[v]-minLon)/(maxLon-minLon)*65535.) : 0;
+        y = maxLat > minLat ? (uint32_t) ((graph->lat[v]-minLat)/(maxLat-minLat)*65535.) : 0;
+        keys[v-first] = (uint64_t) hilbert_key(x,y) << 32 | v;
+    }
+    qsort(keys,last-first,sizeof(uint64_t),compare_key);
+    for(v=first; v<last; v++)
+        perm[(uint32_t) keys[v-first]] = v;
+    free(keys);
+}
+
+
+/*  bfs_order
+
+    Numbers the nodes with edges in breadth first order over the edges
+    of both directions, starting a new search from the first node not
+    numbered yet, and the contracted nodes of a simplified graph in the
+    order their chains are found along the renumbered edges.
+
+    Variables:
+        -graph = graph of the nodes.
+        -perm = new position of each node.
+ */
+static void bfs_order(const graph_t *graph, uint32_t *perm){
+    uint32_t *queue, head, tail = 0, root, v, j, k, w, next;
+
+    queue = malloc(sizeof(uint32_t)*graph->nNodes); assert(queue != NULL || graph->nNodes == 0);
+    for(v=0; v<graph->nNodes; v++)
+        perm[v] = UINT32_MAX;
+    for(root=0; root<graph->nKept; root++){
+        if(perm[root] != UINT32_MAX)
+            continue;
+        head = tail;
+        perm[root] = tail;
+        queue[tail++] = root;
+        while(head < tail){
+            v = queue[head++];
+            for(j=graph->offsets[v]; j<graph->offsets[v+1]; j++)
+                if(perm[w = graph->successors[j]] == UINT32_MAX){
+                    perm[w] = tail;
+                    queue[tail++] = w;
+                }
+            for(j=graph->rOffsets[v]; j<graph->rOffsets[v+1]; j++)
+                if(perm[w = graph->rSources[j]] == UINT32_MAX){
+                    perm[w] = tail;
+                    queue[tail++] = w;
                 }
-            };
         }
     }
-    //Free memory
-    for(i=0; i<n; i++)
-        free(elements[i]);
-    free(elements);
+    //Contracted nodes along the chains of the nodes in their new order
+    next = graph->nKept;
+    for(k=0; graph->geoOffsets != NULL && k<graph->nKept; k++)
+        for(v=queue[k], j=graph->offsets[v]; j<graph->offsets[v+1]; j++)
+            for(w=graph->geoOffsets[j]; w<graph->geoOffsets[j+1]; w++)
+                if(perm[graph->geoNodes[w]] == UINT32_MAX)
+                    perm[graph->geoNodes[w]] = next++;
+    free(queue);
+}
+
+
+/*  permute_graph
+
+    Copies a graph with its nodes renumbered. Edges keep their order
+    inside each node, and the chains of a simplified graph are moved
+    with their edges.
+
+    Variables:
+        -in = graph to copy.
+        -perm = new position of each node, keeping the nodes with edges
+                first (below nKept).
+        -out = output graph.
+ */
+static void permute_graph(const graph_t *in, const uint32_t *perm, graph_t *out){
+    uint32_t n = in->nNodes, u, v, j, k, len, *inv, *geoMap = NULL;
+    uint32_t *offsets, *successors, *ids, *nameOffsets;
+    uint32_t *geoOffsets = NULL, *geoNodes = NULL, *chainGeo = NULL;
+    int32_t *lat, *lon;
+    double *unit;
+    float *weights, *geoDist = NULL;
+    char *names;
+
+    memset(out,0,sizeof(graph_t));
+    out->nNodes = n;
+    out->nEdges = in->nEdges;
+    out->nKept = in->nKept;
+    out->nGeo = in->nGeo;
+    out->nameLen = in->nameLen;
+    inv = malloc(sizeof(uint32_t)*n); assert(inv != NULL || n == 0);
+    for(v=0; v<n; v++)
+        inv[perm[v]] = v;
+
+    offsets = malloc(sizeof(uint32_t)*((uint64_t)n+1)); assert(offsets);
+    successors = malloc(sizeof(uint32_t)*in->nEdges); assert(successors != NULL || in->nEdges == 0);
+    weights = malloc(sizeof(float)*in->nEdges); assert(weights != NULL || in->nEdges == 0);
+    if(in->geoOffsets != NULL){
+        geoOffsets = malloc(sizeof(uint32_t)*((uint64_t)in->nEdges+1)); assert(geoOffsets);
+        geoNodes = malloc(sizeof(uint32_t)*in->nGeo); assert(geoNodes != NULL || in->nGeo == 0);
+        geoDist = malloc(sizeof(float)*in->nGeo); assert(geoDist != NULL || in->nGeo == 0);
+        geoMap = malloc(sizeof(uint32_t)*in->nGeo); assert(geoMap != NULL || in->nGeo == 0);
+        chainGeo = malloc(sizeof(uint32_t)*(n-in->nKept)); assert(chainGeo != NULL || n == in->nKept);
+        geoOffsets[0] = 0;
+    }
+
+    /* Edges of each node in the new order */
+    offsets[0] = 0;
+    for(u=0, k=0; u<n; u++){
+        v = inv[u];
+        offsets[u+1] = offsets[u]+in->offsets[v+1]-in->offsets[v];
+        for(j=in->offsets[v]; j<in->offsets[v+1]; j++){
+            successors[offsets[u]+j-in->offsets[v]] = perm[in->successors[j]];
+            weights[offsets[u]+j-in->offsets[v]] = in->weights[j];
+            if(geoOffsets == NULL)
+                continue;
+            for(len=in->geoOffsets[j]; len<in->geoOffsets[j+1]; len++, k++){
+                geoMap[len] = k;
+                geoNodes[k] = perm[in->geoNodes[len]];
+                geoDist[k] = in->geoDist[len];
+            }
+            geoOffsets[offsets[u]+j-in->offsets[v]+1] = k;
+        }
+    }
+    for(u=in->nKept; chainGeo != NULL && u<n; u++)
+        chainGeo[u-in->nKept] = geoMap[in->chainGeo[inv[u]-in->nKept]];
+
+    /* Node data in the new order */
+    ids = malloc(sizeof(uint32_t)*n); assert(ids != NULL || n == 0);
+    lat = malloc(sizeof(int32_t)*n); assert(lat != NULL || n == 0);
+    lon = malloc(sizeof(int32_t)*n); assert(lon != NULL || n == 0);
+    unit = malloc(sizeof(double)*3*n); assert(unit != NULL || n == 0);
+    nameOffsets = malloc(sizeof(uint32_t)*n); assert(nameOffsets != NULL || n == 0);
+    names = malloc(sizeof(char)*in->nameLen); assert(names != NULL || in->nameLen == 0);
+    memcpy(names,in->names,sizeof(char)*in->nameLen);
+    for(u=0; u<n; u++){
+        v = inv[u];
+        ids[u] = in->ids[v];
+        lat[u] = in->lat[v];
+        lon[u] = in->lon[v];
+        memcpy(unit+3*u,in->unit+3*v,sizeof(double)*3);
+        nameOffsets[u] = in->nameOffsets[v];
+    }
+    free(inv);
+    free(geoMap);
+
+    out->offsets = offsets;
+    out->successors = successors;
+    out->weights = weights;
+    out->geoOffsets = geoOffsets;
+    out->geoNodes = geoNodes;
+    out->geoDist = geoDist;
+    out->chainGeo = chainGeo;
+    out->ids = ids;
+    out->lat = lat;
+    out->lon = lon;
+    out->unit = unit;
+    out->nameOffsets = nameOffsets;
+    out->names = names;
+    graph_reverse(out);
+    graph_index(out);
+}
+
+
+/*  reorder_graph
+
+    Renumbers the nodes of a graph so nodes close in the graph are
+    close in memory: along a Hilbert curve over their coordinates, or
+    in breadth first order over the edges. Successors, reverse edges
+    and chains are rewritten to the new numbering, and the original
+    ids stay in the ids array, found with the id index. The nodes with
+    edges of a simplified graph stay first.
+
+    Variables:
+        -in = graph to reorder.
+        -order = new order of the nodes (enum node_order).
+        -out = output graph.
+ */
+void reorder_graph(const graph_t *in, uint8_t order, graph_t *out){
+    uint32_t *perm, v;
+
+    perm = malloc(sizeof(uint32_t)*in->nNodes); assert(perm != NULL || in->nNodes == 0);
+    if(order == ORDER_HILBERT){
+        hilbert_order(in,0,in->nKept,perm);
+        hilbert_order(in,in->nKept,in->nNodes,perm);
+    }else if(order == ORDER_BFS)
+        bfs_order(in,perm);
+    else
+        for(v=0; v<in->nNodes; v++)
+            perm[v] = v;
+    permute_graph(in,perm,out);
+    free(perm);
 }
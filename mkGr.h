@@ -1,49 +1,147 @@
 #pragma once
+#include "graph.h"
 #include <inttypes.h>
+#include <pthread.h>
+#include <stddef.h>
 
-/* Node Structure of the graph */
+/* Node Structure used while building the graph */
 typedef struct node_s{
     uint32_t id;            // Identification number
     char *name;             // Name (if available)
     double lat, lon;        // Spherical coordinates
-    uint8_t nsucc;          // Number of successors
+    uint32_t nsucc;         // Number of successors
     uint32_t *successors;   // Position in node vector
 } node_t;
 
+/* View of a field of a line: not '\0' terminated */
+typedef struct field_s{
+    const char *str;        // First character
+    uint32_t len;           // Number of characters
+} field_t;
 
-/*  strtok_single
+/* State of the tokenization of a line */
+typedef struct tokenizer_s{
+    const char *pos;        // Start of the next field
+    const char *end;        // End of the line
+    const char *delims;     // Characters separating the fields
+} tokenizer_t;
 
-    strtok manual implementation where zero string elements are
-    taken into account.
+/* Edges collected while reading ways, as (origin, destination) pairs */
+typedef struct edge_buffer_s{
+    uint32_t *edges;        // 2*n node positions
+    size_t n, cap;          // Number of edges and room in buffer
+} edge_buffer_t;
+
+/* Deduplicated pool of node names: every distinct name is stored once */
+typedef struct name_pool_s{
+    char *names;            // Distinct names, '\0' separated
+    uint32_t len, cap;      // Characters used and room in names
+    uint32_t *slots;        // Hash table of name offsets+1 (0 = empty)
+    uint32_t nSlots;        // Size of the table (power of 2)
+    uint32_t count;         // Distinct names
+} name_pool_t;
+
+/* Phases of the parallel reading of the csv file */
+enum csv_phase {CSV_COUNT, CSV_NODES, CSV_WAYS};
+
+/* Orders of the nodes of a graph */
+enum node_order {ORDER_INPUT, ORDER_HILBERT, ORDER_BFS};
+
+/* Kinds of lines of the csv file */
+enum csv_line {CSV_OTHER, CSV_NODE, CSV_WAY};
+
+/* Work shared by the threads reading the csv file */
+typedef struct csv_job_s{
+    uint8_t phase;          // Current phase (enum csv_phase)
+    const char *separator;  // Column separators
+    node_t *nodes;          // Node vector
+    uint32_t n_nodes;       // Number of nodes
+    const uint32_t *index;  // Id index of the nodes
+    const uint32_t *pos;    // Position of each index entry
+} csv_job_t;
+
+/* Newline-aligned chunk of the csv file read by a thread */
+typedef struct csv_chunk_s{
+    const char *start, *end;    // Text of the chunk
+    uint32_t n_nodes, n_ways;   // Node and way lines in the chunk
+    uint32_t first_node;        // Position of its first node
+    const csv_job_t *job;       // Work of the current phase
+    edge_buffer_t edges;        // Edges of its way lines
+    pthread_t thread;
+} csv_chunk_t;
+
+
+/*  tok_init
+
+    Starts the tokenization of a line. The line is not modified and
+    needs no terminating '\0': fields are returned as views into it.
+    The tokenizer keeps all its state, so any number of lines can be
+    tokenized at the same time.
 
     Variables:
-        -str = Input string to find next delims.
-        -delims = string to separate the input.
-    
+        -tok = tokenizer to initialize.
+        -line = first character of the line.
+        -end = end of the line (after its last character).
+        -delims = characters separating the fields ('\0' terminated).
+ */
+void tok_init(tokenizer_t *tok, const char *line, const char *end, const char *delims);
+
+
+/*  tok_next
+
+    Returns the next field of the line. As strtok_single did, empty
+    fields between two consecutive delimiters are returned, but a
+    delimiter at the end of the line does not add an empty field.
+
+    Variables:
+        -tok = tokenizer of the line.
+        -field = output view of the field.
+
     Return value:
-        Pointer to next start of word, modifiying the delims
-        character by '\0' character.
+        1 if a field was returned, 0 at the end of the line.
  */
-char * strtok_single (char * str, char const * delims);
+int tok_next(tokenizer_t *tok, field_t *field);
 
 
-/*  sep_line
+/*  field_u32
 
-    Given an input string (line) and a string of characters for separation
-    (separatos), it separates the line and puts each string in a vector
-    of strings (elements). It also computes the number of elements (n).
+    Reads a decimal unsigned integer from a field.
 
-    Important: The line is useless after this function, so make sure to
-    first make a copy if needed.
+    Variables:
+        -field = field to read.
+        -value = output value.
+
+    Return value:
+        1 if the field starts with a digit, 0 otherwise.
+ */
+int field_u32(field_t field, uint32_t *value);
+
+
+/*  field_double
+
+    Reads a floating point number from a field.
 
     Variables:
-        -line = Input string to be separated.
-        -separatos = Characters to separate the string.
-        -elements = Output vector of strings.
-        -n = number of elements obtained.
- 
+        -field = field to read.
+
+    Return value:
+        value of the field, 0 if it is not a number.
+ */
+double field_double(field_t field);
+
+
+/*  field_is
+
+    Compares a field with a string.
+
+    Variables:
+        -field = field to compare.
+        -str = '\0' terminated string.
+
+    Return value:
+        1 if they are equal, 0 otherwise.
  */
-void sep_line(char *line, char *separators, char ***elements, uint32_t *n);
+int field_is(field_t field, const char *str);
 
 
 /*  load_node
@@ -57,32 +155,13 @@ void sep_line(char *line, char *separators, char ***elements, uint32_t *n);
 
     Variables:
         -line = Input line with node data.
+        -end = end of the line.
         -separator = string to separate the input.
     
     Return value:
         node filled with the data of the line
  */
-node_t load_node(char *line, char *separator);
-
-
-/*  compare_id
-
-    Compares the id's of two nodes. It is implemented to use bsearch
-    from <stdlib.h>. 
-
-    Variables:
-        -node1 = pointer to first node.
-        -node2 = pointer to second node.
-    
-    Return value:
-        -1 if id_1 < id_2
-        0  if id_1 == id_2
-        1  if id_1 > id_2
- */
- 
-int compare_id(const void *node1, const void *node2);
-
-
+node_t load_node(const char *line, const char *end, const char *separator);
 
 
 /*  add_succ
@@ -97,15 +176,104 @@ int compare_id(const void *node1, const void *node2);
 void add_succ(node_t *node, uint32_t id);
 
 
-/*  add_way
+/*  way_edges
 
     Computes for a way the nodes appearing in it, their position in the node
-    vector, and depending of oneway or twoway, adds the edges to the nodes.
+    vector, and depending of oneway or twoway, appends its edges to a
+    buffer in the order they have to be added to the nodes.
     
     Variables:
-        -nodes = vector of nodes.
-        -nnodes = number of nodes.
+        -index, pos = id index of the nodes (see id_index_build).
+        -nNodes = number of nodes.
         -line = string of the way line.
+        -end = end of the line.
         -separator = string to delimite the columns of the line.
+        -edges = buffer of edges to append to.
+ */
+void way_edges(const uint32_t *index, const uint32_t *pos, uint32_t nNodes,
+               const char *line, const char *end, const char *separator,
+               edge_buffer_t *edges);
+
+
+/*  read_csv
+
+    Reads the nodes and the ways of the csv file using several threads.
+    The first field of a line gives its kind. Only "node" and "way"
+    lines are read, and any other line (comments, relations) is
+    skipped, so no counts have to be given.
+    The file is mapped and split into nThreads chunks that end at a
+    newline. Every thread runs three phases on its chunk. First it
+    counts the node and way lines. Then it loads its node lines into
+    their position of the node vector. Last it collects the edges of
+    its way lines into its own buffer, finding the nodes of the ways
+    with an id index.
+    The buffers are added to the nodes in file order, so the graph is
+    the same as reading the file line by line.
+
+    Variables:
+        -filename = name of the csv file.
+        -separator = string to delimite the columns of the lines.
+        -nThreads = number of threads.
+        -nodes = output vector of nodes, allocated.
+        -nNodes = output number of nodes.
+        -nWays = output number of ways.
+
+    Return value:
+        0 if successfull, 1 otherwise.
+ */
+int read_csv(const char *filename, const char *separator, uint32_t nThreads,
+             node_t **nodes, uint32_t *nNodes, uint32_t *nWays);
+
+
+/*  build_graph
+
+    Packs the vector of nodes into the compressed sparse row graph
+    written to disk, computing the length of every edge, the unit
+    vector of every node, the reverse adjacency and the id index. Node
+    successors and names are copied, so the node vector can be freed
+    afterwards. Repeated names (most are empty or street names shared
+    by many nodes) are stored once, with the offset of every node
+    pointing to the shared copy.
+
+    Variables:
+        -graph = output graph.
+        -nodes = vector of nodes.
+        -nNodes = number of nodes.
+ */
+void build_graph(graph_t *graph, node_t *nodes, uint32_t nNodes);
+
+
+/*  simplify_graph
+
+    Builds the search graph of a graph: nodes without edges are
+    dropped, and every chain of contractible nodes (one predecessor
+    and one other successor, or the same two neighbours both ways) is
+    replaced by a single edge with the length of the chain. The
+    contracted nodes are placed after the nodes with edges (nKept),
+    with no edges, and the chain of every edge is stored in geoOffsets,
+    geoNodes and geoDist, so full paths can be expanded and searches
+    can start or end at any node (see graph_ends). A cycle made only of
+    contractible nodes keeps its first node.
+
+    Variables:
+        -in = graph built by build_graph.
+        -out = output simplified graph.
+ */
+void simplify_graph(const graph_t *in, graph_t *out);
+
+
+/*  reorder_graph
+
+    Renumbers the nodes of a graph so nodes close in the graph are
+    close in memory: along a Hilbert curve over their coordinates, or
+    in breadth first order over the edges. Successors, reverse edges
+    and chains are rewritten to the new numbering, and the original
+    ids stay in the ids array, found with the id index. The nodes with
+    edges of a simplified graph stay first.
+
+    Variables:
+        -in = graph to reorder.
+        -order = new order of the nodes (enum node_order).
+        -out = output graph.
  */
-void add_way(node_t *nodes, uint32_t nnodes, char *line, char *separator);
+void reorder_graph(const graph_t *in, uint8_t order, graph_t *out);
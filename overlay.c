@@ -0,0 +1,554 @@
+#include "overlay.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/*Segment changes read from an overlay file */
+typedef struct overlayChanges_s{
+    uint32_t *keys;         //Key of each changed segment
+    float *factors;         //Its factor
+    uint32_t n, cap;        //Changes and room in the vectors
+} overlayChanges_t;
+
+/*  TABLECREATE
+ *
+ *  Allocates an empty table with room for some keys.
+ *
+ *  Input:
+ *      table: table to create.
+ *      n: number of keys.
+ */
+static void tableCreate(overlayTable_t *table, uint32_t n){
+    table->count = 0;
+    table->keys = NULL;
+    table->values = NULL;
+    for(table->nSlots=n>0 ? 16 : 0; table->nSlots<2*(uint64_t)n; table->nSlots*=2);
+    if(table->nSlots == 0)
+        return;
+    table->keys = malloc(sizeof(uint32_t)*table->nSlots); assert(table->keys);
+    table->values = malloc(sizeof(float)*table->nSlots); assert(table->values);
+    memset(table->keys,0xff,sizeof(uint32_t)*table->nSlots);
+}
+
+/*  TABLESLOT
+ *
+ *  Slot of a key, claimed if the key is not in the table yet.
+ *
+ *  Input:
+ *      table: table to look in, with a free slot.
+ *      key: key to look for.
+ *      value: value of the key if it is new.
+ *
+ *  Return: slot of the key.
+ */
+static uint32_t tableSlot(overlayTable_t *table, uint32_t key, float value){
+    uint32_t slot = (key*2654435761u)&(table->nSlots-1);
+
+    while(table->keys[slot] != UINT32_MAX && table->keys[slot] != key)
+        slot = (slot+1)&(table->nSlots-1);
+    if(table->keys[slot] == UINT32_MAX){
+        table->keys[slot] = key;
+        table->values[slot] = value;
+        table->count++;
+    }
+    return slot;
+}
+
+/*  ADDCHANGE
+ *
+ *  Appends the change of a segment.
+ *
+ *  Input:
+ *      changes: changes read, grown if needed.
+ *      key: key of the segment.
+ *      factor: factor of its cost, OVERLAY_BLOCKED if closed.
+ */
+static void addChange(overlayChanges_t *changes, uint32_t key, float factor){
+    if(changes->n == changes->cap){
+        changes->cap = 2*changes->cap+64;
+        changes->keys = realloc(changes->keys,sizeof(uint32_t)*changes->cap);
+        assert(changes->keys);
+        changes->factors = realloc(changes->factors,sizeof(float)*changes->cap);
+        assert(changes->factors);
+    }
+    changes->keys[changes->n] = key;
+    changes->factors[changes->n++] = factor;
+}
+
+/*  FINDSEGMENTS
+ *
+ *  Adds the change of every segment going from a node to another:
+ *  inside a chain, from a node with edges into a chain, or an edge
+ *  without chain (every parallel one).
+ *
+ *  Input:
+ *      graph: graph of the nodes.
+ *      u, v: positions of the nodes.
+ *      factor: factor of the cost, OVERLAY_BLOCKED if closed.
+ *      changes: changes read, grown.
+ *
+ *  Return: number of segments found.
+ */
+static uint32_t findSegments(const graph_t *graph, uint32_t u, uint32_t v,
+                             float factor, overlayChanges_t *changes){
+    uint32_t edges[2], geo[2], j, next, found = 0;
+    uint8_t i, n;
+
+    if(u >= graph->nKept){
+        //From a contracted node to the next node of its chain
+        n = graph_chain_edges(graph,u,edges,geo);
+        for(i=0; i<n; i++){
+            j = edges[i];
+            next = geo[i]+1 < graph->geoOffsets[j+1] ? graph->geoNodes[geo[i]+1] :
+                                                     graph->successors[j];
+            if(next == v){
+                addChange(changes,geo[i]+1 < graph->geoOffsets[j+1] ? geo[i]+1 :
+                                                                    graph->nGeo+j,factor);
+                found++;
+            }
+        }
+    }else if(v >= graph->nKept){
+        //From the source of a chain to its first node
+        n = graph_chain_edges(graph,v,edges,geo);
+        for(i=0; i<n; i++)
+            if(geo[i] == graph->geoOffsets[edges[i]] &&
+               edges[i] >= graph->offsets[u] && edges[i] < graph->offsets[u+1]){
+                addChange(changes,geo[i],factor);
+                found++;
+            }
+    }else{
+        for(j=graph->offsets[u]; j<graph->offsets[u+1]; j++)
+            if(graph->successors[j] == v &&
+               (graph->geoOffsets == NULL || graph->geoOffsets[j] == graph->geoOffsets[j+1])){
+                addChange(changes,graph->nGeo+j,factor);
+                found++;
+            }
+    }
+    return found;
+}
+
+/*  SEGMENTLENGTH
+ *
+ *  Length of a segment.
+ *
+ *  Input:
+ *      graph: graph of the segment.
+ *      key: key of the segment.
+ *      j: edge whose chain holds it.
+ *
+ *  Return: length of the segment.
+ */
+static double segmentLength(const graph_t *graph, uint32_t key, uint32_t j){
+    uint32_t first = graph->geoOffsets != NULL ? graph->geoOffsets[j] : 0;
+    uint32_t last = graph->geoOffsets != NULL ? graph->geoOffsets[j+1] : 0;
+
+    if(key >= graph->nGeo)
+        return graph->weights[j]-(last > first ? graph->geoDist[last-1] : 0.);
+    return graph->geoDist[key]-(key > first ? graph->geoDist[key-1] : 0.);
+}
+
+/*  SEGMENTEXTRA
+ *
+ *  Cost added by an overlay to a segment.
+ *
+ *  Input:
+ *      overlay: overlay to apply.
+ *      key: key of the segment.
+ *      j: edge whose chain holds it.
+ *
+ *  Return: extra cost, DBL_MAX if closed.
+ */
+static double segmentExtra(const overlay_t *overlay, uint32_t key, uint32_t j){
+    float factor = overlayFind(&overlay->segments,key,1.f);
+
+    if(factor == 1.f)
+        return 0.;
+    if(factor == OVERLAY_BLOCKED)
+        return DBL_MAX;
+    return (factor-1.)*segmentLength(overlay->graph,key,j);
+}
+
+/*  CHAINEXTRA
+ *
+ *  Cost added by an overlay to a piece of the chain of an edge.
+ *
+ *  Input:
+ *      overlay: overlay to apply.
+ *      j: edge of the chain.
+ *      from, to: the segments ending at entries from ... to-1 of
+ *                geoNodes are added.
+ *      last: 1 to add the segment ending at the target of the edge.
+ *
+ *  Return: extra cost, DBL_MAX if closed.
+ */
+static double chainExtra(const overlay_t *overlay, uint32_t j, uint32_t from,
+                         uint32_t to, uint8_t last){
+    double extra = 0., e;
+    uint32_t k;
+
+    for(k=from; k<to+last; k++){
+        e = segmentExtra(overlay,k < to ? k : overlay->graph->nGeo+j,j);
+        if(e == DBL_MAX)
+            return DBL_MAX;
+        extra += e;
+    }
+    return extra;
+}
+
+/*  BUILDTABLES
+ *
+ *  Fills the tables of an overlay from the changes read: the last
+ *  factor of each segment, the cost of each edge holding changed
+ *  segments, and the same cost at the position of the edge in the
+ *  reverse adjacency. graph_reverse lists the edges coming from a node
+ *  in the order they have in the successors of that node, so the k-th
+ *  parallel edge from u to v is the k-th entry of u among the
+ *  predecessors of v.
+ *
+ *  Input:
+ *      overlay: overlay to fill.
+ *      changes: changes read.
+ */
+static void buildTables(overlay_t *overlay, const overlayChanges_t *changes){
+    const graph_t *graph = overlay->graph;
+    overlayTable_t *segments = &overlay->segments, *edges = &overlay->edges;
+    uint32_t i, j, u, v, r, rank, slot;
+    double cost;
+
+    tableCreate(segments,changes->n);
+    for(i=0; i<changes->n; i++){
+        slot = tableSlot(segments,changes->keys[i],changes->factors[i]);
+        segments->values[slot] = changes->factors[i];
+    }
+
+    /* Edges: stored weight plus the extra cost of their segments */
+    tableCreate(edges,segments->count);
+    for(i=0; i<segments->nSlots; i++){
+        if(segments->keys[i] == UINT32_MAX || segments->values[i] == 1.f)
+            continue;
+        j = segments->keys[i] >= graph->nGeo ? segments->keys[i]-graph->nGeo :
+                                               graph_geo_edge(graph,segments->keys[i]);
+        slot = tableSlot(edges,j,graph->weights[j]);
+        if(edges->values[slot] == OVERLAY_BLOCKED)
+            continue;
+        cost = segmentExtra(overlay,segments->keys[i],j);
+        cost = cost == DBL_MAX ? DBL_MAX : edges->values[slot]+cost;
+        edges->values[slot] = cost < OVERLAY_BLOCKED ? (float) cost : OVERLAY_BLOCKED;
+    }
+
+    /* Reverse positions of the changed edges */
+    tableCreate(&overlay->rEdges,edges->count);
+    for(i=0; i<edges->nSlots; i++){
+        if(edges->keys[i] == UINT32_MAX)
+            continue;
+        j = edges->keys[i];
+        u = graph_edge_source(graph,j);
+        v = graph->successors[j];
+        for(rank=0, r=graph->offsets[u]; r<j; r++)
+            rank += graph->successors[r] == v;
+        for(r=graph->rOffsets[v]; r<graph->rOffsets[v+1]; r++)
+            if(graph->rSources[r] == u && rank-- == 0){
+                tableSlot(&overlay->rEdges,r,edges->values[i]);
+                break;
+            }
+    }
+}
+
+/*  LOADOVERLAY
+ *
+ *  Reads the edge cost changes of a graph from a text file. Each line
+ *  holds two node ids and either a factor of at least 1 multiplying
+ *  the cost of the segment between them, or "blocked" to close it:
+ *      fromId toId factor|blocked
+ *  separated by blanks, commas, semicolons or '|'. The change applies
+ *  to the segment from the first node to the second one only; empty
+ *  lines and lines starting with '#' are skipped, and a later line for
+ *  the same segment replaces the earlier one. Lines whose segment is
+ *  not in the graph are reported and skipped. On a simplified graph
+ *  the extra cost of a segment is added to the edge whose chain holds
+ *  it, and to the start and target offsets of searches starting or
+ *  ending inside the chain.
+ *
+ *  Input:
+ *      overlay: overlay to fill.
+ *      graph: graph of the segments.
+ *      filename: name of the input file.
+ *
+ *  Return: 0 if successfull, 1 if the file can not be read or a line
+ *          is not valid.
+ */
+int loadOverlay(overlay_t *overlay, const graph_t *graph, const char *filename){
+    FILE *in;
+    char line[OVERLAY_LINE], word[32], *p, *end;
+    uint32_t fromId, toId, u, v;
+    uint64_t lineNo = 0;
+    overlayChanges_t changes = {NULL, NULL, 0, 0};
+    double factor;
+    int ret = 0;
+
+    memset(overlay,0,sizeof(overlay_t));
+    overlay->graph = graph;
+    in = fopen(filename,"r");
+    if(in == NULL){
+        fprintf(stderr,"Could not open overlay file %s.\n",filename);
+        return 1;
+    }
+    while(ret == 0 && fgets(line,OVERLAY_LINE,in) != NULL){
+        lineNo++;
+        p = line+strspn(line," \t\r\n");
+        if(*p == '\0' || *p == '#')
+            continue;
+        if(sscanf(p,"%"SCNu32"%*[ \t,;|]%"SCNu32"%*[ \t,;|]%31s",&fromId,&toId,word) != 3){
+            fprintf(stderr,"ERROR: Can not parse overlay line %"PRIu64".\n",lineNo);
+            ret = 1;
+            break;
+        }
+        if(strcmp(word,"blocked") == 0)
+            factor = OVERLAY_BLOCKED;
+        else{
+            factor = strtod(word,&end);
+            //A factor below 1 would make the heuristics overestimate
+            if(*end != '\0' || !(factor >= 1.)){
+                fprintf(stderr,"ERROR: Overlay line %"PRIu64" needs a factor of at least 1 or \"blocked\".\n",
+                        lineNo);
+                ret = 1;
+                break;
+            }
+            if(factor >= OVERLAY_BLOCKED)
+                factor = OVERLAY_BLOCKED;
+        }
+        u = graph_find(graph,fromId);
+        v = graph_find(graph,toId);
+        if(u == UINT32_MAX || v == UINT32_MAX ||
+           findSegments(graph,u,v,(float) factor,&changes) == 0)
+            fprintf(stderr,"Overlay line %"PRIu64": no segment from %"PRIu32" to %"PRIu32", skipped.\n",
+                    lineNo,fromId,toId);
+        else
+            overlay->nLines++;
+    }
+    fclose(in);
+    if(ret == 0)
+        buildTables(overlay,&changes);
+    free(changes.keys);
+    free(changes.factors);
+    return ret;
+}
+
+/*  FREEOVERLAY
+ *
+ *  Frees the tables of an overlay.
+ *
+ *  Input:
+ *      overlay: overlay to free.
+ */
+void freeOverlay(overlay_t *overlay){
+    free(overlay->segments.keys);
+    free(overlay->segments.values);
+    free(overlay->edges.keys);
+    free(overlay->edges.values);
+    free(overlay->rEdges.keys);
+    free(overlay->rEdges.values);
+}
+
+/*  OVERLAYENDS
+ *
+ *  Applies an overlay to the ends of a node (see graph_ends): the
+ *  offset of each end grows by the extra cost of the segments of the
+ *  chain between the node and the end, and ends behind a closed
+ *  segment are dropped.
+ *
+ *  Input:
+ *      overlay: overlay to apply.
+ *      node: position of the node.
+ *      asTarget: 1 if the path ends at the node, 0 if it starts.
+ *      ends, offsets: ends of the node from graph_ends, updated.
+ *      n: number of ends.
+ *
+ *  Return: number of ends left.
+ */
+uint8_t overlayEnds(const overlay_t *overlay, uint32_t node, uint8_t asTarget,
+                    uint32_t ends[2], double offsets[2], uint8_t n){
+    const graph_t *graph = overlay->graph;
+    uint32_t edges[2], geo[2];
+    uint8_t i, kept = 0;
+    double extra;
+
+    if(node < graph->nKept)
+        return n;
+    //Same edges, in the same order, as graph_ends
+    graph_chain_edges(graph,node,edges,geo);
+    for(i=0; i<n; i++){
+        if(asTarget)
+            extra = chainExtra(overlay,edges[i],graph->geoOffsets[edges[i]],geo[i]+1,0);
+        else
+            extra = chainExtra(overlay,edges[i],geo[i]+1,graph->geoOffsets[edges[i]+1],1);
+        if(extra == DBL_MAX)
+            continue;
+        ends[kept] = ends[i];
+        offsets[kept++] = offsets[i]+extra;
+    }
+    return kept;
+}
+
+/*  OVERLAYCHAINDISTANCE
+ *
+ *  Applies an overlay to the path directly along a chain between two
+ *  nodes (see graph_chain_distance).
+ *
+ *  Input:
+ *      overlay: overlay to apply.
+ *      start, target: positions of the nodes.
+ *      distance: length of the path along the chain, updated.
+ *
+ *  Return: 1 if the path is still open, 0 if it is closed.
+ */
+int overlayChainDistance(const overlay_t *overlay, uint32_t start, uint32_t target,
+                         double *distance){
+    uint32_t ks, kt;
+    double extra;
+
+    if(!graph_chain_span(overlay->graph,start,target,&ks,&kt))
+        return 1;
+    extra = chainExtra(overlay,graph_geo_edge(overlay->graph,ks),ks+1,kt+1,0);
+    if(extra == DBL_MAX)
+        return 0;
+    *distance += extra;
+    return 1;
+}
+
+/*  READOVERLAY
+ *
+ *  Reads a new overlay for a holder, with the holder's own reference.
+ *
+ *  Input:
+ *      holder: holder of the overlay.
+ *
+ *  Return: the overlay, NULL if it could not be read.
+ */
+static overlay_t *readOverlay(overlayHolder_t *holder){
+    overlay_t *overlay;
+    struct stat st;
+
+    if(stat(holder->filename,&st) == 0)
+        holder->mtime = st.st_mtim;
+    overlay = malloc(sizeof(overlay_t)); assert(overlay);
+    if(loadOverlay(overlay,holder->graph,holder->filename) != 0){
+        freeOverlay(overlay);
+        free(overlay);
+        return NULL;
+    }
+    overlay->refs = 1;
+    fprintf(stderr,"Overlay %s: %"PRIu32" changes, %"PRIu32" edges\n",
+            holder->filename,overlay->nLines,overlay->edges.count);
+    return overlay;
+}
+
+/*  OVERLAYHOLDEROPEN
+ *
+ *  Reads the first overlay of a holder.
+ *
+ *  Input:
+ *      holder: holder to initialize.
+ *      graph: graph of the overlays.
+ *      filename: file the overlays are read from.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int overlayHolderOpen(overlayHolder_t *holder, const graph_t *graph,
+                      const char *filename){
+    holder->graph = graph;
+    holder->filename = filename;
+    memset(&holder->mtime,0,sizeof(holder->mtime));
+    holder->current = readOverlay(holder);
+    if(holder->current == NULL)
+        return 1;
+    pthread_mutex_init(&holder->lock,NULL);
+    return 0;
+}
+
+/*  OVERLAYACQUIRE
+ *
+ *  Takes a reference to the current overlay of a holder.
+ *
+ *  Input:
+ *      holder: holder of the overlay.
+ *
+ *  Return: the overlay, to be given back with overlayRelease.
+ */
+overlay_t *overlayAcquire(overlayHolder_t *holder){
+    overlay_t *overlay;
+
+    pthread_mutex_lock(&holder->lock);
+    overlay = holder->current;
+    overlay->refs++;
+    pthread_mutex_unlock(&holder->lock);
+    return overlay;
+}
+
+/*  OVERLAYRELEASE
+ *
+ *  Drops a reference taken by overlayAcquire, freeing the overlay if
+ *  it was replaced and this was its last reference.
+ *
+ *  Input:
+ *      holder: holder of the overlay.
+ *      overlay: overlay to give back.
+ */
+void overlayRelease(overlayHolder_t *holder, overlay_t *overlay){
+    uint32_t refs;
+
+    pthread_mutex_lock(&holder->lock);
+    refs = --overlay->refs;
+    pthread_mutex_unlock(&holder->lock);
+    if(refs == 0){
+        freeOverlay(overlay);
+        free(overlay);
+    }
+}
+
+/*  OVERLAYREFRESH
+ *
+ *  Reloads the overlay of a holder if its file was modified since it
+ *  was read. Searches holding the old overlay keep it until they
+ *  release it. If the new file can not be read, the old overlay stays.
+ *
+ *  Input:
+ *      holder: holder of the overlay.
+ *
+ *  Return: 1 if a new overlay was loaded, 0 otherwise.
+ */
+int overlayRefresh(overlayHolder_t *holder){
+    overlay_t *overlay, *old;
+    struct stat st;
+
+    if(stat(holder->filename,&st) != 0 ||
+       (st.st_mtim.tv_sec == holder->mtime.tv_sec && st.st_mtim.tv_nsec == holder->mtime.tv_nsec))
+        return 0;
+    overlay = readOverlay(holder);
+    if(overlay == NULL){
+        fprintf(stderr,"Keeping the previous overlay.\n");
+        return 0;
+    }
+    pthread_mutex_lock(&holder->lock);
+    old = holder->current;
+    holder->current = overlay;
+    pthread_mutex_unlock(&holder->lock);
+    //Drop the reference of the holder
+    overlayRelease(holder,old);
+    return 1;
+}
+
+/*  OVERLAYHOLDERCLOSE
+ *
+ *  Frees the current overlay of a holder. No reference may be left.
+ *
+ *  Input:
+ *      holder: holder to close.
+ */
+void overlayHolderClose(overlayHolder_t *holder){
+    overlayRelease(holder,holder->current);
+    pthread_mutex_destroy(&holder->lock);
+}
@@ -0,0 +1,230 @@
+#pragma once
+#include "graph.h"
+#include <float.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#define OVERLAY_BLOCKED FLT_MAX     //Factor and cost of a closed edge
+#define OVERLAY_LINE 256            //Longest line of an overlay file
+
+/*Open addressing table from a position to a value. Slots with key
+ *UINT32_MAX are free; nSlots is a power of 2, 0 if the table is empty.
+ */
+typedef struct overlayTable_s{
+    uint32_t nSlots;        //Number of slots
+    uint32_t count;         //Used slots
+    uint32_t *keys;         //Key of each slot
+    float *values;          //Value of each slot
+} overlayTable_t;
+
+/*Changes of the edge costs of a graph, applied by the searches on top
+ *of the stored weights. Costs only grow, so every heuristic bound of
+ *the graph (haversine, chord, landmarks) stays a lower bound.
+ *A segment is the step between two consecutive nodes of the full
+ *graph: an edge of a graph that is not simplified, or a piece of the
+ *chain of an edge of a simplified one. Segments are keyed by the entry
+ *of geoNodes they end at, or by nGeo+j for the one ending at the
+ *target of edge j.
+ */
+typedef struct overlay_s{
+    const graph_t *graph;   //Graph the overlay belongs to
+    uint32_t nLines;        //Changes read from the file
+    overlayTable_t segments;//Factor of each changed segment
+    overlayTable_t edges;   //Cost of each changed edge, by position
+    overlayTable_t rEdges;  //Same, by position in the reverse adjacency
+    uint32_t refs;          //Holders of the overlay (see overlayHolder_t)
+} overlay_t;
+
+/*Overlay shared by running searches and replaced when its file changes.
+ *Searches take a reference to the current overlay and keep it until
+ *they finish, so a reload never changes the costs under a search; the
+ *old overlay is freed when its last reference is dropped.
+ */
+typedef struct overlayHolder_s{
+    pthread_mutex_t lock;   //Guards current and the references
+    overlay_t *current;     //Overlay given to new searches
+    const graph_t *graph;   //Graph of the overlays
+    const char *filename;   //File the overlay is read from
+    struct timespec mtime;  //Modification time of the file read
+} overlayHolder_t;
+
+/*  OVERLAYACTIVE
+ *
+ *  Overlay to apply, if it changes any edge.
+ *
+ *  Input:
+ *      overlay: overlay, or NULL.
+ *
+ *  Return: the overlay, NULL if it is NULL or empty.
+ */
+static inline const overlay_t *overlayActive(const overlay_t *overlay){
+    return overlay != NULL && overlay->edges.count > 0 ? overlay : NULL;
+}
+
+/*  OVERLAYFIND
+ *
+ *  Value of a key of an overlay table.
+ *
+ *  Input:
+ *      table: table to look in.
+ *      key: key to look for.
+ *      value: value returned if the key is not in the table.
+ *
+ *  Return: the value of the key.
+ */
+static inline float overlayFind(const overlayTable_t *table, uint32_t key,
+                                float value){
+    uint32_t slot;
+
+    if(table->count == 0)
+        return value;
+    for(slot=(key*2654435761u)&(table->nSlots-1); table->keys[slot]!=UINT32_MAX;
+        slot=(slot+1)&(table->nSlots-1))
+        if(table->keys[slot] == key)
+            return table->values[slot];
+    return value;
+}
+
+/*  OVERLAYCOST
+ *
+ *  Cost of an edge with the overlay.
+ *
+ *  Input:
+ *      overlay: overlay to apply.
+ *      backward: 1 for a position in the reverse adjacency.
+ *      i: position of the edge.
+ *      weight: stored weight of the edge.
+ *
+ *  Return: cost of the edge, OVERLAY_BLOCKED if closed.
+ */
+static inline float overlayCost(const overlay_t *overlay, uint8_t backward,
+                                uint32_t i, float weight){
+    return overlayFind(backward ? &overlay->rEdges : &overlay->edges,i,weight);
+}
+
+/*  LOADOVERLAY
+ *
+ *  Reads the edge cost changes of a graph from a text file. Each line
+ *  holds two node ids and either a factor of at least 1 multiplying
+ *  the cost of the segment between them, or "blocked" to close it:
+ *      fromId toId factor|blocked
+ *  separated by blanks, commas, semicolons or '|'. The change applies
+ *  to the segment from the first node to the second one only; empty
+ *  lines and lines starting with '#' are skipped, and a later line for
+ *  the same segment replaces the earlier one. Lines whose segment is
+ *  not in the graph are reported and skipped. On a simplified graph
+ *  the extra cost of a segment is added to the edge whose chain holds
+ *  it, and to the start and target offsets of searches starting or
+ *  ending inside the chain.
+ *
+ *  Input:
+ *      overlay: overlay to fill.
+ *      graph: graph of the segments.
+ *      filename: name of the input file.
+ *
+ *  Return: 0 if successfull, 1 if the file can not be read or a line
+ *          is not valid.
+ */
+int loadOverlay(overlay_t *overlay, const graph_t *graph, const char *filename);
+
+/*  FREEOVERLAY
+ *
+ *  Frees the tables of an overlay.
+ *
+ *  Input:
+ *      overlay: overlay to free.
+ */
+void freeOverlay(overlay_t *overlay);
+
+/*  OVERLAYENDS
+ *
+ *  Applies an overlay to the ends of a node (see graph_ends): the
+ *  offset of each end grows by the extra cost of the segments of the
+ *  chain between the node and the end, and ends behind a closed
+ *  segment are dropped.
+ *
+ *  Input:
+ *      overlay: overlay to apply.
+ *      node: position of the node.
+ *      asTarget: 1 if the path ends at the node, 0 if it starts.
+ *      ends, offsets: ends of the node from graph_ends, updated.
+ *      n: number of ends.
+ *
+ *  Return: number of ends left.
+ */
+uint8_t overlayEnds(const overlay_t *overlay, uint32_t node, uint8_t asTarget,
+                    uint32_t ends[2], double offsets[2], uint8_t n);
+
+/*  OVERLAYCHAINDISTANCE
+ *
+ *  Applies an overlay to the path directly along a chain between two
+ *  nodes (see graph_chain_distance).
+ *
+ *  Input:
+ *      overlay: overlay to apply.
+ *      start, target: positions of the nodes.
+ *      distance: length of the path along the chain, updated.
+ *
+ *  Return: 1 if the path is still open, 0 if it is closed.
+ */
+int overlayChainDistance(const overlay_t *overlay, uint32_t start, uint32_t target,
+                         double *distance);
+
+/*  OVERLAYHOLDEROPEN
+ *
+ *  Reads the first overlay of a holder.
+ *
+ *  Input:
+ *      holder: holder to initialize.
+ *      graph: graph of the overlays.
+ *      filename: file the overlays are read from.
+ *
+ *  Return: 0 if successfull, 1 otherwise.
+ */
+int overlayHolderOpen(overlayHolder_t *holder, const graph_t *graph,
+                      const char *filename);
+
+/*  OVERLAYACQUIRE
+ *
+ *  Takes a reference to the current overlay of a holder.
+ *
+ *  Input:
+ *      holder: holder of the overlay.
+ *
+ *  Return: the overlay, to be given back with overlayRelease.
+ */
+overlay_t *overlayAcquire(overlayHolder_t *holder);
+
+/*  OVERLAYRELEASE
+ *
+ *  Drops a reference taken by overlayAcquire, freeing the overlay if
+ *  it was replaced and this was its last reference.
+ *
+ *  Input:
+ *      holder: holder of the overlay.
+ *      overlay: overlay to give back.
+ */
+void overlayRelease(overlayHolder_t *holder, overlay_t *overlay);
+
+/*  OVERLAYREFRESH
+ *
+ *  Reloads the overlay of a holder if its file was modified since it
+ *  was read. Searches holding the old overlay keep it until they
+ *  release it. If the new file can not be read, the old overlay stays.
+ *
+ *  Input:
+ *      holder: holder of the overlay.
+ *
+ *  Return: 1 if a new overlay was loaded, 0 otherwise.
+ */
+int overlayRefresh(overlayHolder_t *holder);
+
+/*  OVERLAYHOLDERCLOSE
+ *
+ *  Frees the current overlay of a holder. No reference may be left.
+ *
+ *  Input:
+ *      holder: holder to close.
+ */
+void overlayHolderClose(overlayHolder_t *holder);
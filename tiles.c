@@ -0,0 +1,236 @@
+#include "tiles.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*  ADVISERANGE
+ *
+ *  Gives advice on the pages of a range of a section. Pages are paged
+ *  in from the first one touching the range to the last one, but only
+ *  dropped if they lie inside it, since the tiles next to it share the
+ *  pages at its ends.
+ *
+ *  Input:
+ *      pager: pager of the tiles.
+ *      base: start of the section.
+ *      elemSize: size of each element.
+ *      first, last: range of elements, last excluded.
+ *      advice: MADV_WILLNEED or MADV_DONTNEED.
+ */
+static void adviseRange(const tilePager_t *pager, const void *base, size_t elemSize,
+                        uint64_t first, uint64_t last, int advice){
+    uintptr_t start, end;
+
+    if(base == NULL || first >= last)
+        return;
+    start = (uintptr_t) base+first*elemSize;
+    end = (uintptr_t) base+last*elemSize;
+    if(advice == MADV_DONTNEED){
+        start = (start+pager->pageSize-1) & ~(pager->pageSize-1);
+        end &= ~(pager->pageSize-1);
+    }else{
+        start &= ~(pager->pageSize-1);
+        end = (end+pager->pageSize-1) & ~(pager->pageSize-1);
+    }
+    if(start < end)
+        madvise((void *) start,end-start,advice);
+}
+
+/*  ADVISETILE
+ *
+ *  Gives advice on the data of a tile searches read: its nodes, the
+ *  edges and reverse edges of its nodes, its boundary edges and the
+ *  chains of its edges.
+ *  Names are left to the output.
+ *
+ *  Input:
+ *      pager: pager of the tiles.
+ *      tile: tile to advise on.
+ *      advice: MADV_WILLNEED or MADV_DONTNEED.
+ */
+static void adviseTile(const tilePager_t *pager, uint32_t tile, int advice){
+    const graph_t *graph = pager->graph;
+    const graphTile_t *t = &graph->tiles[tile], *next = t+1;
+
+    adviseRange(pager,graph->offsets,sizeof(uint32_t),t->firstNode,next->firstNode+1,advice);
+    adviseRange(pager,graph->rOffsets,sizeof(uint32_t),t->firstNode,next->firstNode+1,advice);
+    adviseRange(pager,graph->ids,sizeof(uint32_t),t->firstNode,next->firstNode,advice);
+    adviseRange(pager,graph->lat,sizeof(int32_t),t->firstNode,next->firstNode,advice);
+    adviseRange(pager,graph->lon,sizeof(int32_t),t->firstNode,next->firstNode,advice);
+    adviseRange(pager,graph->unit,3*sizeof(double),t->firstNode,next->firstNode,advice);
+    adviseRange(pager,graph->successors,sizeof(uint32_t),t->firstEdge,next->firstEdge,advice);
+    adviseRange(pager,graph->weights,sizeof(float),t->firstEdge,next->firstEdge,advice);
+    adviseRange(pager,graph->rSources,sizeof(uint32_t),t->firstREdge,next->firstREdge,advice);
+    adviseRange(pager,graph->rWeights,sizeof(float),t->firstREdge,next->firstREdge,advice);
+    adviseRange(pager,graph->tileBoundary,sizeof(uint32_t),
+                t->firstBoundary,next->firstBoundary,advice);
+    adviseRange(pager,graph->tileRBoundary,sizeof(uint32_t),
+                t->firstRBoundary,next->firstRBoundary,advice);
+    if(graph->geoOffsets != NULL){
+        adviseRange(pager,graph->geoOffsets,sizeof(uint32_t),t->firstEdge,next->firstEdge+1,advice);
+        adviseRange(pager,graph->geoNodes,sizeof(uint32_t),t->firstGeo,next->firstGeo,advice);
+        adviseRange(pager,graph->geoDist,sizeof(float),t->firstGeo,next->firstGeo,advice);
+        if(next->firstNode > graph->nKept)
+            adviseRange(pager,graph->chainGeo,sizeof(uint32_t),
+                        (t->firstNode > graph->nKept ? t->firstNode : graph->nKept)-graph->nKept,
+                        next->firstNode-graph->nKept,advice);
+    }
+}
+
+/*  TILEFAULT
+ *
+ *  Pages in a tile that was absent when touched, dropping another one
+ *  if the pager is full.
+ *
+ *  Input:
+ *      pager: pager of the tiles.
+ *      tile: tile to page in.
+ *
+ *  Return: 1 if the tile was paged in, 0 if another thread did it.
+ */
+uint8_t tileFault(tilePager_t *pager, uint32_t tile){
+    uint32_t slot, victim;
+
+    pthread_mutex_lock(&pager->lock);
+    if(pager->state[tile] != TILE_ABSENT){
+        __atomic_store_n(&pager->state[tile],TILE_REFERENCED,__ATOMIC_RELAXED);
+        pthread_mutex_unlock(&pager->lock);
+        return 0;
+    }
+    if(pager->nResident < pager->capacity)
+        slot = pager->nResident++;
+    else{
+        //Clock: tiles touched since the hand last passed get another turn
+        for(;;){
+            victim = pager->slots[pager->hand];
+            if(__atomic_exchange_n(&pager->state[victim],TILE_RESIDENT,__ATOMIC_RELAXED) != TILE_REFERENCED)
+                break;
+            pager->hand = (pager->hand+1)%pager->capacity;
+        }
+        __atomic_store_n(&pager->state[victim],TILE_ABSENT,__ATOMIC_RELAXED);
+        adviseTile(pager,victim,MADV_DONTNEED);
+        pager->evictions++;
+        slot = pager->hand;
+        pager->hand = (pager->hand+1)%pager->capacity;
+    }
+    adviseTile(pager,tile,MADV_WILLNEED);
+    pager->slots[slot] = tile;
+    __atomic_store_n(&pager->state[tile],TILE_REFERENCED,__ATOMIC_RELAXED);
+    pager->faults++;
+    pthread_mutex_unlock(&pager->lock);
+    return 1;
+}
+
+/*  TILETOUCHEXPAND
+ *
+ *  Marks the tile of an expanded node as used and the tiles its edges
+ *  cross into, paging in the absent ones. The edges leaving the tile
+ *  are read from its boundary table, so edges inside the tile cost
+ *  nothing.
+ *
+ *  Input:
+ *      pager: pager of the tiles.
+ *      node: position of the node.
+ *      reverse: 1 to follow the reverse edges, 0 the forward ones.
+ *
+ *  Return: number of tile faults.
+ */
+uint32_t tileTouchExpand(tilePager_t *pager, uint32_t node, uint8_t reverse){
+    const graph_t *graph = pager->graph;
+    const graphTile_t *tile = &graph->tiles[node >> graph->tileBits];
+    const uint32_t *boundary, *offsets, *adjacent;
+    uint32_t faults = tileTouch(pager,node), first, last, low, high, mid;
+
+    if(reverse){
+        boundary = graph->tileRBoundary;
+        offsets = graph->rOffsets;
+        adjacent = graph->rSources;
+        first = tile->firstRBoundary;
+        last = tile[1].firstRBoundary;
+    }else{
+        boundary = graph->tileBoundary;
+        offsets = graph->offsets;
+        adjacent = graph->successors;
+        first = tile->firstBoundary;
+        last = tile[1].firstBoundary;
+    }
+    //First boundary edge of the node: the table is in edge order
+    low = first;
+    high = last;
+    while(low < high){
+        mid = low+(high-low)/2;
+        if(boundary[mid] < offsets[node])
+            low = mid+1;
+        else
+            high = mid;
+    }
+    for(; low<last && boundary[low]<offsets[node+1]; low++)
+        faults += tileTouch(pager,adjacent[boundary[low]]);
+    return faults;
+}
+
+/*  TILEPAGEROPEN
+ *
+ *  Starts paging the tiles of a mapped graph, with none resident.
+ *
+ *  Input:
+ *      pager: pager to initialize.
+ *      graph: graph opened by graph_open with a tile directory.
+ *      capacity: most tiles resident at once.
+ *
+ *  Return: 0 if successfull, 1 if the graph has no tiles.
+ */
+int tilePagerOpen(tilePager_t *pager, const graph_t *graph, uint32_t capacity){
+    memset(pager,0,sizeof(tilePager_t));
+    if(graph->nTiles == 0 || graph->map == NULL){
+        fprintf(stderr,"Graph has no tiles. Rebuild it with makeGraph -T.\n");
+        return 1;
+    }
+    pager->graph = graph;
+    pager->capacity = capacity > 0 ? capacity : 1;
+    pager->state = calloc(graph->nTiles,sizeof(uint8_t)); assert(pager->state);
+    pager->slots = malloc(sizeof(uint32_t)*pager->capacity); assert(pager->slots);
+    pager->pageSize = sysconf(_SC_PAGESIZE);
+    pthread_mutex_init(&pager->lock,NULL);
+    //Only the pages touched are read: the tiles bring their own
+    madvise(graph->map,graph->mapSize,MADV_RANDOM);
+    tilePagerTrim(pager);
+    return 0;
+}
+
+/*  TILEPAGERTRIM
+ *
+ *  Drops the pages of the graph outside the resident tiles, such as
+ *  the ones read while the searches were set up.
+ *
+ *  Input:
+ *      pager: pager of the tiles.
+ */
+void tilePagerTrim(tilePager_t *pager){
+    uint32_t i;
+
+    pthread_mutex_lock(&pager->lock);
+    madvise(pager->graph->map,pager->graph->mapSize,MADV_DONTNEED);
+    for(i=0; i<pager->nResident; i++)
+        adviseTile(pager,pager->slots[i],MADV_WILLNEED);
+    pthread_mutex_unlock(&pager->lock);
+}
+
+/*  TILEPAGERCLOSE
+ *
+ *  Frees the memory of a pager. The graph stays mapped.
+ *
+ *  Input:
+ *      pager: pager to close.
+ */
+void tilePagerClose(tilePager_t *pager){
+    if(pager->graph == NULL)
+        return;
+    madvise(pager->graph->map,pager->graph->mapSize,MADV_NORMAL);
+    free(pager->state);
+    free(pager->slots);
+    pthread_mutex_destroy(&pager->lock);
+}
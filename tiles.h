@@ -0,0 +1,116 @@
+#pragma once
+#include "graph.h"
+#include <inttypes.h>
+#include <pthread.h>
+
+/*States of a tile */
+enum tileState {TILE_ABSENT, TILE_RESIDENT, TILE_REFERENCED};
+
+/*Tiles of a mapped graph kept resident for the searches. A search
+ *touches the tile of every node it expands and the tiles of its
+ *neighbours, whose coordinates and state it reads, found through the
+ *boundary edge tables of the graph; a tile touched while absent is
+ *paged in, and when capacity tiles are resident the least recently used
+ *one, approximated by a clock over the resident tiles, is dropped from
+ *memory. The bound is approximate: reads outside the searches, such as
+ *expanding and printing the path, are not counted, and with fewer tiles
+ *than the neighbours of a node span a touch may drop a tile still being
+ *read. Dropped pages are read again from the file if they are used, so
+ *the bound never changes a result. The pager may be shared by threads.
+ */
+typedef struct tilePager_s{
+    const graph_t *graph;   //Graph of the tiles
+    uint32_t capacity;      //Most tiles resident at once
+    uint8_t *state;         //State of each tile (enum tileState)
+    uint32_t *slots;        //Resident tiles, in clock order
+    uint32_t nResident;     //Used slots
+    uint32_t hand;          //Next slot looked at for a tile to drop
+    uint64_t faults;        //Tiles paged in
+    uint64_t evictions;     //Tiles dropped
+    size_t pageSize;        //Size of a memory page
+    pthread_mutex_t lock;   //Guards the slots, the hand and the counters
+} tilePager_t;
+
+/*  TILEFAULT
+ *
+ *  Pages in a tile that was absent when touched, dropping another one
+ *  if the pager is full.
+ *
+ *  Input:
+ *      pager: pager of the tiles.
+ *      tile: tile to page in.
+ *
+ *  Return: 1 if the tile was paged in, 0 if another thread did it.
+ */
+uint8_t tileFault(tilePager_t *pager, uint32_t tile);
+
+/*  TILETOUCH
+ *
+ *  Marks the tile of a node as used, paging it in if it is absent.
+ *
+ *  Input:
+ *      pager: pager of the tiles.
+ *      node: position of the node.
+ *
+ *  Return: 1 if the tile was paged in (a tile fault), 0 otherwise.
+ */
+static inline uint8_t tileTouch(tilePager_t *pager, uint32_t node){
+    uint32_t tile = node >> pager->graph->tileBits;
+    uint8_t state = __atomic_load_n(&pager->state[tile],__ATOMIC_RELAXED);
+
+    if(state == TILE_REFERENCED)
+        return 0;
+    if(state == TILE_RESIDENT){
+        __atomic_store_n(&pager->state[tile],TILE_REFERENCED,__ATOMIC_RELAXED);
+        return 0;
+    }
+    return tileFault(pager,tile);
+}
+
+/*  TILETOUCHEXPAND
+ *
+ *  Marks the tile of an expanded node as used and the tiles its edges
+ *  cross into, paging in the absent ones. The edges leaving the tile
+ *  are read from its boundary table, so edges inside the tile cost
+ *  nothing.
+ *
+ *  Input:
+ *      pager: pager of the tiles.
+ *      node: position of the node.
+ *      reverse: 1 to follow the reverse edges, 0 the forward ones.
+ *
+ *  Return: number of tile faults.
+ */
+uint32_t tileTouchExpand(tilePager_t *pager, uint32_t node, uint8_t reverse);
+
+/*  TILEPAGEROPEN
+ *
+ *  Starts paging the tiles of a mapped graph, with none resident.
+ *
+ *  Input:
+ *      pager: pager to initialize.
+ *      graph: graph opened by graph_open with a tile directory.
+ *      capacity: most tiles resident at once.
+ *
+ *  Return: 0 if successfull, 1 if the graph has no tiles.
+ */
+int tilePagerOpen(tilePager_t *pager, const graph_t *graph, uint32_t capacity);
+
+/*  TILEPAGERTRIM
+ *
+ *  Drops the pages of the graph outside the resident tiles, such as
+ *  the ones read while the searches were set up.
+ *
+ *  Input:
+ *      pager: pager of the tiles.
+ */
+void tilePagerTrim(tilePager_t *pager);
+
+/*  TILEPAGERCLOSE
+ *
+ *  Frees the memory of a pager. The graph stays mapped.
+ *
+ *  Input:
+ *      pager: pager to close.
+ */
+void tilePagerClose(tilePager_t *pager);